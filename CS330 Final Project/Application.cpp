@@ -8,18 +8,65 @@
 				 on the right side and a green one on the left.
 
 	Controls:
+	Left click -					[Print the object, triangle and texture coordinate under the
+									 middle of the screen]
 	WASD -							[Control forward and side movement of camera]
 	Mouse -							[Control panning of camera]
-	ScrollWheel -					[Control speed of movement]
+	ScrollWheel -					[Control speed of movement, in units per second]
 	E -								[Increase camera's Z axis]
 	Q -								[Decrease camera's Z axis]
 	P -								[*Sensitive to press* Changes Projection]
 
+	Command line:
+	--headless [frames] -			[Render N frames (default 300) to an offscreen framebuffer in a hidden
+									 window and print CPU/GPU frame time percentiles, then exit. The
+									 window is never shown but still needs a desktop session]
+	--bench-lights [frames] -		[Headless run of the clustered lighting path with 2 to 1024 point
+									 lights, then exit]
+	--bench-instances [frames] -	[Headless run with 1024 to 65536 extra instanced cubes on the table,
+									 then exit]
+	--bench-flip [iterations] -		[Times vertical flips of a 4K RGBA image without creating a window,
+									 then exit]
+	--bench-pick [rays] -			[Picks a grid of points on the headless frame, then times rays against
+									 a million-triangle cylinder, then exit]
+	--bench-occlusion [frames] -	[Frustum and occlusion culls a floor of desks full of books and cubes
+									 on the CPU, without creating a window, and prints the culling rates,
+									 then exit]
+	--bench-transforms [frames] -	[Moves a few of a thousand copies of the scene every frame on the CPU,
+									 without creating a window, and times updating only what moved
+									 against recomputing every world matrix, then exit]
+	--bench-lod [frames] -			[Moves the camera towards and away from a cylinder on the CPU, without
+									 creating a window, and prints the level of detail drawn and its
+									 triangles, then exit]
+	--no-occlusion-cull -			[Draw everything inside the view frustum, without testing it against
+									 the scene's occluders first]
+	--no-texture-cache -			[Decode the source images every run instead of using the BC1/BC3
+									 copies in Resources/TextureCache]
+	--no-shader-cache -				[Compile the shaders from source every run instead of loading the
+									 linked program binaries in Resources/ShaderCache]
+	--no-parallel-shaders -			[Compile the shaders on the main thread even when the driver supports
+									 KHR_parallel_shader_compile; the scene is still drawn with the
+									 fallback program until they are ready]
+	--scene <file.scene> -			[Load another scene text file instead of Resources/Scenes/table.scene,
+									 compiled next to it as .uscene]
+	--no-vsync -					[Present frames as fast as possible instead of at the display's
+									 refresh rate; the simulation still steps at 60 Hz]
+	--no-packed-vertices -			[Keep the 32-byte float vertices instead of the 16-byte quantized
+									 ones on the GPU]
+	--no-bindless -					[Sample materials from the texture array even when
+									 ARB_bindless_texture and NV_gpu_shader5 are available]
+
 */
 
 // including libraries
 #include <iostream>
+#include <algorithm>
+#include <condition_variable>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 // #include <glad/glad.h>
@@ -36,6 +83,33 @@
 // cylinder class
 #include "Dependencies/cylinder/Cylinder.h"
 
+// frame timing for headless benchmark runs
+#include "Benchmark.h"
+// uniform locations resolved at link time
+#include "UniformCache.h"
+// std140 uniform block layouts shared with the shaders
+#include "ShaderBlocks.h"
+// clustered point-light assignment
+#include "ClusteredLights.h"
+// instanced unit meshes
+#include "MeshArena.h"
+// sort-keyed draw submission
+#include "DrawQueue.h"
+// texture array / bindless material lookup
+#include "MaterialLibrary.h"
+// threaded texture decoding and streamed uploads
+#include "TextureLoader.h"
+// row-swap image flips
+#include "ImageFlip.h"
+// textures, lights and instances loaded from the scene file
+#include "SceneFile.h"
+// render packets handed from the simulation thread to the GL thread
+#include "TripleBuffer.h"
+// parented scene transforms, recomputed only when they change
+#include "TransformHierarchy.h"
+// deduplicated shader programs and their cached binaries
+#include "ShaderRegistry.h"
+
 using namespace std;
 
 // Shader program macro
@@ -52,22 +126,34 @@ namespace
 	const int WINDOW_WIDTH = 800;
 	const int WINDOW_HEIGHT = 600;
 
-	// Declaring unsigned ints for vertex array and buffer, as well as number of indices
-	struct GLMesh
-	{
-		GLuint vaos[2];
-		GLuint vbos[2];
-		GLuint nIndices;
-	};
-
 	// defining main window
 	GLFWwindow* gWindow = nullptr;
-	// Triangle mesh data
-	GLMesh gMesh;
-	// Texture IDs
-	GLuint texture0, texture1, texture2, texture3, texture4;
-	// defining both shader programs
+	// Unit meshes every prop in the scene is an instance of, added in SceneMesh order, and
+	// the model matrices and textures of those props
+	MeshArena gMeshes;
+	// Texture IDs, one per texture unit
+	GLuint gTextures[SCENE_TEXTURE_UNITS];
+	// Every material texture in one array (or bindless handle table), indexed per instance
+	MaterialLibrary gMaterials;
+	bool gBindless = true;
+	// Scene description: which textures, lights and instances to create
+	SceneFile gScene;
+	string gSceneTextPath = "../CS330 Final Project/Resources/Scenes/table.scene";
+	// Decodes the scene textures off the main thread, textures show a placeholder until uploaded
+	TextureLoader gTextureLoader;
+	// Compressed copies of the textures with precomputed mips, written on the first run
+	bool gTextureCache = true;
+	const char* const TEXTURE_CACHE_DIRECTORY = "../CS330 Final Project/Resources/TextureCache/";
+	// Linked programs shared by identical sources, their binaries kept for the next run
+	ShaderRegistry gShaders;
+	bool gShaderCache = true;
+	const char* const SHADER_CACHE_DIRECTORY = "../CS330 Final Project/Resources/ShaderCache/";
+	bool gParallelShaders = true;
+	// defining both shader programs, the same program while their sources match
 	GLuint gProgramId, gCylProgramId;
+	// Unlit program every object is drawn with until both programs above have linked
+	GLuint gFallbackProgramId = 0;
+	bool gShaderProgramsReady = false;
 
 	// global cam variables
 	glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 1.0f);
@@ -75,8 +161,71 @@ namespace
 	glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 
 	// deltaTime ensures all users have similar movement speed
-	float deltaTime = 0.0f;
-	float lastFrame = 0.0f;
+	double deltaTime = 0.0;
+	double lastFrame = 0.0;
+
+	// Camera and lights advance in fixed steps; each frame renders a blend of the last two steps
+	struct SimulationState
+	{
+		glm::vec3 cameraPos;
+		vector<glm::vec3> lightPositions;
+	};
+	SimulationState gPreviousState, gCurrentState;
+	const double SIMULATION_STEP = 1.0 / 60.0;
+	// longest frame the clock accepts, so a stall does not set off a burst of catch-up steps
+	const double MAX_FRAME_TIME = 0.25;
+	double gSimulationTime = 0.0;
+	// units per second at scrollSpeed 1, the old per-frame speed of 2.5 at 60 frames per second
+	const float CAMERA_SPEED = 150.0f;
+
+	// Input gathered on the main thread (GLFW only reports keys there) for the simulation thread
+	struct InputState
+	{
+		bool forward, backward, left, right, down, up;
+		glm::vec3 cameraFront;
+		float scrollSpeed;
+		bool perspective;
+	};
+	InputState gInput;
+	std::mutex gInputMutex;
+
+	// Everything URender needs for one frame, written by the simulation thread and only read
+	// by the GL thread. Instance lists are copied only when the scene's instances change.
+	struct RenderPacket
+	{
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::vec3 viewPosition;
+		vector<PointLight> lights;
+		vector<MeshInstance> instances[SCENE_MESH_COUNT];
+		unsigned int instancesVersion = 0;
+	};
+	TripleBuffer<RenderPacket> gRenderPackets;
+
+	// Scene instances owned by the simulation side, bumped version on every change
+	vector<MeshInstance> gSceneInstances[SCENE_MESH_COUNT];
+	unsigned int gSceneInstancesVersion = 0;
+	// Scene nodes and one node per scene instance; gSceneInstanceNodes[mesh][i] places gSceneInstances[mesh][i]
+	TransformHierarchy gSceneTransforms;
+	vector<uint32_t> gSceneInstanceNodes[SCENE_MESH_COUNT];
+	// version last streamed into gMeshes by the GL thread
+	unsigned int gUploadedInstancesVersion = 0;
+
+	// This frame's draws, sorted by program, mesh, material and depth before submission
+	DrawQueue gDrawQueue;
+	// sort key program indices, also the MeshArena pipeline of each mesh
+	const uint32_t OBJECT_PROGRAM_INDEX = 0;
+	const uint32_t CYLINDER_PROGRAM_INDEX = 1;
+	const uint32_t PROGRAM_INDEX_COUNT = 2;
+
+	// The simulation thread prepares one packet per frame the GL thread asks for
+	std::thread gSimulationThread;
+	std::mutex gFrameMutex;
+	std::condition_variable gFrameRequested;
+	unsigned long long gFramesRequested = 0;
+	bool gStopSimulation = false;
+	// wait for the display's refresh before presenting the next frame
+	bool gVsync = true;
 
 	// initial mouse coords
 	float lastX = 400, lastY = 300;
@@ -93,76 +242,201 @@ namespace
 	// Checking to see if projection was changed on last frame
 	bool lastFrameCheck = false;
 
-	// light color
-	glm::vec3 gLightColor(1.0f, 1.0f, 1.0f);
-	glm::vec3 gLightColor2(0.8f, 1.0f, 0.8f);
-
-	glm::vec3 pointLightColors[2] = {
-		glm::vec3(1.0f, 1.0f, 1.0f),
-		glm::vec3(0.5f, 1.0f, 0.5f)
-	};
-
-	// Light position and scale
-	float lX = 1.4f, lY = 0.04f, lZ = 3.5f; // Allows light source variables to be changed
-	glm::vec3 gLightPosition(lX, lY, lZ);
-	glm::vec3 gLightScale(0.3f);
-
 	// Cylinders
 	Cylinder cylinder1(1.0f, 1.1f, 2.0f, 360, 1);
 	Cylinder cylinder2(1.0f, 1.0f, 2.0f, 360, 1);
+
+	// Sectors of each cylinder level of detail, and the largest error in pixels a level may
+	// show (how far its flat sides fall inside the true circle) before a finer one is drawn
+	const int CYLINDER_LOD_SECTORS[] = { 360, 96, 32, 12 };
+	const float LOD_PIXEL_ERROR = 0.5f;
+
+	// Uniform handles of the object shader, resolved once after the program links.
+	// Camera and light data live in the shared FrameBlock/LightBlock uniform buffers, model
+	// matrices and material indices in each mesh's instance buffer.
+	struct ObjectProgramUniforms
+	{
+		UniformHandle<int> uMaterials;
+	};
+
+	UniformCache gUniformCache;
+	ObjectProgramUniforms gObjectUniforms, gCylUniforms;
+
+	// Uniform buffer bound to FRAME_BLOCK_BINDING for every program
+	GLuint gFrameUbo = 0;
+
+	// Scene point lights and their per-frame cluster assignment
+	vector<PointLight> gPointLights;
+	ClusterLightGrid gClusterGrid;
+
+	// Projection depth range, also used to slice the light clusters
+	const float NEAR_PLANE = 0.1f;
+	const float FAR_PLANE = 100.0f;
+
+	// CPU depth buffer the scene's occluders are drawn into, in pixels
+	const int OCCLUSION_WIDTH = 256;
+	const int OCCLUSION_HEIGHT = 192;
+	bool gOcclusionCulling = true;
+
+	// Vertices stored quantized to 16 bytes instead of 8 floats
+	bool gPackedVertices = true;
+
+	// Current framebuffer size
+	int gViewportWidth = WINDOW_WIDTH, gViewportHeight = WINDOW_HEIGHT;
+	// Camera of the last rendered frame, what a click is picked against
+	glm::mat4 gRenderedView(1.0f), gRenderedProjection(1.0f);
+
+	// Headless benchmark mode: hidden window, scene rendered into an offscreen framebuffer
+	bool gHeadless = false;
+	bool gBenchLights = false;
+	bool gBenchInstances = false;
+	bool gBenchFlip = false;
+	bool gBenchPick = false;
+	bool gBenchOcclusion = false;
+	bool gBenchLod = false;
+	bool gBenchTransforms = false;
+	int gHeadlessFrames = 300;
+	GLuint gOffscreenFbo = 0, gOffscreenColor = 0, gOffscreenDepth = 0;
 }
 
 // Initializes libraries and window/context
 bool UInitialize(int, char* [], GLFWwindow** window);
 // Resizes active window if user or program changes size
 void UResizeWindow(GLFWwindow* window, int width, int height);
-// Processes input (like a keyboard key) and does something with it
-void UProcessInput(GLFWwindow* window);
+// Processes input (like a keyboard key) and does something with it; held movement keys go in keys
+void UProcessInput(GLFWwindow* window, InputState& keys);
+// Copies the latest input for the simulation thread
+void UPublishInput(const InputState& keys);
+InputState USnapshotInput();
+// Advances the camera by one fixed step of held movement keys
+void USimulate(const InputState& input, SimulationState& state, float dt);
+// Blends the previous and current simulation states into the camera, lights and instances of one frame
+void UBuildRenderPacket(const InputState& input, float alpha, RenderPacket& packet);
+// Simulation thread: steps the clock and publishes a render packet each time a frame is requested
+void USimulationLoop();
+void UStartSimulation();
+void URequestRenderPacket();
+void UStopSimulation();
 // Mouse scroll callback
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
-// Setting index locations, colors, etc...
-void UCreateMesh(GLMesh& mesh);
-// Destroys locations
-void UDestroyMesh(GLMesh& mesh);
+// Left click picks whatever is under the middle of the screen, the cursor is captured for looking around
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+// Nearest scene triangle under a framebuffer pixel (origin top left) in the last rendered frame
+bool UPick(double screenX, double screenY, PickHit& hit);
+// Picks a grid of points on the scene and times rays against a million-triangle cylinder
+void UBenchmarkPicking(int rayCount);
+// Builds the unit mesh arena, and requests the textures
+void UAddSceneMeshes(MeshArena& arena);
+uint32_t UAddCylinderLods(MeshArena& arena, Cylinder& cylinder);
+void UCreateMeshes();
+void UDestroyMeshes();
+// Adds every scene instance to the instance list of its unit mesh, placed through the scene's nodes
+void UCreateSceneInstances();
+// Adds the scene's nodes and instances to a hierarchy under parent, returns the instances' nodes in scene order
+vector<uint32_t> UAddSceneTransforms(TransformHierarchy& hierarchy, uint32_t parent);
+// Copies world matrices of moved scene nodes into the instance lists
+void USyncSceneTransforms();
+// Moves a few copies of the scene per frame and times the transform updates
+void UBenchmarkTransforms(int frameCount);
+// Scatters thousands of extra cubes over the table and times the instanced draws
+void UBenchmarkInstances(int frameCount);
+// Times byte-wise, memcpy and SIMD row-swap flips of a 4K RGBA image
+void UBenchmarkImageFlip(int iterations);
+// Culls a floor of desks against standing books on the CPU and reports how much is hidden
+void UBenchmarkOcclusion(int frameCount);
+// Moves the camera towards and away from a cylinder and reports the levels of detail drawn
+void UBenchmarkLod(int frameCount);
 // Actually renders the pyramid and allows for transformations
-void URender();
-// Creates, compiles, and deleted shader programs (when error occurs)
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+void URender(const RenderPacket& packet);
+// Starts building a shader program without waiting on the compiler
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* vertexFormatShaderSource, const char* fragShaderSource,
+	const char* materialShaderSource, GLuint& programId);
+// Builds the fallback program, waiting for it since there's nothing to draw with before it
+bool UCreateFallbackProgram(GLuint& programId);
+// Polls the object programs; true on the frame they become ready to replace the fallback
+bool UUpdateShaderPrograms();
 // Deleting shader programs
 void UDestroyShaderProgram(GLuint programId);
 // Captures mouse events commented out for now
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
-// Loads texture for placing
-bool UCreateTexture(const char* filename, GLuint& textureId);
 // Deallocates memory from texture
 void UDestroyTexture(GLuint textureId);
-// Flipping image on Y axis
-void flipImageVertically(unsigned char* image, int width, int height, int channels);
+// Hands textures that finished loading to the material library
+void UUpdateMaterials();
+// Creates/destroys the offscreen color + depth framebuffer used in headless mode
+bool UCreateOffscreenTarget(int width, int height);
+void UDestroyOffscreenTarget();
+// Renders a fixed number of frames offscreen and reports frame time percentiles
+void URunHeadless(int frameCount);
+// Renders frames into the bound offscreen target and reports CPU, GPU and light assignment times
+void UTimeFrames(int frameCount, const string& label);
+// Scales the clustered lighting path from 2 to 1024 point lights
+void UBenchmarkLightCounts(int frameCount);
+// Looks up the object shader's uniform handles in the cache
+void UResolveObjectUniforms(GLuint programId, ObjectProgramUniforms& uniforms);
+// Creates the frame uniform buffer and light cluster buffers and binds them to their binding points
+void UCreateUniformBuffers();
+void UDestroyUniformBuffers();
+// Builds a point light from a color and position, with the shared attenuation and its cluster range
+PointLight UMakePointLight(const glm::vec3& color, const glm::vec3& position);
+// Fills gPointLights with the scene's lights
+void UCreateSceneLights();
+// Writes this frame's camera and cluster data with one glBufferSubData
+void UUploadFrameUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition);
 
 
 // Vertex Shader Source Code
 const GLchar* objectVertexShaderSource = GLSL(440,
-	layout(location = 0) in vec3 position;
-	layout(location = 1) in vec3 normal;
-	layout(location = 2) in vec2 textureCoordinate;
+	// element of the instance buffer, offset by the indirect command's baseInstance
+	layout(location = 3) in uint instanceIndex;
 
 	out vec3 vertexNormal;
 	out vec3 vertexFragmentPos;
 	out vec2 vertexTextureCoordinate;
+	flat out uint vertexMaterial;
+
+	// model matrix, normal matrix and material index of every instance in the scene
+	struct InstanceData
+	{
+		mat4 model;
+		mat3 normalMatrix;
+		uvec4 material;
+	};
 
-	// variables to be used for transforming
-	uniform mat4 model;
-	uniform mat4 view;
-	uniform mat4 projection;
+	layout(std430, binding = 6) readonly buffer InstanceBuffer
+	{
+		InstanceData instances[];
+	};
+
+	// camera data shared by every program, updated once per frame
+	layout(std140, binding = 0) uniform FrameBlock
+	{
+		mat4 view;
+		mat4 projection;
+		vec4 viewPosition;
+		vec4 clusterParams;
+		uvec4 clusterDims;
+	};
+
+	// Vertex attributes, defined by MeshArena's shader for its float or packed vertex layout
+	void loadVertex(uint mesh, out vec3 position, out vec3 normal, out vec2 textureCoordinate);
 
 	void main()
 	{
+		vec3 position;
+		vec3 normal;
+		vec2 textureCoordinate;
+		loadVertex(instances[instanceIndex].material.y, position, normal, textureCoordinate);
+
+		mat4 model = instances[instanceIndex].model;
 		gl_Position = projection * view * model * vec4(position, 1.0f); // transforming vertices to clip coords
 
 		vertexFragmentPos = vec3(model * vec4(position, 1.0f));
 
-		vertexNormal = mat3(transpose(inverse(model))) * normal;
-		vertexTextureCoordinate = textureCoordinate; // receives color data
+		vertexNormal = instances[instanceIndex].normalMatrix * normal;
+		// textures are stored top row first, so V runs downwards
+		vertexTextureCoordinate = vec2(textureCoordinate.x, 1.0 - textureCoordinate.y);
+		vertexMaterial = instances[instanceIndex].material.x;
 	}
 );
 
@@ -173,29 +447,51 @@ const GLchar* objectFragmentShaderSource = GLSL(440,
 	in vec3 vertexNormal; // For incoming normals
 	in vec3 vertexFragmentPos; // For incoming fragment position
 	in vec2 vertexTextureCoordinate; // For incoming texture coordinates
+	flat in uint vertexMaterial; // For the instance's material index
 
-	// Implementing attenuation
+	// Implementing attenuation, std140 layout mirrored by PointLight in ShaderBlocks.h
 	struct Light {
-		vec3 position;
+		vec4 position;
 
-		vec3 ambient;
-		vec3 diffuse;
-		vec3 specular;
+		vec4 ambient;
+		vec4 diffuse;
+		vec4 specular;
 
-		float constant;
-		float linear;
-		float quadratic;
+		vec4 attenuation; // constant, linear, quadratic, range
 	};
 
 	out vec4 fragmentColor; // For outgoing pyramid color to the GPU
 
-	// Uniform / Global variables for object color, light color, light position, and camera/view position
-	uniform vec3 lightPos;
-	uniform vec3 viewPosition;
-	uniform sampler2D uTexture; // Useful when working with multiple textures
-	uniform Light pointLights[2];
+	// camera data shared by every program, updated once per frame
+	layout(std140, binding = 0) uniform FrameBlock
+	{
+		mat4 view;
+		mat4 projection;
+		vec4 viewPosition;
+		vec4 clusterParams;
+		uvec4 clusterDims;
+	};
+
+	// every point light in the scene, shared by every program
+	layout(std430, binding = 2) readonly buffer LightBuffer
+	{
+		Light lights[];
+	};
+
+	// (offset, count) into clusterLightIndices for each view-space cluster
+	layout(std430, binding = 3) readonly buffer ClusterGrid
+	{
+		uvec2 clusterGrid[];
+	};
 
-	layout(binding = 3) uniform sampler2D texSampler1;
+	// light indices of all clusters, back to back
+	layout(std430, binding = 4) readonly buffer ClusterIndices
+	{
+		uint clusterLightIndices[];
+	};
+
+	// Object texture lookup, defined by MaterialLibrary's shader for the texture array or bindless handles
+	vec3 materialColor(uint material, vec2 uv);
 
 	// function contains logic for pointlights, and outputs a light source containing ambient, diffuse, and specular lighting
 	vec3 CalcPointLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir);
@@ -204,10 +500,19 @@ const GLchar* objectFragmentShaderSource = GLSL(440,
 	{
 		/*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
 		vec3 norm = normalize(vertexNormal);
-		vec3 viewDir = normalize(viewPosition - vertexFragmentPos);
-		vec3 result;
-		for (int i = 0; i < 2; i++)
-		result += CalcPointLight(pointLights[i], norm, vertexFragmentPos, viewDir);
+		vec3 viewDir = normalize(viewPosition.xyz - vertexFragmentPos);
+
+		// find this fragment's cluster: screen tile plus exponential view depth slice
+		float viewDepth = -(view * vec4(vertexFragmentPos, 1.0)).z;
+		uint slice = uint(max(log(max(viewDepth, 0.0001)) * clusterParams.x + clusterParams.y, 0.0));
+		uvec3 cluster = min(uvec3(uvec2(gl_FragCoord.xy / clusterParams.zw), slice), clusterDims.xyz - uvec3(1));
+		uint clusterIndex = cluster.x + clusterDims.x * (cluster.y + clusterDims.y * cluster.z);
+		uvec2 lightRange = clusterGrid[clusterIndex];
+
+		// only the lights whose range reaches this cluster
+		vec3 result = vec3(0.0);
+		for (uint i = 0u; i < lightRange.y; i++)
+			result += CalcPointLight(lights[clusterLightIndices[lightRange.x + i]], norm, vertexFragmentPos, viewDir);
 
 		fragmentColor = vec4(result, 1.0);
 	}
@@ -215,19 +520,20 @@ const GLchar* objectFragmentShaderSource = GLSL(440,
 	vec3 CalcPointLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir)
 	{
 		float highlightSize = 32.0f;
-		vec3 lightDir = normalize(light.position - fragPos);
+		vec3 lightDir = normalize(light.position.xyz - fragPos);
 
 		float diff = max(dot(normal, lightDir), 0.0);
 		vec3 reflectDir = reflect(-lightDir, normal);
 		float spec = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
 
-		float distance = length(light.position - fragPos);
-		float attenuation = 1.0 / (light.constant + light.linear * distance +
-							light.quadratic * (distance * distance));
+		float distance = length(light.position.xyz - fragPos);
+		float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance +
+							light.attenuation.z * (distance * distance));
 
-		vec3 ambient = light.ambient * vec3(texture(uTexture, vertexTextureCoordinate).rgb);
-		vec3 diffuse = light.diffuse * diff * vec3(texture(uTexture, vertexTextureCoordinate).rgb);
-		vec3 specular = light.specular * spec * vec3(texture(uTexture, vertexTextureCoordinate).rgb);
+		vec3 color = materialColor(vertexMaterial, vertexTextureCoordinate);
+		vec3 ambient = light.ambient.rgb * color;
+		vec3 diffuse = light.diffuse.rgb * diff * color;
+		vec3 specular = light.specular.rgb * spec * color;
 		ambient *= attenuation;
 		diffuse *= attenuation;
 		specular *= attenuation;
@@ -236,69 +542,289 @@ const GLchar* objectFragmentShaderSource = GLSL(440,
 
 );
 
+// Drawn with while the object program compiles: no lights, clusters or textures to wait on
+const GLchar* fallbackFragmentShaderSource = GLSL(440,
+	in vec3 vertexNormal;
+
+	out vec4 fragmentColor;
+
+	void main()
+	{
+		// grey under one fixed light, just enough to make out the shapes
+		float diffuse = max(dot(normalize(vertexNormal), normalize(vec3(0.3, -0.5, 1.0))), 0.0);
+		fragmentColor = vec4(vec3(0.2 + 0.6 * diffuse), 1.0);
+	}
+);
+
 int main(int argc, char* argv[])
 {
-	if (!UInitialize(argc, argv, &gWindow))
-		return EXIT_FAILURE;
+	// command line options
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+		{
+			gHeadless = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench-lights") == 0)
+		{
+			gHeadless = true;
+			gBenchLights = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench-instances") == 0)
+		{
+			gHeadless = true;
+			gBenchInstances = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-texture-cache") == 0)
+		{
+			gTextureCache = false;
+		}
+		else if (strcmp(argv[i], "--no-shader-cache") == 0)
+		{
+			gShaderCache = false;
+		}
+		else if (strcmp(argv[i], "--no-parallel-shaders") == 0)
+		{
+			gParallelShaders = false;
+		}
+		else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+		{
+			gSceneTextPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-bindless") == 0)
+		{
+			gBindless = false;
+		}
+		else if (strcmp(argv[i], "--no-vsync") == 0)
+		{
+			gVsync = false;
+		}
+		else if (strcmp(argv[i], "--bench-pick") == 0)
+		{
+			gHeadless = true;
+			gBenchPick = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench-flip") == 0)
+		{
+			gBenchFlip = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench-occlusion") == 0)
+		{
+			gBenchOcclusion = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench-transforms") == 0)
+		{
+			gBenchTransforms = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench-lod") == 0)
+		{
+			gBenchLod = true;
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+				gHeadlessFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-occlusion-cull") == 0)
+		{
+			gOcclusionCulling = false;
+		}
+		else if (strcmp(argv[i], "--no-packed-vertices") == 0)
+		{
+			gPackedVertices = false;
+		}
+	}
+
+	// headless runs get no mouse input, so frame the table from above instead of the default view
+	if (gHeadless)
+	{
+		cameraPos = glm::vec3(0.0f, -3.0f, 3.0f);
+		cameraFront = glm::normalize(glm::vec3(0.0f, 3.0f, -3.0f));
+	}
 
-	UCreateMesh(gMesh);
+	// CPU-only benchmark, no window or context needed
+	if (gBenchFlip)
+	{
+		UBenchmarkImageFlip(gHeadlessFrames);
+		return EXIT_SUCCESS;
+	}
 
-	if (!UCreateShaderProgram(objectVertexShaderSource, objectFragmentShaderSource, gProgramId))
-		return EXIT_FAILURE;
-	if (!UCreateShaderProgram(objectVertexShaderSource, objectFragmentShaderSource, gCylProgramId))
+	// the compiled binary sits next to the text form
+	string sceneBinaryPath = gSceneTextPath.substr(0, gSceneTextPath.rfind('.')) + ".uscene";
+	if (!gScene.load(gSceneTextPath, sceneBinaryPath))
 		return EXIT_FAILURE;
 
-	// Telling OpenGL which texture the sample is connected to, which is unit 0
-	glUseProgram(gProgramId);
+	// culling runs on the CPU alone, no window or context needed either
+	if (gBenchOcclusion)
+	{
+		UBenchmarkOcclusion(gHeadlessFrames);
+		return EXIT_SUCCESS;
+	}
+	if (gBenchLod)
+	{
+		UBenchmarkLod(gHeadlessFrames);
+		return EXIT_SUCCESS;
+	}
+	if (gBenchTransforms)
+	{
+		UBenchmarkTransforms(gHeadlessFrames);
+		return EXIT_SUCCESS;
+	}
 
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	if (!UInitialize(argc, argv, &gWindow))
+		return EXIT_FAILURE;
 
-	// render loop
-	while (!glfwWindowShouldClose(gWindow))
-	{
-		UProcessInput(gWindow);		
+	CpuTimer startupTimer;
 
-		// bind texture on corresponding texture unit
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture0);
+	if (gTextureCache)
+		gTextureLoader.setCacheDirectory(TEXTURE_CACHE_DIRECTORY);
+	gTextureLoader.start();
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texture1);
+	if (!gMaterials.create(SCENE_TEXTURE_UNITS, gBindless))
+		return EXIT_FAILURE;
+	cout << "INFO: Materials sampled from " << (gMaterials.bindless() ? "bindless texture handles" : "a texture array") << endl;
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, texture2);
+	UCreateMeshes();
+	UCreateSceneInstances();
 
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, texture3);
+	if (gShaderCache)
+		gShaders.setCacheDirectory(SHADER_CACHE_DIRECTORY);
+	if (gParallelShaders && gShaders.enableParallelCompile())
+		cout << "INFO: Shaders compiled on the driver's threads" << endl;
+	if (!UCreateFallbackProgram(gFallbackProgramId))
+		return EXIT_FAILURE;
+	if (!UCreateShaderProgram(objectVertexShaderSource, gMeshes.vertexShaderSource(), objectFragmentShaderSource,
+		gMaterials.materialShaderSource(), gProgramId))
+		return EXIT_FAILURE;
+	if (!UCreateShaderProgram(objectVertexShaderSource, gMeshes.vertexShaderSource(), objectFragmentShaderSource,
+		gMaterials.materialShaderSource(), gCylProgramId))
+		return EXIT_FAILURE;
 
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, texture4);
+	UCreateUniformBuffers();
+	UCreateSceneLights();
 
-		URender();
+	gCurrentState.cameraPos = cameraPos;
+	gPreviousState = gCurrentState;
+	// movement keys read this frame, only touched by the main thread
+	InputState keys = {};
+	UPublishInput(keys);
 
-		glfwPollEvents();
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-		glfwSetCursorPosCallback(gWindow, mouse_callback);
+	// benchmarks measure the finished scene, so they wait for the shaders and every texture
+	if (gHeadless)
+	{
+		gShaders.finish();
+		if (!UUpdateShaderPrograms())
+			return EXIT_FAILURE;
+		cout << "INFO: Shader programs ready " << startupTimer.elapsedMs() << " ms after startup (compiled "
+			<< gShaders.compiledCount() << ", cache hits " << gShaders.cacheHitCount() << ", shared " << gShaders.sharedCount() << ")" << endl;
+
+		gTextureLoader.finish();
+		UUpdateMaterials();
+		cout << "INFO: Textures ready " << startupTimer.elapsedMs() << " ms after startup (cache hits "
+			<< gTextureLoader.cacheHits() << ", misses " << gTextureLoader.cacheMisses() << ")" << endl;
+	}
+
+	int exitCode = EXIT_SUCCESS;
+	if (gBenchLights)
+	{
+		UBenchmarkLightCounts(gHeadlessFrames);
+	}
+	else if (gBenchInstances)
+	{
+		UBenchmarkInstances(gHeadlessFrames);
+	}
+	else if (gBenchPick)
+	{
+		UBenchmarkPicking(gHeadlessFrames);
+	}
+	else if (gHeadless)
+	{
+		URunHeadless(gHeadlessFrames);
+	}
+	else
+	{
+		// render loop, camera and scene updates run on the simulation thread
+		UStartSimulation();
+		bool firstPacket = true;
+		while (!glfwWindowShouldClose(gWindow))
+		{
+			UProcessInput(gWindow, keys);
+			UPublishInput(keys);
+
+			// upload at most one finished texture per frame
+			gTextureLoader.poll(1);
+			UUpdateMaterials();
+
+			// the fallback program draws until the object programs have linked
+			if (UUpdateShaderPrograms())
+			{
+				cout << "INFO: Shader programs ready " << startupTimer.elapsedMs() << " ms after startup (compiled "
+					<< gShaders.compiledCount() << ", cache hits " << gShaders.cacheHitCount() << ", shared " << gShaders.sharedCount() << ")" << endl;
+			}
+			else if (gShaders.failed(gProgramId) || gShaders.failed(gCylProgramId))
+			{
+				// the log was printed by the registry; a scene that can only ever be grey is a failed startup
+				cout << "ERROR::SHADER::PROGRAM::OBJECT_PROGRAM_FAILED" << endl;
+				exitCode = EXIT_FAILURE;
+				break;
+			}
+
+			// take the newest packet; if the simulation is behind, the previous one is drawn again
+			while (!gRenderPackets.update() && firstPacket)
+				std::this_thread::yield();
+			firstPacket = false;
+			// the next frame is prepared while this one is submitted
+			URequestRenderPacket();
+
+			URender(gRenderPackets.read());
+
+			glfwSwapBuffers(gWindow);
+
+			glfwPollEvents();
+
+			glfwSetCursorPosCallback(gWindow, mouse_callback);
+		}
 	}
 
-	UDestroyMesh(gMesh);
+	UStopSimulation();
+	UDestroyMeshes();
 
-	// release textures
-	UDestroyTexture(texture0);
-	UDestroyTexture(texture1);
-	UDestroyTexture(texture2);
-	UDestroyTexture(texture3);
-	UDestroyTexture(texture4);
+	// release textures, bindless handles first
+	gMaterials.destroy();
+	gTextureLoader.stop();
+	for (GLuint texture : gTextures)
+		UDestroyTexture(texture);
 
 	UDestroyShaderProgram(gProgramId);
 	UDestroyShaderProgram(gCylProgramId);
+	UDestroyShaderProgram(gFallbackProgramId);
+	gShaders.destroy();
+	UDestroyUniformBuffers();
 
-	exit(EXIT_SUCCESS);
+	exit(exitCode);
 }
 
 bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 {
-	glfwInit(); // initializing GLFW library
+	// initializing GLFW library
+	if (!glfwInit())
+	{
+		std::cout << "Failed to initialize GLFW" << std::endl;
+		return false;
+	}
 	// Setting OpenGL versions
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
@@ -310,8 +836,14 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+	// Headless runs never map the window, but it is still a native window and context: the
+	// bundled GLFW has no EGL or OSMesa libraries beside it, so a window system (a desktop
+	// session) is needed all the same
+	if (gHeadless)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
 	// Creating GLFW window using previously defined variables
-	* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+	*window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
 	// If creation fails, alert user and terminate
 	if (*window == NULL)
 	{
@@ -324,9 +856,14 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 	glfwMakeContextCurrent(*window);
 	glfwSetFramebufferSizeCallback(*window, UResizeWindow);
 	glfwSetScrollCallback(*window, UMouseScrollCallback);
+	glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+
+	// headless frames never reach the screen, so they are never held back by the display
+	glfwSwapInterval(gVsync && !gHeadless ? 1 : 0);
 
 	// When window has focus on PC, disable mouse cursor
-	glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	if (!gHeadless)
+		glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	// Enabling use of experimental/pre-release drivers
 	glewExperimental = GL_TRUE;
@@ -346,25 +883,19 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 }
 
 // if declared key(s) are pressed during this frame, do something
-void UProcessInput(GLFWwindow* window)
+void UProcessInput(GLFWwindow* window, InputState& keys)
 {
 	// Checking if 'escape' key was pressed. If so, close window.
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
 
-	const float cameraSpeed = 2.5f * scrollSpeed;
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		cameraPos += cameraSpeed * cameraFront;
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		cameraPos -= cameraSpeed * cameraFront;
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-		cameraPos -= cameraSpeed * cameraUp;
-	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-		cameraPos += cameraSpeed * cameraUp;
+	// movement keys are applied by the simulation thread
+	keys.forward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS;
+	keys.backward = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
+	keys.right = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+	keys.left = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+	keys.down = glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS;
+	keys.up = glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS;
 
 	// press "p" to change projections
 	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
@@ -385,6 +916,138 @@ void UProcessInput(GLFWwindow* window)
 }
 
 
+// the keys are read on the main thread; this copy is the only input the simulation thread sees
+void UPublishInput(const InputState& keys)
+{
+	std::lock_guard<std::mutex> lock(gInputMutex);
+	gInput.forward = keys.forward;
+	gInput.backward = keys.backward;
+	gInput.right = keys.right;
+	gInput.left = keys.left;
+	gInput.down = keys.down;
+	gInput.up = keys.up;
+	gInput.cameraFront = cameraFront;
+	gInput.scrollSpeed = scrollSpeed;
+	gInput.perspective = perspective;
+}
+
+InputState USnapshotInput()
+{
+	std::lock_guard<std::mutex> lock(gInputMutex);
+	return gInput;
+}
+
+// movement keys held during this step move the simulated camera, independent of the frame rate
+void USimulate(const InputState& input, SimulationState& state, float dt)
+{
+	const float cameraSpeed = CAMERA_SPEED * input.scrollSpeed * dt;
+	glm::vec3 right = glm::normalize(glm::cross(input.cameraFront, cameraUp));
+	if (input.forward)
+		state.cameraPos += cameraSpeed * input.cameraFront;
+	if (input.backward)
+		state.cameraPos -= cameraSpeed * input.cameraFront;
+	if (input.right)
+		state.cameraPos += right * cameraSpeed;
+	if (input.left)
+		state.cameraPos -= right * cameraSpeed;
+	if (input.down)
+		state.cameraPos -= cameraSpeed * cameraUp;
+	if (input.up)
+		state.cameraPos += cameraSpeed * cameraUp;
+}
+
+void UBuildRenderPacket(const InputState& input, float alpha, RenderPacket& packet)
+{
+	// the mouse turns the camera directly, so only positions are blended
+	packet.viewPosition = glm::mix(gPreviousState.cameraPos, gCurrentState.cameraPos, alpha);
+	packet.view = glm::lookAt(packet.viewPosition, packet.viewPosition + input.cameraFront, cameraUp);
+
+	// Defining perspective projection to start, however pressing P will change perspective to ortho
+	if (input.perspective)
+		packet.projection = glm::perspective(1.0f, GLfloat(WINDOW_WIDTH / WINDOW_HEIGHT), NEAR_PLANE, FAR_PLANE);
+	else
+		packet.projection = glm::ortho(0.0f, 5.0f, 0.0f, 5.0f, NEAR_PLANE, FAR_PLANE);
+
+	// gPointLights is fixed once the render loop starts; the simulation only moves positions
+	packet.lights = gPointLights;
+	size_t lightCount = std::min(packet.lights.size(), gCurrentState.lightPositions.size());
+	for (size_t i = 0; i < lightCount; ++i)
+	{
+		glm::vec3 position = glm::mix(gPreviousState.lightPositions[i], gCurrentState.lightPositions[i], alpha);
+		packet.lights[i].position = glm::vec4(position, 1.0f);
+	}
+
+	USyncSceneTransforms();
+	if (packet.instancesVersion != gSceneInstancesVersion)
+	{
+		for (int mesh = 0; mesh < SCENE_MESH_COUNT; ++mesh)
+			packet.instances[mesh] = gSceneInstances[mesh];
+		packet.instancesVersion = gSceneInstancesVersion;
+	}
+}
+
+void USimulationLoop()
+{
+	unsigned long long framesBuilt = 0;
+	lastFrame = glfwGetTime();
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(gFrameMutex);
+			gFrameRequested.wait(lock, [&framesBuilt]() { return gStopSimulation || gFramesRequested > framesBuilt; });
+			if (gStopSimulation)
+				return;
+			framesBuilt = gFramesRequested;
+		}
+
+		InputState input = USnapshotInput();
+
+		double currentFrame = glfwGetTime();
+		deltaTime = std::min(currentFrame - lastFrame, MAX_FRAME_TIME);
+		lastFrame = currentFrame;
+
+		// run as many fixed steps as real time allows, the remainder carries over to the next frame
+		gSimulationTime += deltaTime;
+		while (gSimulationTime >= SIMULATION_STEP)
+		{
+			gPreviousState = gCurrentState;
+			USimulate(input, gCurrentState, (float)SIMULATION_STEP);
+			gSimulationTime -= SIMULATION_STEP;
+		}
+
+		UBuildRenderPacket(input, (float)(gSimulationTime / SIMULATION_STEP), gRenderPackets.write());
+		gRenderPackets.publish();
+	}
+}
+
+void UStartSimulation()
+{
+	gStopSimulation = false;
+	gSimulationThread = std::thread(USimulationLoop);
+	URequestRenderPacket();
+}
+
+void URequestRenderPacket()
+{
+	{
+		std::lock_guard<std::mutex> lock(gFrameMutex);
+		++gFramesRequested;
+	}
+	gFrameRequested.notify_one();
+}
+
+void UStopSimulation()
+{
+	if (!gSimulationThread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(gFrameMutex);
+		gStopSimulation = true;
+	}
+	gFrameRequested.notify_one();
+	gSimulationThread.join();
+}
+
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 {
 	if (yoffset > 0)
@@ -401,20 +1064,45 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 	cout << scrollSpeed << endl;
 }
 
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+	if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS)
+		return;
+
+	PickHit hit;
+	if (UPick(gViewportWidth * 0.5, gViewportHeight * 0.5, hit))
+		cout << "INFO: Picked " << USceneMeshName(hit.instance.mesh) << " " << hit.instance.instance << ", triangle " << hit.triangle
+			<< ", uv (" << hit.uv.x << ", " << hit.uv.y << ") at distance " << hit.distance << endl;
+	else
+		cout << "INFO: Picked nothing" << endl;
+}
+
+bool UPick(double screenX, double screenY, PickHit& hit)
+{
+	// the pixel's points on the near and far planes, window y runs down and NDC y up
+	glm::mat4 toWorld = glm::inverse(gRenderedProjection * gRenderedView);
+	float ndcX = (float)(2.0 * screenX / gViewportWidth - 1.0);
+	float ndcY = (float)(1.0 - 2.0 * screenY / gViewportHeight);
+	glm::vec4 nearPoint = toWorld * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+	glm::vec4 farPoint = toWorld * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 ray = glm::vec3(farPoint) / farPoint.w - origin;
+
+	float length = glm::length(ray);
+	return gMeshes.pick(origin, ray / length, length, hit);
+}
+
 // Set viewport if window is resized
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
+	gViewportWidth = width;
+	gViewportHeight = height;
 	glViewport(0, 0, width, height);
 }
 
 // URender will render the frame. This function is in the while loop within main()
-void URender()
+void URender(const RenderPacket& packet)
 {
-	// Lamp orbits around the origin
-	gLightPosition.x = lX;
-	gLightPosition.y = lY;
-	gLightPosition.z = lZ;
-
 	// Enabling z-depth
 	glEnable(GL_DEPTH_TEST);
 
@@ -422,571 +1110,312 @@ void URender()
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// Activate VAO
-	glBindVertexArray(gMesh.vaos[0]);
-
-	// 1. Scales the object by 2
-	glm::mat4 scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-	// 2. Place object at the origin
-	glm::mat4 translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
-	// 3. Rotate object
-	glm::mat4 rotation = glm::rotate(0.6f, glm::vec3(0, 0, 1));
-	// Model matrix: transformations are applied right-to-left order
-	glm::mat4 model = translation * scale;
-
-	// Defining perspective projection to start, however pressing P will change perspective to ortho
-	glm::mat4 projection = glm::perspective(1.0f, GLfloat(WINDOW_WIDTH / WINDOW_HEIGHT), 0.1f, 100.0f);
-	if (perspective)
-	{
-		projection = glm::perspective(1.0f, GLfloat(WINDOW_WIDTH / WINDOW_HEIGHT), 0.1f, 100.0f);
-	}
-	else
+	// restream the instance and indirect buffers only when the scene's instances changed
+	if (packet.instancesVersion != gUploadedInstancesVersion)
 	{
-		projection = glm::ortho(0.0f, 5.0f, 0.0f, 5.0f, 0.1f, 100.0f);
+		for (int mesh = 0; mesh < SCENE_MESH_COUNT; ++mesh)
+			gMeshes.setInstances(mesh, packet.instances[mesh]);
+		gUploadedInstancesVersion = packet.instancesVersion;
 	}
 
-	const float radius = 10.0f;
-	float camX = sin(glfwGetTime()) * radius;
-	float camZ = cos(glfwGetTime()) * radius;
-
-	// new camera view that allows movement. commented out for now
-	glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-
-	glUseProgram(gProgramId);
-
-	// Program 1
-	GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-	GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-	GLint projLoc = glGetUniformLocation(gProgramId, "projection");
-
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-	// Reference matrix uniforms for Shader program
-	GLint viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
-	GLint lightAmbientLoc = glGetUniformLocation(gProgramId, "pointLights[0].ambient");
-	GLint lightDiffuseLoc = glGetUniformLocation(gProgramId, "pointLights[0].diffuse");
-	GLint lightSpecularLoc = glGetUniformLocation(gProgramId, "pointLights[0].specular");
-	GLint lightPositionLoc = glGetUniformLocation(gProgramId, "pointLights[0].position");
-	GLfloat lightConstantLoc = glGetUniformLocation(gProgramId, "pointLights[0].constant");
-	GLfloat lightLinearLoc = glGetUniformLocation(gProgramId, "pointLights[0].linear");
-	GLfloat lightQuadraticLoc = glGetUniformLocation(gProgramId, "pointLights[0].quadratic");
-	// light2
-	GLint lightAmbientLoc2 = glGetUniformLocation(gProgramId, "pointLights[1].ambient");
-	GLint lightDiffuseLoc2 = glGetUniformLocation(gProgramId, "pointLights[1].diffuse");
-	GLint lightSpecularLoc2 = glGetUniformLocation(gProgramId, "pointLights[1].specular");
-	GLint lightPositionLoc2 = glGetUniformLocation(gProgramId, "pointLights[1].position");
-	GLfloat lightConstantLoc2 = glGetUniformLocation(gProgramId, "pointLights[1].constant");
-	GLfloat lightLinearLoc2 = glGetUniformLocation(gProgramId, "pointLights[1].linear");
-	GLfloat lightQuadraticLoc2 = glGetUniformLocation(gProgramId, "pointLights[1].quadratic");
-
-	// Pass color, light, and camera data to the pyramid Shader program's corresponding uniforms
-	glUniform3f(lightPositionLoc, 1.4f, 0.04f, 3.5f);
-	const glm::vec3 cameraPosition = (cameraPos, cameraPos + cameraFront, cameraUp);
-	glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-	// Setting float variables for caster
-	glUniform3f(lightAmbientLoc, pointLightColors[0].x * 0.1f, pointLightColors[0].y * 0.1f, pointLightColors[0].z * 0.1f);
-	glUniform3f(lightDiffuseLoc, pointLightColors[0].x, pointLightColors[0].y, pointLightColors[0].z);
-	glUniform3f(lightSpecularLoc, pointLightColors[0].x, pointLightColors[0].y, pointLightColors[0].z);
-	glUniform1f(lightConstantLoc, 1.0f);
-	glUniform1f(lightLinearLoc, 0.09f);
-	glUniform1f(lightQuadraticLoc, 0.032f);
-	// light 2
-	glUniform3f(lightAmbientLoc2, pointLightColors[1].x * 0.1f, pointLightColors[1].y * 0.1f, pointLightColors[1].z * 0.1f);
-	glUniform3f(lightDiffuseLoc2, pointLightColors[1].x, pointLightColors[1].y, pointLightColors[1].z);
-	glUniform3f(lightSpecularLoc2, pointLightColors[1].x, pointLightColors[1].y, pointLightColors[1].z);
-	glUniform3f(lightPositionLoc2, -6.1f, 2.0f, 4.2f);
-	glUniform1f(lightConstantLoc2, 1.0f);
-	glUniform1f(lightLinearLoc2, 0.09f);
-	glUniform1f(lightQuadraticLoc2, 0.032f);
-
-	glBindVertexArray(gMesh.vaos[0]);
-
-	// Loading textures and drawing objects
-
-	/********************
-	*     Table top 	*
-	********************/
-
-	// Marble texture
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-	// Tabletop vertices
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-
-	/********************
-	*        Book		*
-	********************/
-
-	// Book Cover Texture
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 1);
-	// Book
-	glDrawArrays(GL_TRIANGLES, 6, 36);
-
-	/********************
-	*   Rubik's Cube	*
-	********************/
-
-	// Rubik's Cube Texture
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 2);
-	// Cube
-	glDrawArrays(GL_TRIANGLES, 42, 36);
-
-	/********************
-	*  Perfume Bottle	*
-	********************/
-	scale = glm::scale(glm::vec3(0.7f, 0.7f, 0.7f));
-	rotation = glm::rotate(0.6f, glm::vec3(0, 0, 1));
-	translation = glm::translate(glm::vec3(0, 0, 0));
-
-	model = translation * rotation * scale;
-
-	// Pass new matrix data from model
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-	// Dust Texture
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 3);
-	// Perfume bottle
-	glDrawArrays(GL_TRIANGLES, 78, 36);
-
-	/********************
-	*     Perfume Cap	*
-	********************/
-
-	scale = glm::scale(glm::vec3(0.26f, 0.26f, 0.7f));
-	rotation = glm::rotate(3.79f, glm::vec3(-0.05f, 0.0f, 3.3f));
-	translation = glm::translate(glm::vec3(-0.53f, -0.13f, 0));
-
-	model = translation * rotation * scale;
-
-	// Pass new matrix data from model
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-	glDrawArrays(GL_TRIANGLES, 114, 36);
-
-	/********************
-	*     Cylinder 1	*
-	********************/
-
-	glUseProgram(gCylProgramId);
-	glBindVertexArray(gMesh.vaos[1]);
-
-	// Program 2
-	modelLoc = glGetUniformLocation(gCylProgramId, "model");
-	viewLoc = glGetUniformLocation(gCylProgramId, "view");
-	projLoc = glGetUniformLocation(gCylProgramId, "projection");
-
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-	// Reference matrix uniforms for Shader program
-	lightPositionLoc = glGetUniformLocation(gCylProgramId, "lightPos");
-	viewPositionLoc = glGetUniformLocation(gCylProgramId, "viewPosition");
-	lightConstantLoc = glGetUniformLocation(gCylProgramId, "light.constant");
-	lightLinearLoc = glGetUniformLocation(gCylProgramId, "light.linear");
-	lightQuadraticLoc = glGetUniformLocation(gCylProgramId, "light.quadratic");
-	lightAmbientLoc = glGetUniformLocation(gCylProgramId, "light.ambient");
-	lightDiffuseLoc = glGetUniformLocation(gCylProgramId, "light.diffuse");
-	lightSpecularLoc = glGetUniformLocation(gCylProgramId, "light.specular");
-	// light2
-	lightAmbientLoc2 = glGetUniformLocation(gCylProgramId, "pointLights[1].ambient");
-	lightDiffuseLoc2 = glGetUniformLocation(gCylProgramId, "pointLights[1].diffuse");
-	lightSpecularLoc2 = glGetUniformLocation(gCylProgramId, "pointLights[1].specular");
-	lightPositionLoc2 = glGetUniformLocation(gCylProgramId, "pointLights[1].position");
-	lightConstantLoc2 = glGetUniformLocation(gCylProgramId, "pointLights[1].constant");
-	lightLinearLoc2 = glGetUniformLocation(gCylProgramId, "pointLights[1].linear");
-	lightQuadraticLoc2 = glGetUniformLocation(gCylProgramId, "pointLights[1].quadratic");
-
-	// Pass color, light, and camera data to the pyramid Shader program's corresponding uniforms
-	glUniform3f(lightPositionLoc, gLightPosition.x, gLightPosition.y, gLightPosition.z);
-	// const glm::vec3 cameraPosition = (cameraPos, cameraPos + cameraFront, cameraUp);
-	glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-	// Setting float variables for caster
-	glUniform3f(lightAmbientLoc, 0.1f, 0.1f, 0.1f);
-	glUniform3f(lightDiffuseLoc, 0.8f, 0.8f, 0.8f);
-	glUniform3f(lightSpecularLoc, 1.0f, 1.0f, 1.0f);
-	glUniform1f(lightConstantLoc, 1.0f);
-	glUniform1f(lightLinearLoc, 0.09f);
-	glUniform1f(lightQuadraticLoc, 0.032f);
-	// light 2
-	glUniform3f(lightAmbientLoc2, pointLightColors[1].x * 0.1f, pointLightColors[1].y * 0.1f, pointLightColors[1].z * 0.1f);
-	glUniform3f(lightDiffuseLoc2, pointLightColors[1].x, pointLightColors[1].y, pointLightColors[1].z);
-	glUniform3f(lightSpecularLoc2, pointLightColors[1].x, pointLightColors[1].y, pointLightColors[1].z);
-	glUniform3f(lightPositionLoc2, -6.1f, 2.0f, 4.2f);
-	glUniform1f(lightConstantLoc2, 1.0f);
-	glUniform1f(lightLinearLoc2, 0.09f);
-	glUniform1f(lightQuadraticLoc2, 0.032f);
-
-	scale = glm::scale(glm::vec3(0.2f, 0.2f, 0.2f));
-	rotation = glm::rotate(3.15f, glm::vec3(8.0f, 0.0f, 0.0f));
-	translation = glm::translate(glm::vec3(-0.3f, -1.4f, 0.21f));
-
-	model = translation * rotation * scale;
-
-	// Pass new matrix data from model
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-	cylinder1.draw();
-
-	/********************
-	*     Cylinder 2	*
-	********************/
-
-	scale = glm::scale(glm::vec3(0.04f, 0.04f, 0.04f));
-	rotation = glm::rotate(2.0f, glm::vec3(0.6f, -0.06f, 0.45f));
-	translation = glm::translate(glm::vec3(-0.44f, -0.25f, 0.0f));
-
-	model = translation * rotation * scale;
-
-	// Pass new matrix data from model
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-	cylinder2.draw();
+	gRenderedView = packet.view;
+	gRenderedProjection = packet.projection;
+
+	// Assign lights to view clusters, then upload camera and cluster data for both programs
+	gClusterGrid.setProjection(packet.projection, NEAR_PLANE, FAR_PLANE, gViewportWidth, gViewportHeight);
+	gClusterGrid.update(packet.lights, packet.view);
+	UUploadFrameUniforms(packet.view, packet.projection, packet.viewPosition);
+
+	// One multi-draw per program covers every mesh and every instance inside the view frustum,
+	// transforms and materials are looked up per instance in the shader; the queue only binds
+	// what changes between them
+	gMaterials.bind();
+	gDrawQueue.clear();
+	const GLuint pipelinePrograms[PROGRAM_INDEX_COUNT] = {
+		gShaderProgramsReady ? gProgramId : gFallbackProgramId,
+		gShaderProgramsReady ? gCylProgramId : gFallbackProgramId
+	};
+	gMeshes.queueDraws(gDrawQueue, pipelinePrograms, packet.projection * packet.view);
+	gDrawQueue.sort();
+	gDrawQueue.submit();
 
 	glBindVertexArray(0);
-
-	glfwSwapBuffers(gWindow);
 }
 
-// UCreateMesh contains positions and color data, and ensures data is in GPU memory
-void UCreateMesh(GLMesh& mesh)
+// UAddSceneMeshes adds the unit meshes every prop is instanced from to an arena, UCreateMeshes packs them into gMeshes and requests the scene textures
+void UAddSceneMeshes(MeshArena& arena)
 {
-	 // Position, Normal, and texture data for objects
-	GLfloat verts[] = {
+	// Position, Normal, and texture data for the unit meshes, four vertices per face
+
+	// Table top plane
+	const GLfloat planeVerts[] = {
 		// Table top			// Plane Normal		// Texture Coords
 		-1.0f, -1.0f,   0.0f,	0.0f, 0.0f, 1.0f,	0.0f,  0.0f, // bottom left vertex
 		-1.0f,  1.0f,   0.0f,	0.0f, 0.0f, 1.0f,	0.0f,  1.0f, // top left vertex
-		 1.0f,  1.0f,   0.0f,	0.0f, 0.0f, 1.0f,	1.0f,  1.0f, // top right vertex
 		 1.0f,  1.0f,   0.0f,	0.0f, 0.0f, 1.0f,	1.0f,  1.0f, // top right vertex
 		 1.0f, -1.0f,   0.0f,	0.0f, 0.0f, 1.0f,	1.0f,  0.0f, // bottom right vertex
-		-1.0f, -1.0f,   0.0f,	0.0f, 0.0f, 1.0f,	0.0f,  0.0f, // bottom left vertex
+	};
+	const GLuint planeIndices[] = { 0, 1, 2, 2, 3, 0 };
 
-		// Book
-		// Front Face			// Plane Normal		// Texture Coords
-		-1.0f, -1.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.15f,  0.5f, // bottom left vertex
-		-1.0f,  0.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.15f, 0.94f, // top left vertex
-		-0.5f,  0.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.83f, 0.94f, // top right vertex
-		-0.5f,  0.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.83f, 0.94f, // top right vertex
-		-0.5f, -1.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.83f,  0.5f, // bottom right vertex
-		-1.0f, -1.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.15f,  0.5f, // bottom left vertex
-		// Back Face
-		-1.0f, -1.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.15f,  0.0f, // bottom left vertex
-		-1.0f,  0.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.15f, 0.44f, // top left vertex
-		-0.5f,  0.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.83f, 0.44f, // top right vertex
-		-0.5f,  0.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.83f, 0.44f, // top right vertex
-		-0.5f, -1.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.83f,  0.0f, // bottom right vertex
-		-1.0f, -1.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.15f,  0.0f, // bottom left vertex
-		// Left Face
-		-1.0f, -1.0f,   0.1f,  -1.0f, 0.0f, 0.0f,	0.15f,  0.5f, // bottom left vertex
-		-1.0f,  0.0f,   0.1f,  -1.0f, 0.0f, 0.0f,	0.15f, 0.94f, // top left vertex
-		-1.0f,  0.0f, 0.001f,  -1.0f, 0.0f, 0.0f,	0.0f,  0.94f, // back top left vertex
-		-1.0f,  0.0f, 0.001f,  -1.0f, 0.0f, 0.0f,	0.0f,  0.94f, // back top left vertex
-		-1.0f, -1.0f, 0.001f,  -1.0f, 0.0f, 0.0f,	0.0f,   0.5f, // back bottom left vertex
-		-1.0f, -1.0f,   0.1f,  -1.0f, 0.0f, 0.0f,	0.15f,  0.5f, // bottom left vertex
-		// Right Face
-		-0.5f, -1.0f,   0.1f,   1.0f, 0.0f, 0.0f,	1.0f,  0.5f, // bottom right vertex
-		-0.5f,  0.0f,   0.1f,   1.0f, 0.0f, 0.0f,   1.0f, 0.94f, // top right vertex
-		-0.5f,  0.0f, 0.001f,   1.0f, 0.0f, 0.0f,	0.83f, 0.94f, // back top right vertex
-		-0.5f,  0.0f, 0.001f,   1.0f, 0.0f, 0.0f,	0.83f, 0.94f, // back top right vertex
-		-0.5f, -1.0f, 0.001f,   1.0f, 0.0f, 0.0f,	0.83f,  0.5f, // back bottom right vertex
-		-0.5f, -1.0f,   0.1f,   1.0f, 0.0f, 0.0f,	1.0f,  0.5f, // bottom right vertex
-		// Top Face
-		-1.0f,  0.0f,   0.1f,	0.0f, 1.0f, 0.0f,   0.15f, 0.94f, // top left vertex
-		-1.0f,  0.0f, 0.001f,	0.0f, 1.0f, 0.0f,	0.15f,  1.0f, // back top left vertex
-		-0.5f,  0.0f, 0.001f,	0.0f, 1.0f, 0.0f,	0.83f,  1.0f, // back top right vertex
-		-0.5f,  0.0f, 0.001f,	0.0f, 1.0f, 0.0f,	0.83f,  1.0f, // back top right vertex
-		-0.5f,  0.0f,   0.1f,	0.0f, 1.0f, 0.0f,	0.83f, 0.94f, // top right vertex
-		-1.0f,  0.0f,   0.1f,	0.0f, 1.0f, 0.0f,	0.15f, 0.94f, // top left vertex
-		// Bottom Face
-		-1.0f, -1.0f,   0.1f,	0.0f,-1.0f, 0.0f,	 0.15f,  0.5f, // bottom left vertex
-		-1.0f, -1.0f, 0.001f,	0.0f,-1.0f, 0.0f,	 0.15f, 0.44f, // back bottom left vertex
-		-0.5f, -1.0f, 0.001f,	0.0f,-1.0f, 0.0f,	 0.83f, 0.44f, // back bottom right vertex
-		-0.5f, -1.0f, 0.001f,	0.0f,-1.0f, 0.0f,	 0.83f, 0.44f, // back bottom right vertex
-		-0.5f, -1.0f,   0.1f,	0.0f,-1.0f, 0.0f,    0.83f,  0.5f, // bottom right vertex
-		-1.0f, -1.0f,   0.1f,	0.0f,-1.0f, 0.0f,    0.15f,  0.5f, // bottom left vertex
-
-		// Rubik's Cube
-		// Front Face
-		-0.75f,-0.25f,0.351f,	0.0f, 0.0f, 1.0f,	 0.34f,  0.5f, // bottom left vertex
-		-0.75f, 0.0f, 0.351f,	0.0f, 0.0f, 1.0f,	 0.34f, 0.75f, // top left vertex
-		-0.5f,  0.0f, 0.351f,	0.0f, 0.0f, 1.0f,	 0.66f, 0.75f, // top right vertex
-		-0.5f,  0.0f, 0.351f,	0.0f, 0.0f, 1.0f,	 0.66f, 0.75f, // top right vertex
-		-0.5f, -0.25f,0.351f,	0.0f, 0.0f, 1.0f,	 0.66f,  0.5f, // bottom right vertex
-		-0.75f,-0.25f,0.351f,	0.0f, 0.0f, 1.0f,	 0.34f,  0.5f, // bottom left vertex
-		// Back Face
-		-0.75f,-0.25f,0.101f,	0.0f, 0.0f,-1.0f,	 0.34f,  0.0f, // back bottom left vertex
-		-0.75f, 0.0f, 0.101f,	0.0f, 0.0f,-1.0f,	 0.34f, 0.25f, // back top left vertex
-		-0.5f,  0.0f, 0.101f,	0.0f, 0.0f,-1.0f,   0.665f, 0.25f, // back top right vertex
-		-0.5f,  0.0f, 0.101f,	0.0f, 0.0f,-1.0f,	0.665f, 0.25f, // back top right vertex
-		-0.5f, -0.25f,0.101f,	0.0f, 0.0f,-1.0f,	0.665f,  0.0f, // back bottom right vertex
-		-0.75f,-0.25f,0.101f,	0.0f, 0.0f,-1.0f,	 0.34f,  0.0f, // back bottom left vertex
-		// Left Face
-		-0.75f,-0.25f,0.351f,  -1.0f, 0.0f, 0.0f,	 0.33f,  0.5f, // bottom left vertex
-		-0.75f, 0.0f, 0.351f,  -1.0f, 0.0f, 0.0f,	 0.33f, 0.75f, // top left vertex
-		-0.75f, 0.0f, 0.101f,  -1.0f, 0.0f, 0.0f,	  0.0f, 0.75f, // back top left vertex
-		-0.75f, 0.0f, 0.101f,  -1.0f, 0.0f, 0.0f,	  0.0f, 0.75f, // back top left vertex
-		-0.75f,-0.25f,0.101f,  -1.0f, 0.0f, 0.0f,	  0.0f,  0.5f, // back bottom left vertex
-		-0.75f,-0.25f,0.351f,  -1.0f, 0.0f, 0.0f,	 0.33f,  0.5f, // bottom left vertex
-		// Right Face
-		-0.5f, -0.25f,0.351f,   1.0f, 0.0f, 0.0f,	 0.66f,  0.5f, // bottom right vertex
-		-0.5f,  0.0f, 0.351f,   1.0f, 0.0f, 0.0f,	 0.66f, 0.75f, // top right vertex
-		-0.5f,  0.0f, 0.101f,   1.0f, 0.0f, 0.0f,	  1.0f, 0.75f, // back top right vertex
-		-0.5f,  0.0f, 0.101f,   1.0f, 0.0f, 0.0f,	  1.0f, 0.75f, // back top right vertex
-		-0.5f, -0.25f,0.101f,   1.0f, 0.0f, 0.0f,	  1.0f,  0.5f, // back bottom right vertex
-		-0.5f, -0.25f,0.351f,   1.0f, 0.0f, 0.0f,	 0.66f,  0.5f, // bottom right vertex
-		// Top Face
-		-0.75f, 0.0f, 0.351f,	0.0f, 1.0f, 0.0f,	 0.34f, 0.75f, // top left vertex
-		-0.75f, 0.0f, 0.101f,	0.0f, 1.0f, 0.0f,	 0.34f,  1.0f, // back top left vertex
-		-0.5f,  0.0f, 0.101f,	0.0f, 1.0f, 0.0f,	0.665f,  1.0f, // back top right vertex
-		-0.5f,  0.0f, 0.101f,	0.0f, 1.0f, 0.0f,	0.665f,  1.0f, // back top right vertex
-		-0.5f,  0.0f, 0.351f,	0.0f, 1.0f, 0.0f,	0.665f, 0.75f, // top right vertex
-		-0.75f, 0.0f, 0.351f,	0.0f, 1.0f, 0.0f,	 0.34f, 0.75f, // top left vertex
-		// Bottom Face
-		-0.75f,-0.25f,0.351f,	0.0f,-1.0f, 0.0f,	 0.34f,  0.5f, // bottom left vertex
-		-0.75f,-0.25f,0.101f,	0.0f,-1.0f, 0.0f,	 0.34f, 0.25f, // back bottom left vertex
-		-0.5f, -0.25f,0.101f,	0.0f,-1.0f, 0.0f,	0.665f, 0.25f, // back bottom right vertex
-		-0.5f, -0.25f,0.101f,	0.0f,-1.0f, 0.0f,	0.665f, 0.25f, // back bottom right vertex
-		-0.5f, -0.25f,0.351f,	0.0f,-1.0f, 0.0f,	0.665f,  0.5f, // bottom right vertex
-		-0.75f,-0.25f,0.351f,	0.0f,-1.0f, 0.0f,	 0.34f,  0.5f, // bottom left vertex
-
-		// Perfume Bottle
+	// Unit box with the book cover layout, shared by the book, perfume bottle and perfume cap
+	const GLfloat bookBoxVerts[] = {
 		// Front Face			// Plane Normal		// Texture Coords
-		-1.0f, -1.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.15f,  0.5f, // bottom left vertex
-		-1.0f,  0.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.15f, 0.94f, // top left vertex
-		-0.5f,  0.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.83f, 0.94f, // top right vertex
-		-0.5f,  0.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.83f, 0.94f, // top right vertex
-		-0.5f, -1.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.83f,  0.5f, // bottom right vertex
-		-1.0f, -1.0f,   0.1f,	0.0f, 0.0f, 1.0f,	0.15f,  0.5f, // bottom left vertex
+		0.0f, 0.0f, 1.0f,	0.0f, 0.0f, 1.0f,	0.15f, 0.5f, // bottom left vertex
+		0.0f, 1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	0.15f, 0.94f, // top left vertex
+		1.0f, 1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	0.83f, 0.94f, // top right vertex
+		1.0f, 0.0f, 1.0f,	0.0f, 0.0f, 1.0f,	0.83f, 0.5f, // bottom right vertex
 		// Back Face
-		-1.0f, -1.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.15f,  0.0f, // bottom left vertex
-		-1.0f,  0.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.15f, 0.44f, // top left vertex
-		-0.5f,  0.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.83f, 0.44f, // top right vertex
-		-0.5f,  0.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.83f, 0.44f, // top right vertex
-		-0.5f, -1.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.83f,  0.0f, // bottom right vertex
-		-1.0f, -1.0f, 0.001f,	0.0f, 0.0f,-1.0f,   0.15f,  0.0f, // bottom left vertex
+		0.0f, 0.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.15f, 0.0f, // bottom left vertex
+		0.0f, 1.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.15f, 0.44f, // top left vertex
+		1.0f, 1.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.83f, 0.44f, // top right vertex
+		1.0f, 0.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.83f, 0.0f, // bottom right vertex
 		// Left Face
-		-1.0f, -1.0f,   0.1f,  -1.0f, 0.0f, 0.0f,	0.15f,  0.5f, // bottom left vertex
-		-1.0f,  0.0f,   0.1f,  -1.0f, 0.0f, 0.0f,	0.15f, 0.94f, // top left vertex
-		-1.0f,  0.0f, 0.001f,  -1.0f, 0.0f, 0.0f,	0.0f,  0.94f, // back top left vertex
-		-1.0f,  0.0f, 0.001f,  -1.0f, 0.0f, 0.0f,	0.0f,  0.94f, // back top left vertex
-		-1.0f, -1.0f, 0.001f,  -1.0f, 0.0f, 0.0f,	0.0f,   0.5f, // back bottom left vertex
-		-1.0f, -1.0f,   0.1f,  -1.0f, 0.0f, 0.0f,	0.15f,  0.5f, // bottom left vertex
+		0.0f, 0.0f, 1.0f,	-1.0f, 0.0f, 0.0f,	0.15f, 0.5f, // bottom left vertex
+		0.0f, 1.0f, 1.0f,	-1.0f, 0.0f, 0.0f,	0.15f, 0.94f, // top left vertex
+		0.0f, 1.0f, 0.0f,	-1.0f, 0.0f, 0.0f,	0.0f, 0.94f, // back top left vertex
+		0.0f, 0.0f, 0.0f,	-1.0f, 0.0f, 0.0f,	0.0f, 0.5f, // back bottom left vertex
 		// Right Face
-		-0.5f, -1.0f,   0.1f,   1.0f, 0.0f, 0.0f,	1.0f,  0.5f, // bottom right vertex
-		-0.5f,  0.0f,   0.1f,   1.0f, 0.0f, 0.0f,   1.0f, 0.94f, // top right vertex
-		-0.5f,  0.0f, 0.001f,   1.0f, 0.0f, 0.0f,	0.83f, 0.94f, // back top right vertex
-		-0.5f,  0.0f, 0.001f,   1.0f, 0.0f, 0.0f,	0.83f, 0.94f, // back top right vertex
-		-0.5f, -1.0f, 0.001f,   1.0f, 0.0f, 0.0f,	0.83f,  0.5f, // back bottom right vertex
-		-0.5f, -1.0f,   0.1f,   1.0f, 0.0f, 0.0f,	1.0f,  0.5f, // bottom right vertex
+		1.0f, 0.0f, 1.0f,	1.0f, 0.0f, 0.0f,	1.0f, 0.5f, // bottom right vertex
+		1.0f, 1.0f, 1.0f,	1.0f, 0.0f, 0.0f,	1.0f, 0.94f, // top right vertex
+		1.0f, 1.0f, 0.0f,	1.0f, 0.0f, 0.0f,	0.83f, 0.94f, // back top right vertex
+		1.0f, 0.0f, 0.0f,	1.0f, 0.0f, 0.0f,	0.83f, 0.5f, // back bottom right vertex
 		// Top Face
-		-1.0f,  0.0f,   0.1f,	0.0f, 1.0f, 0.0f,   0.15f, 0.94f, // top left vertex
-		-1.0f,  0.0f, 0.001f,	0.0f, 1.0f, 0.0f,	0.15f,  1.0f, // back top left vertex
-		-0.5f,  0.0f, 0.001f,	0.0f, 1.0f, 0.0f,	0.83f,  1.0f, // back top right vertex
-		-0.5f,  0.0f, 0.001f,	0.0f, 1.0f, 0.0f,	0.83f,  1.0f, // back top right vertex
-		-0.5f,  0.0f,   0.1f,	0.0f, 1.0f, 0.0f,	0.83f, 0.94f, // top right vertex
-		-1.0f,  0.0f,   0.1f,	0.0f, 1.0f, 0.0f,	0.15f, 0.94f, // top left vertex
+		0.0f, 1.0f, 1.0f,	0.0f, 1.0f, 0.0f,	0.15f, 0.94f, // top left vertex
+		0.0f, 1.0f, 0.0f,	0.0f, 1.0f, 0.0f,	0.15f, 1.0f, // back top left vertex
+		1.0f, 1.0f, 0.0f,	0.0f, 1.0f, 0.0f,	0.83f, 1.0f, // back top right vertex
+		1.0f, 1.0f, 1.0f,	0.0f, 1.0f, 0.0f,	0.83f, 0.94f, // top right vertex
 		// Bottom Face
-		-1.0f, -1.0f,   0.1f,	0.0f,-1.0f, 0.0f,	 0.15f,  0.5f, // bottom left vertex
-		-1.0f, -1.0f, 0.001f,	0.0f,-1.0f, 0.0f,	 0.15f, 0.44f, // back bottom left vertex
-		-0.5f, -1.0f, 0.001f,	0.0f,-1.0f, 0.0f,	 0.83f, 0.44f, // back bottom right vertex
-		-0.5f, -1.0f, 0.001f,	0.0f,-1.0f, 0.0f,	 0.83f, 0.44f, // back bottom right vertex
-		-0.5f, -1.0f,   0.1f,	0.0f,-1.0f, 0.0f,    0.83f,  0.5f, // bottom right vertex
-		-1.0f, -1.0f,   0.1f,	0.0f,-1.0f, 0.0f,    0.15f,  0.5f, // bottom left vertex
-
-		// Perfume Cap
+		0.0f, 0.0f, 1.0f,	0.0f, -1.0f, 0.0f,	0.15f, 0.5f, // bottom left vertex
+		0.0f, 0.0f, 0.0f,	0.0f, -1.0f, 0.0f,	0.15f, 0.44f, // back bottom left vertex
+		1.0f, 0.0f, 0.0f,	0.0f, -1.0f, 0.0f,	0.83f, 0.44f, // back bottom right vertex
+		1.0f, 0.0f, 1.0f,	0.0f, -1.0f, 0.0f,	0.83f, 0.5f, // bottom right vertex
+	};
+
+	// Unit box with the Rubik's cube layout
+	const GLfloat cubeBoxVerts[] = {
 		// Front Face			// Plane Normal		// Texture Coords
-		-0.5f, 0.0f, 0.1f,		0.0f, 0.0f, 1.0f,	0.15f, 0.5f, // bottom left vertex
-		-0.5f, 0.5f, 0.1f,		0.0f, 0.0f, 1.0f,	0.15f, 0.94f, // top left vertex
-		 0.5f, 0.5f, 0.1f,		0.0f, 0.0f, 1.0f,	0.83f, 0.94f, // top right vertex
-		 0.5f, 0.5f, 0.1f,		0.0f, 0.0f, 1.0f,	0.83f, 0.94f, // top right vertex
-		 0.5f, 0.0f, 0.1f,		0.0f, 0.0f, 1.0f,	0.83f, 0.5f, // bottom right vertex
-		-0.5f, 0.0f, 0.1f,		0.0f, 0.0f, 1.0f,	0.15f, 0.5f, // bottom left vertex
+		0.0f, 0.0f, 1.0f,	0.0f, 0.0f, 1.0f,	0.34f, 0.5f, // bottom left vertex
+		0.0f, 1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	0.34f, 0.75f, // top left vertex
+		1.0f, 1.0f, 1.0f,	0.0f, 0.0f, 1.0f,	0.66f, 0.75f, // top right vertex
+		1.0f, 0.0f, 1.0f,	0.0f, 0.0f, 1.0f,	0.66f, 0.5f, // bottom right vertex
 		// Back Face
-		-0.5f, 0.0f, 0.001f,	0.0f, 0.0f, -1.0f,	0.15f, 0.0f, // bottom left vertex
-		-0.5f, 0.5f, 0.001f,	0.0f, 0.0f, -1.0f,	0.15f, 0.44f, // top left vertex
-		 0.5f, 0.5f, 0.001f,	0.0f, 0.0f, -1.0f,	0.83f, 0.44f, // top right vertex
-		 0.5f, 0.5f, 0.001f,	0.0f, 0.0f, -1.0f,	0.83f, 0.44f, // top right vertex
-		 0.5f, 0.0f, 0.001f,	0.0f, 0.0f, -1.0f,	0.83f, 0.0f, // bottom right vertex
-		-0.5f, 0.0f, 0.001f,	0.0f, 0.0f, -1.0f,	0.15f, 0.0f, // bottom left vertex
+		0.0f, 0.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.34f, 0.0f, // back bottom left vertex
+		0.0f, 1.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.34f, 0.25f, // back top left vertex
+		1.0f, 1.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.665f, 0.25f, // back top right vertex
+		1.0f, 0.0f, 0.0f,	0.0f, 0.0f, -1.0f,	0.665f, 0.0f, // back bottom right vertex
 		// Left Face
-		-0.5f, 0.0f, 0.1f,		-1.0f, 0.0f, 0.0f,	0.15f, 0.5f, // bottom left vertex
-		-0.5f, 0.5f, 0.1f,		-1.0f, 0.0f, 0.0f,  0.15f, 0.94f, // top left vertex
-		-0.5f, 0.5f, 0.001f,	-1.0f, 0.0f, 0.0f,	0.0f, 0.94f, // back top left vertex
-		-0.5f, 0.5f, 0.001f,	-1.0f, 0.0f, 0.0f,	0.0f, 0.94f, // back top left vertex
-		-0.5f, 0.0f, 0.001f,	-1.0f, 0.0f, 0.0f,	0.0f, 0.5f, // back bottom left vertex
-		-0.5f, 0.0f, 0.1f,		-1.0f, 0.0f, 0.0f,	0.15f, 0.5f, // bottom left vertex
+		0.0f, 0.0f, 1.0f,	-1.0f, 0.0f, 0.0f,	0.33f, 0.5f, // bottom left vertex
+		0.0f, 1.0f, 1.0f,	-1.0f, 0.0f, 0.0f,	0.33f, 0.75f, // top left vertex
+		0.0f, 1.0f, 0.0f,	-1.0f, 0.0f, 0.0f,	0.0f, 0.75f, // back top left vertex
+		0.0f, 0.0f, 0.0f,	-1.0f, 0.0f, 0.0f,	0.0f, 0.5f, // back bottom left vertex
 		// Right Face
-		 0.5f, 0.0f, 0.1f,		1.0f, 0.0f, 0.0f,	1.0f, 0.5f, // bottom right vertex
-		 0.5f, 0.5f, 0.1f,		1.0f, 0.0f, 0.0f,	1.0f, 0.94f, // top right vertex
-		 0.5f, 0.5f, 0.001f,	1.0f, 0.0f, 0.0f,	0.83f, 0.94f, // back top right vertex
-		 0.5f, 0.5f, 0.001f,	1.0f, 0.0f, 0.0f,	0.83f, 0.94f, // back top right vertex
-		 0.5f, 0.0f, 0.001f,	1.0f, 0.0f, 0.0f,	0.83f, 0.5f, // back bottom right vertex
-		 0.5f, 0.0f, 0.1f,		1.0f, 0.0f, 0.0f,	1.0f, 0.5f, // bottom right vertex
+		1.0f, 0.0f, 1.0f,	1.0f, 0.0f, 0.0f,	0.66f, 0.5f, // bottom right vertex
+		1.0f, 1.0f, 1.0f,	1.0f, 0.0f, 0.0f,	0.66f, 0.75f, // top right vertex
+		1.0f, 1.0f, 0.0f,	1.0f, 0.0f, 0.0f,	1.0f, 0.75f, // back top right vertex
+		1.0f, 0.0f, 0.0f,	1.0f, 0.0f, 0.0f,	1.0f, 0.5f, // back bottom right vertex
 		// Top Face
-		-0.5f, 0.5f, 0.1f,		0.0f, 1.0f, 0.0f,	0.15f, 0.94f, // top left vertex
-		-0.5f, 0.5f, 0.001f,	0.0f, 1.0f, 0.0f,	0.15f, 1.0f, // back top left vertex
-		 0.5f, 0.5f, 0.001f,	0.0f, 1.0f, 0.0f,	0.83f, 1.0f, // back top right vertex
-		 0.5f, 0.5f, 0.001f,	0.0f, 1.0f, 0.0f,	0.83f, 1.0f, // back top right vertex
-		 0.5f, 0.5f, 0.1f,		0.0f, 1.0f, 0.0f,	0.83f, 0.94f, // top right vertex
-		-0.5f, 0.5f, 0.1f,		0.0f, 1.0f, 0.0f,	0.15f, 0.94f, // top left vertex
+		0.0f, 1.0f, 1.0f,	0.0f, 1.0f, 0.0f,	0.34f, 0.75f, // top left vertex
+		0.0f, 1.0f, 0.0f,	0.0f, 1.0f, 0.0f,	0.34f, 1.0f, // back top left vertex
+		1.0f, 1.0f, 0.0f,	0.0f, 1.0f, 0.0f,	0.665f, 1.0f, // back top right vertex
+		1.0f, 1.0f, 1.0f,	0.0f, 1.0f, 0.0f,	0.665f, 0.75f, // top right vertex
 		// Bottom Face
-		-0.5f, 0.0f, 0.1f,		0.0f, -1.0f, 0.0f,	0.15f, 0.5f, // bottom left vertex
-		-0.5f, 0.0f, 0.001f,	0.0f, -1.0f, 0.0f,	0.15f, 0.44f, // back bottom left vertex
-		 0.5f, 0.0f, 0.001f,	0.0f, -1.0f, 0.0f,	0.83f, 0.44f, // back bottom right vertex
-		 0.5f, 0.0f, 0.001f,	0.0f, -1.0f, 0.0f,	0.83f, 0.44f, // back bottom right vertex
-		 0.5f, 0.0f, 0.1f,		0.0f, -1.0f, 0.0f,	0.83f, 0.5f, // bottom right vertex
-		-0.5f, 0.0f, 0.1f,		0.0f, -1.0f, 0.0f,	0.15f, 0.5f, // bottom left vertex
-
+		0.0f, 0.0f, 1.0f,	0.0f, -1.0f, 0.0f,	0.34f, 0.5f, // bottom left vertex
+		0.0f, 0.0f, 0.0f,	0.0f, -1.0f, 0.0f,	0.34f, 0.25f, // back bottom left vertex
+		1.0f, 0.0f, 0.0f,	0.0f, -1.0f, 0.0f,	0.665f, 0.25f, // back bottom right vertex
+		1.0f, 0.0f, 1.0f,	0.0f, -1.0f, 0.0f,	0.665f, 0.5f, // bottom right vertex
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// generating vertex array object names
-	glGenVertexArrays(1, &mesh.vaos[0]);
-	// Binding generated vertex array name
-	glBindVertexArray(mesh.vaos[0]);
-
-	// Generates buffers for vertex data and indices
-	glGenBuffers(1, &mesh.vbos[0]);
-	// Binding vertex data
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);
-	// Sending vertex/coordinate data to GPU
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
-
-	// Setting stride, which is 5 (3 + 2)
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Creating vertex attrib pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
+	// two triangles per face, same winding as the original triangle lists
+	const GLuint boxIndices[] = {
+		 0,  1,  2,  2,  3,  0,
+		 4,  5,  6,  6,  7,  4,
+		 8,  9, 10, 10, 11,  8,
+		12, 13, 14, 14, 15, 12,
+		16, 17, 18, 18, 19, 16,
+		20, 21, 22, 22, 23, 20
+	};
 
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// Program 1 draws the boxes and plane, program 2 the cylinders; added in SceneMesh order
+	const GLsizei floatsPerVertex = 8;
+	arena.addMesh(planeVerts, sizeof(planeVerts) / sizeof(GLfloat) / floatsPerVertex,
+		planeIndices, sizeof(planeIndices) / sizeof(GLuint), OBJECT_PROGRAM_INDEX);
+	arena.addMesh(bookBoxVerts, sizeof(bookBoxVerts) / sizeof(GLfloat) / floatsPerVertex,
+		boxIndices, sizeof(boxIndices) / sizeof(GLuint), OBJECT_PROGRAM_INDEX);
+	arena.addMesh(cubeBoxVerts, sizeof(cubeBoxVerts) / sizeof(GLfloat) / floatsPerVertex,
+		boxIndices, sizeof(boxIndices) / sizeof(GLuint), OBJECT_PROGRAM_INDEX);
+	// Cylinder vertices are interleaved the same way, only their copy in the arena is used
+	UAddCylinderLods(arena, cylinder1);
+	UAddCylinderLods(arena, cylinder2);
+}
 
-	// Cylinder VAO
-	glUseProgram(gCylProgramId);
+// Adds a cylinder as one mesh with every level of its LOD chain. A level of n sectors misses
+// the circle by at most radius * (1 - cos(pi / n)), and the cylinder's bounding sphere is at
+// least as wide as the cylinder, so keeping that under LOD_PIXEL_ERROR gives each level's
+// largest on-screen size.
+uint32_t UAddCylinderLods(MeshArena& arena, Cylinder& cylinder)
+{
+	cylinder.setLodSectorCounts(CYLINDER_LOD_SECTORS, sizeof(CYLINDER_LOD_SECTORS) / sizeof(CYLINDER_LOD_SECTORS[0]));
+	const GLfloat* vertices = cylinder.getLodInterleavedVertices();
+	const GLuint* indices = cylinder.getLodIndices();
+	const GLsizei floatsPerVertex = 8;
 
-	glGenVertexArrays(1, &mesh.vaos[1]);
-	glBindVertexArray(mesh.vaos[1]);
-	glGenBuffers(1, &mesh.vbos[1]);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[1]);
-	glBufferData(GL_ARRAY_BUFFER, cylinder1.getInterleavedVertexSize(), cylinder1.getInterleavedVertices(), GL_STATIC_DRAW);
+	uint32_t mesh = arena.addMesh(vertices, cylinder.getLodVertexCount(0), indices, cylinder.getLodIndexCount(0), CYLINDER_PROGRAM_INDEX);
+	for (int level = 1; level < cylinder.getLodCount(); ++level)
+	{
+		float chordError = 1.0f - cos(glm::pi<float>() / cylinder.getLodSectorCount(level));
+		arena.addLod(mesh, vertices + cylinder.getLodVertexStart(level) * floatsPerVertex, cylinder.getLodVertexCount(level),
+			indices + cylinder.getLodIndexStart(level), cylinder.getLodIndexCount(level),
+			2.0f * LOD_PIXEL_ERROR / (chordError * WINDOW_HEIGHT));
+	}
+	return mesh;
+}
 
-	// Creating vertex attrib pointers
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, cylinder1.getInterleavedStride(), 0);
-	glEnableVertexAttribArray(0);
+void UCreateMeshes()
+{
+	UAddSceneMeshes(gMeshes);
+	gMeshes.create(gPackedVertices);
+	cout << "INFO: Vertex buffer " << gMeshes.vertexBufferBytes() << " bytes, "
+		<< (gMeshes.packedVertices() ? "16-byte packed" : "32-byte float") << " vertices; index buffer "
+		<< gMeshes.indexBufferBytes() << " bytes, " << (gMeshes.indexType() == GL_UNSIGNED_SHORT ? 16 : 32) << "-bit indices" << endl;
+
+	// Every level was welded and reordered for the vertex cache on its way into the arena
+	for (uint32_t mesh = 0; mesh < gMeshes.meshCount(); ++mesh)
+	{
+		for (uint32_t level = 0; level < gMeshes.lodCount(mesh); ++level)
+		{
+			const MeshOptimizeStats& stats = gMeshes.optimizeStats(mesh, level);
+			cout << "INFO: Mesh " << mesh << " lod " << level << ": " << stats.verticesBefore << " -> " << stats.verticesAfter
+				<< " vertices, ACMR " << stats.acmrBefore << " -> " << stats.acmrAfter << " (" << VERTEX_CACHE_SIZE << " entry FIFO)" << endl;
+		}
+	}
+	if (gOcclusionCulling)
+		gMeshes.setOcclusionCulling(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
 
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, cylinder1.getInterleavedStride(), (void*)(sizeof(float)* floatsPerVertex));
-	glEnableVertexAttribArray(1);
+	// Textures listed by the scene decode on the loader's worker threads and stream in as they finish
+	for (uint32_t i = 0; i < gScene.textureCount(); ++i)
+		gTextureLoader.request(gScene.texturePath(i), gTextures[gScene.texture(i).unit]);
+}
 
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, cylinder1.getInterleavedStride(), (void*)(sizeof(float)* (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+void UDestroyMeshes()
+{
+	gMeshes.destroy();
+}
 
-	// Marble Texture
-	const char* texFilename = "../CS330 Final Project/Resources/Textures/marble.jfif";
-	if (!UCreateTexture(texFilename, texture0))
+void UCreateSceneInstances()
+{
+	for (int mesh = 0; mesh < SCENE_MESH_COUNT; ++mesh)
 	{
-		cout << "Failed to load texture " << texFilename << endl;
+		gSceneInstances[mesh].clear();
+		gSceneInstanceNodes[mesh].clear();
 	}
-	// Book Texture
-	texFilename = "../CS330 Final Project/Resources/Textures/gulagArchipelago.png";
-	if (!UCreateTexture(texFilename, texture1))
+
+	gSceneTransforms.clear();
+	vector<uint32_t> instanceNodes = UAddSceneTransforms(gSceneTransforms, TransformHierarchy::NO_PARENT);
+	gSceneTransforms.update();
+
+	for (uint32_t i = 0; i < gScene.instanceCount(); ++i)
 	{
-		cout << "Failed to load texture " << texFilename << endl;
+		const SceneInstance& instance = gScene.instance(i);
+		MeshInstance meshInstance = { gSceneTransforms.world(instanceNodes[i]), instance.material, (instance.flags & SCENE_INSTANCE_OCCLUDER) != 0 };
+		gSceneInstances[instance.mesh].push_back(meshInstance);
+		gSceneInstanceNodes[instance.mesh].push_back(instanceNodes[i]);
 	}
-	// Rubik's Cube Texture
-	texFilename = "../CS330 Final Project/Resources/Textures/rubikscube.png";
-	if (!UCreateTexture(texFilename, texture2))
+	++gSceneInstancesVersion;
+}
+
+vector<uint32_t> UAddSceneTransforms(TransformHierarchy& hierarchy, uint32_t parent)
+{
+	// scene files list every node after its parent, which is the order the hierarchy needs too
+	vector<uint32_t> nodes(gScene.nodeCount());
+	for (uint32_t i = 0; i < gScene.nodeCount(); ++i)
 	{
-		cout << "Failed to load texture " << texFilename << endl;
+		const SceneNode& node = gScene.node(i);
+		nodes[i] = hierarchy.add(node.parent == SCENE_NO_PARENT ? parent : nodes[node.parent], glm::make_mat4(node.local));
 	}
-	// Dust Texture
-	texFilename = "../CS330 Final Project/Resources/Textures/dust.jpg";
-	if (!UCreateTexture(texFilename, texture3))
+
+	vector<uint32_t> instanceNodes(gScene.instanceCount());
+	for (uint32_t i = 0; i < gScene.instanceCount(); ++i)
 	{
-		cout << "Failed to load texture " << texFilename << endl;
+		const SceneInstance& instance = gScene.instance(i);
+		instanceNodes[i] = hierarchy.add(instance.parent == SCENE_NO_PARENT ? parent : nodes[instance.parent], glm::make_mat4(instance.model));
 	}
+	return instanceNodes;
 }
 
-void UDestroyMesh(GLMesh& mesh)
+void USyncSceneTransforms()
 {
-	// Delete mesh
-	glDeleteVertexArrays(1, &mesh.vaos[0]);
-	glDeleteVertexArrays(1, &mesh.vaos[1]);
-	glDeleteBuffers(1, &mesh.vbos[0]);
-	glDeleteBuffers(1, &mesh.vbos[1]);
+	// nothing in the scene moves on its own, so this is usually a single flag test
+	if (!gSceneTransforms.dirty())
+		return;
+
+	gSceneTransforms.update();
+	for (int mesh = 0; mesh < SCENE_MESH_COUNT; ++mesh)
+	{
+		for (size_t i = 0; i < gSceneInstanceNodes[mesh].size(); ++i)
+			gSceneInstances[mesh][i].model = gSceneTransforms.world(gSceneInstanceNodes[mesh][i]);
+	}
+	++gSceneInstancesVersion;
 }
 
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* vertexFormatShaderSource, const char* fragShaderSource,
+	const char* materialShaderSource, GLuint& programId)
 {
-	// for comp and linkage error reporting
-	int success = 0;
-	char infoLog[512];
-
-	// Creating shader program object
-	programId = glCreateProgram();
+	// the vertex decoding is a second vertex shader and the material lookup a second fragment shader
+	const ShaderStageSource stages[] = {
+		{ GL_VERTEX_SHADER, vtxShaderSource },
+		{ GL_VERTEX_SHADER, vertexFormatShaderSource },
+		{ GL_FRAGMENT_SHADER, fragShaderSource },
+		{ GL_FRAGMENT_SHADER, materialShaderSource }
+	};
 
-	// Creating vertex and fragment shader objects
-	GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-	GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+	// only starts the compile, or the binary cache load; UUpdateShaderPrograms picks the program
+	// up once it has linked, and a program built from the same sources is shared right away
+	programId = gShaders.request(stages, sizeof(stages) / sizeof(stages[0]));
+	return programId != 0;
+}
 
-	// get shader sources
-	glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-	glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+bool UCreateFallbackProgram(GLuint& programId)
+{
+	const ShaderStageSource stages[] = {
+		{ GL_VERTEX_SHADER, objectVertexShaderSource },
+		{ GL_VERTEX_SHADER, gMeshes.vertexShaderSource() },
+		{ GL_FRAGMENT_SHADER, fallbackFragmentShaderSource }
+	};
 
-	// compile vertex shader
-	glCompileShader(vertexShaderId);
-	// check for compile errors
-	glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+	programId = gShaders.acquire(stages, sizeof(stages) / sizeof(stages[0]));
+	return programId != 0;
+}
 
+bool UUpdateShaderPrograms()
+{
+	if (gShaderProgramsReady)
 		return false;
-	}
-
-	// compile fragment shader
-	glCompileShader(fragmentShaderId);
-	// check for compile errors
-	glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-		std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
 
+	gShaders.poll();
+	if (!gShaders.ready(gProgramId) || !gShaders.ready(gCylProgramId))
 		return false;
-	}
 
-	// Attach shaders to shader program
-	glAttachShader(programId, vertexShaderId);
-	glAttachShader(programId, fragmentShaderId);
+	// resolve every uniform location once, URender only uses the cached handles. The cylinders
+	// share the object program, so building it once covers both.
+	gUniformCache.build(gProgramId);
+	UResolveObjectUniforms(gProgramId, gObjectUniforms);
+	UResolveObjectUniforms(gCylProgramId, gCylUniforms);
 
-	glLinkProgram(programId); // link shader program
-	// check for linking errors
-	glGetProgramiv(programId, GL_LINK_STATUS, &success);
-	if (!success)
-	{
-		glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-
-		return false;
-	}
-
-	glUseProgram(programId);
+	// Telling OpenGL which texture the sample is connected to, which is unit 0 (the material array)
+	glUseProgram(gProgramId);
+	USetUniform(gObjectUniforms.uMaterials, 0);
+	glUseProgram(gCylProgramId);
+	USetUniform(gCylUniforms.uMaterials, 0);
 
+	gShaderProgramsReady = true;
 	return true;
 }
 
 void UDestroyShaderProgram(GLuint programId)
 {
-	glDeleteProgram(programId);
+	// shared programs stay until their last user lets go
+	if (gShaders.release(programId))
+		gUniformCache.forget(programId);
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
@@ -1023,71 +1452,657 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 	cameraFront = glm::normalize(direction);
 }
 
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
+bool UCreateOffscreenTarget(int width, int height)
+{
+	glGenFramebuffers(1, &gOffscreenFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, gOffscreenFbo);
+
+	// color attachment
+	glGenRenderbuffers(1, &gOffscreenColor);
+	glBindRenderbuffer(GL_RENDERBUFFER, gOffscreenColor);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gOffscreenColor);
+
+	// depth attachment, URender relies on the depth test
+	glGenRenderbuffers(1, &gOffscreenDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, gOffscreenDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gOffscreenDepth);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cout << "Offscreen framebuffer is incomplete" << endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return false;
+	}
+
+	glViewport(0, 0, width, height);
+	return true;
+}
+
+void UDestroyOffscreenTarget()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteRenderbuffers(1, &gOffscreenColor);
+	glDeleteRenderbuffers(1, &gOffscreenDepth);
+	glDeleteFramebuffers(1, &gOffscreenFbo);
+}
+
+void URunHeadless(int frameCount)
+{
+	if (!UCreateOffscreenTarget(WINDOW_WIDTH, WINDOW_HEIGHT))
+		return;
+
+	cout << "INFO: Headless run, " << frameCount << " frames at " << WINDOW_WIDTH << "x" << WINDOW_HEIGHT
+		<< " on " << glGetString(GL_RENDERER) << endl;
+
+	UTimeFrames(frameCount, "urender");
+
+	UDestroyOffscreenTarget();
+}
+
+void UTimeFrames(int frameCount, const string& label)
 {
-	for (int j = 0; j < height / 2; ++j)
+	// A small ring of timer queries so reading GPU results never waits on the frame just submitted
+	const int QUERY_COUNT = 4;
+	GLuint queries[QUERY_COUNT];
+	glGenQueries(QUERY_COUNT, queries);
+
+	// the first frames include shader/texture warm-up in the driver and are not recorded
+	const int warmupFrames = frameCount > 20 ? 5 : (frameCount > 1 ? 1 : 0);
+
+	FrameStats cpuStats, gpuStats, clusterStats, cullStats, occlusionStats;
+
+	// headless frames build their packet on the GL thread, with the camera exactly on the current state
+	RenderPacket packet;
+
+	for (int frame = 0; frame < frameCount + QUERY_COUNT; ++frame)
 	{
-		int index1 = j * width * channels;
-		int index2 = (height - 1 - j) * width * channels;
+		int slot = frame % QUERY_COUNT;
+
+		// collect the GPU time of the frame that last used this query
+		int previous = frame - QUERY_COUNT;
+		if (previous >= warmupFrames && previous < frameCount)
+		{
+			GLuint64 elapsedNs = 0;
+			glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsedNs);
+			gpuStats.add(elapsedNs / 1.0e6);
+		}
+
+		if (frame >= frameCount)
+			continue;
+
+		CpuTimer timer;
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+
+		UBuildRenderPacket(USnapshotInput(), 1.0f, packet);
+		URender(packet);
 
-		for (int i = width * channels; i > 0; --i)
+		glEndQuery(GL_TIME_ELAPSED);
+		if (frame >= warmupFrames)
 		{
-			unsigned char tmp = image[index1];
-			image[index1] = image[index2];
-			image[index2] = tmp;
-			++index1;
-			++index2;
+			cpuStats.add(timer.elapsedMs());
+			clusterStats.add(gClusterGrid.lastAssignMs());
+			cullStats.add(gMeshes.lastCullMs());
+			occlusionStats.add(gMeshes.lastOcclusionMs());
 		}
 	}
+
+	cpuStats.report((label + "_cpu").c_str());
+	gpuStats.report((label + "_gpu").c_str());
+	clusterStats.report((label + "_light_assign_cpu").c_str());
+	cullStats.report((label + "_frustum_cull_cpu").c_str());
+	if (gMeshes.occlusionCulling())
+		occlusionStats.report((label + "_occlusion_cull_cpu").c_str());
+
+	const DrawQueueStats& drawStats = gDrawQueue.stats();
+	cout << "INFO: " << label << " draw queue: " << drawStats.draws << " draws, " << drawStats.programBinds << " program and "
+		<< drawStats.vaoBinds << " VAO binds, "
+		<< drawStats.bindsSkipped() << " redundant binds skipped" << endl;
+	cout << "INFO: " << label << " frustum culling: " << gMeshes.visibleCount() << " instances visible, "
+		<< gMeshes.culledCount() << " culled per frame, " << gMeshes.occludedCount() << " of them behind occluders, "
+		<< gMeshes.triangleCount() << " triangles drawn" << endl;
+
+	glDeleteQueries(QUERY_COUNT, queries);
 }
 
-bool UCreateTexture(const char* filename, GLuint& textureId)
+void UResolveObjectUniforms(GLuint programId, ObjectProgramUniforms& uniforms)
 {
-	int width, height, channels;
-	unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-
-	if (image)
-	{
-		flipImageVertically(image, width, height, channels);
-
-		// generates texture names
-		glGenTextures(1, &textureId);
-		// binding texure to 2D texture
-		glBindTexture(GL_TEXTURE_2D, textureId);
-
-		// set texture wrapping params
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		// set texture filtering params
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		// Assigning texture to pointer, and defining how it will be stored in memory
-		if (channels == 3)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-		else if (channels == 4)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		else
+	uniforms.uMaterials = gUniformCache.handle<int>(programId, "uMaterials");
+}
+
+void UCreateUniformBuffers()
+{
+	// storage is allocated once, frames only overwrite it
+	glGenBuffers(1, &gFrameUbo);
+	glBindBuffer(GL_UNIFORM_BUFFER, gFrameUbo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// binding points are context state, every program declares the same layout(binding = N)
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, gFrameUbo);
+
+	// light list, cluster grid and cluster index shader storage buffers
+	gClusterGrid.create();
+}
+
+void UDestroyUniformBuffers()
+{
+	glDeleteBuffers(1, &gFrameUbo);
+	gClusterGrid.destroy();
+}
+
+PointLight UMakePointLight(const glm::vec3& color, const glm::vec3& position)
+{
+	PointLight light;
+	light.position = glm::vec4(position, 1.0f);
+	light.ambient = glm::vec4(color * 0.1f, 0.0f);
+	light.diffuse = glm::vec4(color, 0.0f);
+	light.specular = glm::vec4(color, 0.0f);
+	light.attenuation = glm::vec4(1.0f, 0.09f, 0.032f, 0.0f); // constant, linear, quadratic
+	light.attenuation.w = UPointLightRange(light);
+	return light;
+}
+
+void UCreateSceneLights()
+{
+	gPointLights.clear();
+	gCurrentState.lightPositions.clear();
+	for (uint32_t i = 0; i < gScene.lightCount(); ++i)
+	{
+		const SceneLight& light = gScene.light(i);
+		gPointLights.push_back(UMakePointLight(glm::make_vec3(light.color), glm::make_vec3(light.position)));
+		gCurrentState.lightPositions.push_back(glm::make_vec3(light.position));
+	}
+}
+
+void UUploadFrameUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPosition)
+{
+	FrameBlock frame;
+	frame.view = view;
+	frame.projection = projection;
+	frame.viewPosition = glm::vec4(viewPosition, 1.0f);
+	frame.clusterParams = gClusterGrid.sliceParams();
+	frame.clusterDims = glm::uvec4(CLUSTER_X, CLUSTER_Y, CLUSTER_Z, 0);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, gFrameUbo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlock), &frame);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UBenchmarkLightCounts(int frameCount)
+{
+	if (!UCreateOffscreenTarget(WINDOW_WIDTH, WINDOW_HEIGHT))
+		return;
+
+	cout << "INFO: Clustered lighting benchmark, " << CLUSTER_X << "x" << CLUSTER_Y << "x" << CLUSTER_Z
+		<< " clusters, " << frameCount << " frames per light count on " << glGetString(GL_RENDERER) << endl;
+
+	// fixed-seed LCG so every run places the same lights
+	unsigned int seed = 12345u;
+	auto random01 = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (1.0f / 16777216.0f);
+	};
+
+	for (int lightCount = 2; lightCount <= 1024; lightCount *= 2)
+	{
+		UCreateSceneLights();
+		while ((int)gPointLights.size() < lightCount)
+		{
+			// scattered over and around the table top, dimmer than the scene lights
+			glm::vec3 position(-4.0f + 8.0f * random01(), -4.0f + 8.0f * random01(), 0.1f + 3.0f * random01());
+			glm::vec3 color = 0.25f * glm::vec3(random01(), random01(), random01());
+			gPointLights.push_back(UMakePointLight(color, position));
+		}
+
+		UTimeFrames(frameCount, "lights_" + to_string(lightCount));
+		cout << "INFO: lights_" << lightCount << " cluster light references: " << gClusterGrid.lastIndexCount() << endl;
+	}
+
+	UCreateSceneLights();
+	UDestroyOffscreenTarget();
+}
+
+void UBenchmarkInstances(int frameCount)
+{
+	if (!UCreateOffscreenTarget(WINDOW_WIDTH, WINDOW_HEIGHT))
+		return;
+
+	cout << "INFO: Instancing benchmark, " << frameCount << " frames per instance count on " << glGetString(GL_RENDERER) << endl;
+
+	// fixed-seed LCG so every run places the same cubes
+	unsigned int seed = 12345u;
+	auto random01 = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (1.0f / 16777216.0f);
+	};
+
+	for (int instanceCount = 1024; instanceCount <= 65536; instanceCount *= 4)
+	{
+		UCreateSceneInstances();
+		for (int i = 0; i < instanceCount; ++i)
+		{
+			// small cubes over the table top, each with one of the four scene textures
+			glm::vec3 position(-2.0f + 4.0f * random01(), -2.0f + 4.0f * random01(), 0.5f * random01());
+			glm::mat4 model = glm::translate(position) * glm::rotate(6.28f * random01(), glm::vec3(0.0f, 0.0f, 1.0f))
+				* glm::scale(glm::vec3(0.04f));
+			MeshInstance cube = { model, (GLuint)(i % 4), false };
+			gSceneInstances[SCENE_MESH_CUBE_BOX].push_back(cube);
+		}
+		++gSceneInstancesVersion;
+
+		UTimeFrames(frameCount, "instances_" + to_string(instanceCount));
+		cout << "INFO: instances_" << instanceCount << " multi-draw calls: " << gMeshes.drawCalls() << ", indirect commands: "
+			<< gMeshes.commandCount() << endl;
+
+		// scene queries: rays from the camera at random table points, and neighbours of random cubes
+		const int queryCount = 1000;
+		FrameStats rayStats, nearStats;
+		size_t rayHits = 0, neighbours = 0;
+		vector<InstanceRef> near;
+		for (int query = 0; query < queryCount; ++query)
+		{
+			glm::vec3 target(-2.0f + 4.0f * random01(), -2.0f + 4.0f * random01(), 0.0f);
+			float distance = FAR_PLANE;
+			InstanceRef hit;
+			CpuTimer rayTimer;
+			rayHits += gMeshes.raycastBounds(gCurrentState.cameraPos, glm::normalize(target - gCurrentState.cameraPos), distance, hit);
+			rayStats.add(rayTimer.elapsedMs());
+
+			const MeshInstance& cube = gSceneInstances[SCENE_MESH_CUBE_BOX][query % instanceCount];
+			near.clear();
+			CpuTimer nearTimer;
+			gMeshes.instancesNear(glm::vec3(cube.model[3]), 0.1f, near);
+			nearStats.add(nearTimer.elapsedMs());
+			neighbours += near.size();
+		}
+		rayStats.report(("instances_" + to_string(instanceCount) + "_bvh_raycast_cpu").c_str());
+		nearStats.report(("instances_" + to_string(instanceCount) + "_bvh_near_cpu").c_str());
+		cout << "INFO: instances_" << instanceCount << " BVH: " << gMeshes.hierarchy().nodeCount() << " nodes, "
+			<< rayHits << " of " << queryCount << " rays hit, " << neighbours / (double)queryCount << " instances within 0.1 of a cube" << endl;
+	}
+
+	UCreateSceneInstances();
+	UDestroyOffscreenTarget();
+}
+
+void UBenchmarkPicking(int rayCount)
+{
+	if (!UCreateOffscreenTarget(WINDOW_WIDTH, WINDOW_HEIGHT))
+		return;
+
+	// one frame so there is a camera to pick against
+	RenderPacket packet;
+	UBuildRenderPacket(USnapshotInput(), 1.0f, packet);
+	URender(packet);
+
+	cout << "INFO: Picking benchmark on " << glGetString(GL_RENDERER) << endl;
+	for (int row = 1; row <= 3; ++row)
+	{
+		for (int column = 1; column <= 3; ++column)
+		{
+			double x = gViewportWidth * column / 4.0, y = gViewportHeight * row / 4.0;
+			PickHit hit;
+			CpuTimer timer;
+			bool found = UPick(x, y, hit);
+			double ms = timer.elapsedMs();
+			cout << "INFO: pick (" << x << ", " << y << "): ";
+			if (found)
+				cout << USceneMeshName(hit.instance.mesh) << " " << hit.instance.instance << ", triangle " << hit.triangle
+					<< ", uv (" << hit.uv.x << ", " << hit.uv.y << ")";
+			else
+				cout << "nothing";
+			cout << " in " << ms << " ms" << endl;
+		}
+	}
+	UDestroyOffscreenTarget();
+
+	// 1000 sectors by 500 stacks is a million side triangles
+	Cylinder dense(1.0f, 1.0f, 2.0f, 1000, 500);
+	CpuTimer buildTimer;
+	TriangleBvh triangles;
+	triangles.build(dense.getInterleavedVertices(), dense.getInterleavedVertexCount(), dense.getIndices(), dense.getIndexCount());
+	cout << "INFO: pick_1m triangle BVH over " << triangles.triangleCount() << " triangles built in " << buildTimer.elapsedMs() << " ms" << endl;
+
+	// fixed-seed LCG so every run casts the same rays, from a sphere around the cylinder at points near its axis
+	unsigned int seed = 12345u;
+	auto random01 = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (1.0f / 16777216.0f);
+	};
+
+	FrameStats rayStats;
+	int hits = 0;
+	for (int ray = 0; ray < rayCount; ++ray)
+	{
+		float angle = 6.2832f * random01();
+		glm::vec3 origin(5.0f * cos(angle), 5.0f * sin(angle), -3.0f + 6.0f * random01());
+		glm::vec3 target(0.5f * random01() - 0.25f, 0.5f * random01() - 0.25f, 1.8f * random01() - 0.9f);
+
+		float distance = FAR_PLANE;
+		TriangleHit hit;
+		CpuTimer timer;
+		hits += triangles.raycast(origin, glm::normalize(target - origin), distance, hit);
+		rayStats.add(timer.elapsedMs());
+	}
+	rayStats.report("pick_1m_triangles_cpu");
+	cout << "INFO: pick_1m " << hits << " of " << rayCount << " rays hit" << endl;
+}
+
+void UBenchmarkImageFlip(int iterations)
+{
+	const int width = 3840, height = 2160, channels = 4;
+	const size_t rowBytes = (size_t)width * channels;
+	vector<unsigned char> image(rowBytes * height);
+	for (size_t i = 0; i < image.size(); ++i)
+		image[i] = (unsigned char)(i * 31u);
+
+	cout << "INFO: Image flip benchmark, " << width << "x" << height << " RGBA, " << iterations << " iterations" << endl;
+
+	FrameStats bytewiseStats, memcpyStats, simdStats;
+	vector<unsigned char> scratch(rowBytes);
+	unsigned int sink = 0;
+
+	for (int i = 0; i < iterations; ++i)
+	{
+		// the byte-at-a-time loop the loader used before
+		CpuTimer timer;
+		unsigned char* data = image.data();
+		for (int j = 0; j < height / 2; ++j)
+		{
+			size_t index1 = j * rowBytes;
+			size_t index2 = (height - 1 - j) * rowBytes;
+			for (size_t k = rowBytes; k > 0; --k)
+			{
+				unsigned char tmp = data[index1];
+				data[index1] = data[index2];
+				data[index2] = tmp;
+				++index1;
+				++index2;
+			}
+		}
+		bytewiseStats.add(timer.elapsedMs());
+
+		// whole rows through a row-sized scratch buffer, as Bmp::flipImage used to
+		timer.reset();
+		for (int j = 0; j < height / 2; ++j)
+		{
+			unsigned char* top = data + j * rowBytes;
+			unsigned char* bottom = data + (height - 1 - j) * rowBytes;
+			memcpy(scratch.data(), top, rowBytes);
+			memcpy(top, bottom, rowBytes);
+			memcpy(bottom, scratch.data(), rowBytes);
+		}
+		memcpyStats.add(timer.elapsedMs());
+
+		timer.reset();
+		UFlipImageRows(data, rowBytes, height);
+		simdStats.add(timer.elapsedMs());
+
+		// three flips leave the image flipped, keep the optimizer from dropping any of them
+		sink += data[(i * 7919u) % image.size()];
+	}
+
+	bytewiseStats.report("flip_4k_bytewise");
+	memcpyStats.report("flip_4k_memcpy_scratch");
+	simdStats.report("flip_4k_simd_rows");
+	cout << "INFO: SIMD row swap throughput " << (image.size() / 1.0e6) / simdStats.mean() << " GB/s (checksum " << sink << ")" << endl;
+	cout << "INFO: Scene textures skip the flip entirely, the object shader samples with V = 1 - v" << endl;
+}
+
+void UBenchmarkOcclusion(int frameCount)
+{
+	// the meshes are never created, so the arena makes no GL calls
+	MeshArena arena;
+	UAddSceneMeshes(arena);
+	arena.setOcclusionCulling(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+
+	// fixed-seed LCG so every run builds the same office
+	unsigned int seed = 12345u;
+	auto random01 = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (1.0f / 16777216.0f);
+	};
+
+	// a floor of copies of the scene's desk, 5 units apart, each with a row of standing books
+	// (occluders) near its back edge, cubes behind the books, under the table and in front
+	const int DESKS_PER_SIDE = 8;
+	const float DESK_SPACING = 5.0f;
+	TransformHierarchy sceneTransforms;
+	vector<uint32_t> instanceNodes = UAddSceneTransforms(sceneTransforms, TransformHierarchy::NO_PARENT);
+	sceneTransforms.update();
+	vector<MeshInstance> instances[SCENE_MESH_COUNT];
+	for (int row = 0; row < DESKS_PER_SIDE; ++row)
+	{
+		for (int column = 0; column < DESKS_PER_SIDE; ++column)
+		{
+			glm::mat4 desk = glm::translate(glm::vec3(column * DESK_SPACING, row * DESK_SPACING, 0.0f));
+			for (uint32_t i = 0; i < gScene.instanceCount(); ++i)
+			{
+				const SceneInstance& instance = gScene.instance(i);
+				MeshInstance copy = { desk * sceneTransforms.world(instanceNodes[i]), instance.material, (instance.flags & SCENE_INSTANCE_OCCLUDER) != 0 };
+				instances[instance.mesh].push_back(copy);
+			}
+
+			for (int book = 0; book < 4; ++book)
+			{
+				glm::mat4 model = desk * glm::translate(glm::vec3(-1.8f + 0.9f * book, 1.2f, 0.0f)) * glm::scale(glm::vec3(0.85f, 0.12f, 0.7f));
+				MeshInstance standing = { model, 1u, true };
+				instances[SCENE_MESH_BOOK_BOX].push_back(standing);
+			}
+
+			const glm::vec3 cubeAreaMin[3] = { glm::vec3(-1.8f, 1.4f, 0.0f), glm::vec3(-1.8f, -1.8f, -0.9f), glm::vec3(-1.8f, -1.8f, 0.2f) };
+			const glm::vec3 cubeAreaSize[3] = { glm::vec3(3.4f, 0.4f, 0.3f), glm::vec3(3.4f, 3.4f, 0.7f), glm::vec3(3.4f, 0.6f, 0.3f) };
+			for (int area = 0; area < 3; ++area)
+			{
+				for (int i = 0; i < 24; ++i)
+				{
+					glm::vec3 position = cubeAreaMin[area] + cubeAreaSize[area] * glm::vec3(random01(), random01(), random01());
+					MeshInstance cube = { desk * glm::translate(position) * glm::scale(glm::vec3(0.1f)), 2u, false };
+					instances[SCENE_MESH_CUBE_BOX].push_back(cube);
+				}
+			}
+		}
+	}
+	size_t total = 0;
+	for (int mesh = 0; mesh < SCENE_MESH_COUNT; ++mesh)
+	{
+		arena.setInstances(mesh, instances[mesh]);
+		total += instances[mesh].size();
+	}
+
+	cout << "INFO: Occlusion culling benchmark, " << DESKS_PER_SIDE * DESKS_PER_SIDE << " desks, " << total << " instances, "
+		<< frameCount << " frames, " << arena.occlusionBuffer().width() << "x" << arena.occlusionBuffer().height()
+		<< " depth buffer on " << arena.occlusionBuffer().threadCount() << " threads" << endl;
+
+	// the camera walks along the front row looking over the desks, with the render loop's projection;
+	// the desks stand on the xy plane, so z is up
+	glm::mat4 projection = glm::perspective(1.0f, GLfloat(WINDOW_WIDTH / WINDOW_HEIGHT), NEAR_PLANE, FAR_PLANE);
+	glm::vec3 front = glm::normalize(glm::vec3(0.0f, 1.0f, -0.35f));
+	FrameStats frustumStats, occlusionStats;
+	size_t inFrustum = 0, occluded = 0, triangles = 0;
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		float walk = frameCount > 1 ? frame / (float)(frameCount - 1) : 0.5f;
+		glm::vec3 eye((DESKS_PER_SIDE - 1) * DESK_SPACING * walk, -4.0f, 1.5f);
+		glm::mat4 view = glm::lookAt(eye, eye + front, glm::vec3(0.0f, 0.0f, 1.0f));
+
+		arena.cull(projection * view);
+		frustumStats.add(arena.lastCullMs());
+		occlusionStats.add(arena.lastOcclusionMs());
+		inFrustum += arena.visibleCount() + arena.occludedCount();
+		occluded += arena.occludedCount();
+		triangles += arena.occlusionBuffer().triangleCount();
+	}
+
+	frustumStats.report("occlusion_frustum_cull_cpu");
+	occlusionStats.report("occlusion_occlusion_cull_cpu");
+	if (frameCount > 0)
+		cout << "INFO: occlusion per frame: " << inFrustum / frameCount << " instances in the frustum, " << occluded / frameCount
+			<< " behind occluders (" << (inFrustum ? 100.0 * occluded / inFrustum : 0.0) << "%), "
+			<< triangles / frameCount << " occluder triangles rasterized" << endl;
+}
+
+void UBenchmarkLod(int frameCount)
+{
+	// the meshes are never created, so the arena makes no GL calls
+	MeshArena arena;
+	UAddSceneMeshes(arena);
+
+	// one upright cylinder at the origin, the table's candle without the rest of the scene
+	MeshInstance candle = { glm::scale(glm::vec3(0.2f, 0.2f, 0.5f)), 0u, false };
+	arena.setInstances(SCENE_MESH_CYLINDER, vector<MeshInstance>(1, candle));
+
+	const int levelCount = cylinder2.getLodCount();
+	cout << "INFO: Level of detail benchmark, " << frameCount << " frames, levels of";
+	for (int level = 0; level < levelCount; ++level)
+		cout << " " << cylinder2.getLodSectorCount(level);
+	cout << " sectors" << endl;
+
+	// the camera dollies from next to the cylinder out to 40 units and back, with a small
+	// shake at every distance so an instance near a threshold crosses it again and again
+	glm::mat4 projection = glm::perspective(1.0f, GLfloat(WINDOW_WIDTH / WINDOW_HEIGHT), NEAR_PLANE, FAR_PLANE);
+	vector<size_t> framesAtLevel(levelCount, 0);
+	size_t triangles = 0, switches = 0, fullTriangles = 0;
+	int lastLevel = -1;
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		float phase = frameCount > 1 ? frame / (float)(frameCount - 1) : 0.5f;
+		float distance = 0.6f + 39.4f * (1.0f - fabs(2.0f * phase - 1.0f)) + ((frame & 1) ? 0.05f : -0.05f);
+		glm::vec3 eye(0.0f, -distance, 0.5f);
+		glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f, 0.0f, 0.5f), glm::vec3(0.0f, 0.0f, 1.0f));
+
+		arena.cull(projection * view);
+		triangles += arena.triangleCount();
+		fullTriangles += cylinder2.getLodIndexCount(0) / 3;
+		for (int level = 0; level < levelCount; ++level)
 		{
-			cout << "Not implemented to handle image with " << channels << "channels" << endl;
-			return false;
+			if (arena.lodInstanceCount(SCENE_MESH_CYLINDER, level) == 0)
+				continue;
+			framesAtLevel[level]++;
+			if (lastLevel >= 0 && level != lastLevel)
+				switches++;
+			lastLevel = level;
 		}
+	}
 
-		// generating mipmap for GL_TEXTURE_2D
-		glGenerateMipmap(GL_TEXTURE_2D);
+	for (int level = 0; level < levelCount; ++level)
+		cout << "INFO: lod " << cylinder2.getLodSectorCount(level) << " sectors (" << cylinder2.getLodIndexCount(level) / 3
+			<< " triangles): " << framesAtLevel[level] << " frames" << endl;
+	if (frameCount > 0)
+		cout << "INFO: lod per frame: " << triangles / frameCount << " triangles drawn instead of " << fullTriangles / frameCount
+			<< ", " << switches << " level switches over " << frameCount << " frames" << endl;
+}
 
-		// free loaded image
-		stbi_image_free(image);
-		// rebinding GL_TEXTURE_2D to nothing
-		glBindTexture(GL_TEXTURE_2D, 0);
+void UBenchmarkTransforms(int frameCount)
+{
+	// a floor of copies of the scene, each under its own desk node
+	const int DESKS_PER_SIDE = 32;
+	const float DESK_SPACING = 5.0f;
+	const int DESKS = DESKS_PER_SIDE * DESKS_PER_SIDE;
+	TransformHierarchy hierarchy;
+	vector<uint32_t> desks(DESKS);
+	vector<glm::vec3> deskPositions(DESKS);
+	for (int desk = 0; desk < DESKS; ++desk)
+	{
+		deskPositions[desk] = glm::vec3((desk % DESKS_PER_SIDE) * DESK_SPACING, (desk / DESKS_PER_SIDE) * DESK_SPACING, 0.0f);
+		desks[desk] = hierarchy.add(TransformHierarchy::NO_PARENT, glm::translate(deskPositions[desk]));
+		UAddSceneTransforms(hierarchy, desks[desk]);
+	}
+	hierarchy.update();
 
-		return true;
+	cout << "INFO: Transform benchmark, " << DESKS << " copies of the scene, " << hierarchy.size() << " nodes, "
+		<< frameCount << " frames" << endl;
+
+	// every frame one desk in 64 slides a little, carrying everything on it
+	const int MOVING_EVERY = 64;
+	FrameStats partialStats, fullStats;
+	size_t recomputed = 0;
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		glm::vec3 slide(0.1f * sin(frame * 0.1f), 0.0f, 0.0f);
+		for (int desk = frame % MOVING_EVERY; desk < DESKS; desk += MOVING_EVERY)
+			hierarchy.setLocal(desks[desk], glm::translate(deskPositions[desk] + slide));
+		CpuTimer partialTimer;
+		recomputed += hierarchy.update();
+		partialStats.add(partialTimer.elapsedMs());
+
+		// what rebuilding every matrix each frame costs, the way URender used to
+		for (int desk = 0; desk < DESKS; ++desk)
+			hierarchy.setLocal(desks[desk], hierarchy.local(desks[desk]));
+		CpuTimer fullTimer;
+		hierarchy.update();
+		fullStats.add(fullTimer.elapsedMs());
 	}
 
-	return false;
+	// the batched products against glm's scalar operator*, over every parented node
+	vector<const glm::mat4*> left, right;
+	for (uint32_t node = 0; node < hierarchy.size(); ++node)
+	{
+		if (hierarchy.parent(node) == TransformHierarchy::NO_PARENT)
+			continue;
+		left.push_back(&hierarchy.world(hierarchy.parent(node)));
+		right.push_back(&hierarchy.local(node));
+	}
+	vector<glm::mat4> batchResults(left.size()), scalarResults(left.size());
+	vector<glm::mat4*> out(left.size());
+	for (size_t i = 0; i < out.size(); ++i)
+		out[i] = &batchResults[i];
+	FrameStats batchStats, scalarStats;
+	for (int repeat = 0; repeat < 50; ++repeat)
+	{
+		CpuTimer batchTimer;
+		TransformHierarchy::UMultiplyBatch(left.data(), right.data(), out.data(), left.size());
+		batchStats.add(batchTimer.elapsedMs());
+
+		CpuTimer scalarTimer;
+		for (size_t i = 0; i < left.size(); ++i)
+			scalarResults[i] = *left[i] * *right[i];
+		scalarStats.add(scalarTimer.elapsedMs());
+	}
+	float maxDifference = 0.0f;
+	for (size_t i = 0; i < left.size(); ++i)
+		for (int column = 0; column < 4; ++column)
+			maxDifference = glm::max(maxDifference, glm::length(batchResults[i][column] - scalarResults[i][column]));
+
+	partialStats.report("transforms_dirty_update_cpu");
+	fullStats.report("transforms_full_update_cpu");
+	batchStats.report("transforms_batch_multiply_cpu");
+	scalarStats.report("transforms_glm_multiply_cpu");
+	if (frameCount > 0)
+		cout << "INFO: transforms per frame: " << recomputed / frameCount << " of " << hierarchy.size()
+			<< " world matrices recomputed; batched and glm products differ by at most " << maxDifference << endl;
 }
 
 void UDestroyTexture(GLuint textureId)
 {
-	glGenTextures(1, &textureId);
+	glDeleteTextures(1, &textureId);
+}
+
+void UUpdateMaterials()
+{
+	vector<GLuint> uploaded;
+	gTextureLoader.takeUploaded(uploaded);
+	for (GLuint texture : uploaded)
+	{
+		for (GLuint unit = 0; unit < SCENE_TEXTURE_UNITS; ++unit)
+		{
+			if (gTextures[unit] == texture)
+				gMaterials.setTexture(unit, texture);
+		}
+
+		// the array now holds its own copy, keeping the source would store the texture twice
+		if (!gMaterials.bindless())
+		{
+			for (GLuint unit = 0; unit < SCENE_TEXTURE_UNITS; ++unit)
+			{
+				if (gTextures[unit] == texture)
+					gTextures[unit] = 0;
+			}
+			UDestroyTexture(texture);
+		}
+	}
 }
\ No newline at end of file
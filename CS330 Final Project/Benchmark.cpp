@@ -0,0 +1,53 @@
+/*
+	Benchmark.cpp
+	Percentile reporting for FrameStats.
+*/
+
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+double FrameStats::mean() const
+{
+	if (samples.empty())
+		return 0.0;
+
+	double total = 0.0;
+	for (double s : samples)
+		total += s;
+	return total / samples.size();
+}
+
+double FrameStats::percentile(double p) const
+{
+	if (samples.empty())
+		return 0.0;
+
+	std::vector<double> sorted(samples);
+	std::sort(sorted.begin(), sorted.end());
+
+	// nearest-rank: smallest sample with at least p% of samples at or below it
+	std::size_t rank = (std::size_t)std::ceil(p / 100.0 * sorted.size());
+	if (rank > 0)
+		--rank;
+	if (rank >= sorted.size())
+		rank = sorted.size() - 1;
+	return sorted[rank];
+}
+
+void FrameStats::report(const char* label) const
+{
+	std::cout << std::fixed << std::setprecision(3)
+		<< "BENCH " << label
+		<< " n=" << samples.size()
+		<< " mean=" << mean()
+		<< " p50=" << percentile(50.0)
+		<< " p90=" << percentile(90.0)
+		<< " p99=" << percentile(99.0)
+		<< " max=" << percentile(100.0)
+		<< " (ms)" << std::endl;
+	std::cout.unsetf(std::ios_base::floatfield);
+}
@@ -0,0 +1,51 @@
+/*
+	Benchmark.h
+	Frame timing helpers for the headless benchmark modes. Samples are stored in
+	milliseconds and summarized as percentiles so CI runs can be compared over time.
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+// Wall clock stopwatch used for CPU-side measurements
+class CpuTimer
+{
+public:
+	CpuTimer() : start(std::chrono::steady_clock::now()) {}
+
+	void reset() { start = std::chrono::steady_clock::now(); }
+
+	// elapsed time since construction or last reset, in milliseconds
+	double elapsedMs() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+// Collection of per-frame samples (milliseconds)
+class FrameStats
+{
+public:
+	void add(double ms) { samples.push_back(ms); }
+	void clear() { samples.clear(); }
+	std::size_t count() const { return samples.size(); }
+
+	double mean() const;
+	// p in [0, 100], nearest-rank on a sorted copy of the samples
+	double percentile(double p) const;
+
+	// Prints a single greppable line: BENCH <label> n=.. mean=.. p50=.. p90=.. p99=.. max=..
+	void report(const char* label) const;
+
+private:
+	std::vector<double> samples;
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,348 @@
+/*
+	Bvh.cpp
+	Binned SAH build, refit and the frustum, sphere and ray queries.
+*/
+
+#include "Bvh.h"
+
+#include <algorithm>
+
+namespace
+{
+	// cost of visiting a node, relative to testing one box
+	const float TRAVERSAL_COST = 1.0f;
+
+	float USurfaceArea(const Aabb& box)
+	{
+		glm::vec3 size = box.boundsMax - box.boundsMin;
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	void UGrow(Aabb& box, const Aabb& other)
+	{
+		box.boundsMin = glm::min(box.boundsMin, other.boundsMin);
+		box.boundsMax = glm::max(box.boundsMax, other.boundsMax);
+	}
+}
+
+const float Bvh::REBUILD_COST_RATIO = 2.0f;
+
+Bvh::Bvh()
+	: builtCost(0.0f), buildCount(0), refitCount(0)
+{
+}
+
+void Bvh::build(const std::vector<Aabb>& boxes)
+{
+	nodes.clear();
+	orderedBounds.clear();
+	primitives.resize(boxes.size());
+	for (std::size_t i = 0; i < boxes.size(); ++i)
+		primitives[i] = (uint32_t)i;
+	buildCount++;
+
+	if (boxes.empty())
+	{
+		builtCost = 0.0f;
+		return;
+	}
+
+	std::vector<glm::vec3> centroids(boxes.size());
+	for (std::size_t i = 0; i < boxes.size(); ++i)
+		centroids[i] = (boxes[i].boundsMin + boxes[i].boundsMax) * 0.5f;
+
+	// a binary tree over n leaves has fewer than 2n nodes
+	nodes.reserve(boxes.size() * 2);
+	Node root = { boxes[0], 0, (uint32_t)boxes.size(), 0 };
+	nodes.push_back(root);
+	buildNode(0, 0, boxes, centroids);
+
+	orderedBounds.reserve(boxes.size());
+	for (uint32_t primitive : primitives)
+		orderedBounds.add(boxes[primitive]);
+
+	builtCost = sahCost();
+}
+
+void Bvh::buildNode(uint32_t index, int depth, const std::vector<Aabb>& boxes, std::vector<glm::vec3>& centroids)
+{
+	// nodes may reallocate below, so work on copies of the range
+	const uint32_t first = nodes[index].first, count = nodes[index].count;
+
+	Aabb bounds = boxes[primitives[first]];
+	Aabb centroidBounds = { centroids[primitives[first]], centroids[primitives[first]] };
+	for (uint32_t i = first + 1; i < first + count; ++i)
+	{
+		UGrow(bounds, boxes[primitives[i]]);
+		centroidBounds.boundsMin = glm::min(centroidBounds.boundsMin, centroids[primitives[i]]);
+		centroidBounds.boundsMax = glm::max(centroidBounds.boundsMax, centroids[primitives[i]]);
+	}
+	nodes[index].bounds = bounds;
+	nodes[index].left = 0;
+
+	if (count <= 1 || depth >= MAX_DEPTH)
+		return;
+
+	// cheapest split between centroid bins over all three axes
+	int bestAxis = -1, bestSplit = 0;
+	float bestCost = 0.0f;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = centroidBounds.boundsMax[axis] - centroidBounds.boundsMin[axis];
+		if (!(extent > 0.0f))
+			continue;
+		float binScale = BIN_COUNT / extent;
+
+		uint32_t binCounts[BIN_COUNT] = {};
+		Aabb binBounds[BIN_COUNT];
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			int bin = std::min(BIN_COUNT - 1, (int)((centroids[primitives[i]][axis] - centroidBounds.boundsMin[axis]) * binScale));
+			if (binCounts[bin]++ == 0)
+				binBounds[bin] = boxes[primitives[i]];
+			else
+				UGrow(binBounds[bin], boxes[primitives[i]]);
+		}
+
+		// area and count left of each split from a forward sweep, right of it from a backward one
+		float leftArea[BIN_COUNT], rightArea[BIN_COUNT];
+		uint32_t leftCount[BIN_COUNT], rightCount[BIN_COUNT];
+		Aabb sweep = {};
+		uint32_t sweepCount = 0;
+		for (int bin = 0; bin < BIN_COUNT - 1; ++bin)
+		{
+			if (binCounts[bin])
+			{
+				if (sweepCount == 0)
+					sweep = binBounds[bin];
+				else
+					UGrow(sweep, binBounds[bin]);
+				sweepCount += binCounts[bin];
+			}
+			leftCount[bin + 1] = sweepCount;
+			leftArea[bin + 1] = sweepCount ? USurfaceArea(sweep) : 0.0f;
+		}
+		sweepCount = 0;
+		for (int bin = BIN_COUNT - 1; bin > 0; --bin)
+		{
+			if (binCounts[bin])
+			{
+				if (sweepCount == 0)
+					sweep = binBounds[bin];
+				else
+					UGrow(sweep, binBounds[bin]);
+				sweepCount += binCounts[bin];
+			}
+			rightCount[bin] = sweepCount;
+			rightArea[bin] = sweepCount ? USurfaceArea(sweep) : 0.0f;
+		}
+
+		for (int split = 1; split < BIN_COUNT; ++split)
+		{
+			if (leftCount[split] == 0 || rightCount[split] == 0)
+				continue;
+			float cost = leftArea[split] * leftCount[split] + rightArea[split] * rightCount[split];
+			if (bestAxis < 0 || cost < bestCost)
+			{
+				bestAxis = axis;
+				bestSplit = split;
+				bestCost = cost;
+			}
+		}
+	}
+
+	// every centroid in one place, nothing to split
+	if (bestAxis < 0)
+		return;
+
+	float area = USurfaceArea(bounds);
+	float leafCost = area * count;
+	float splitCost = TRAVERSAL_COST * area + bestCost;
+	if (splitCost >= leafCost && count <= MAX_LEAF_SIZE)
+		return;
+
+	float binScale = BIN_COUNT / (centroidBounds.boundsMax[bestAxis] - centroidBounds.boundsMin[bestAxis]);
+	float axisMin = centroidBounds.boundsMin[bestAxis];
+	uint32_t* middle = std::partition(primitives.data() + first, primitives.data() + first + count,
+		[&](uint32_t primitive) {
+			int bin = std::min(BIN_COUNT - 1, (int)((centroids[primitive][bestAxis] - axisMin) * binScale));
+			return bin < bestSplit;
+		});
+	uint32_t leftCountTotal = (uint32_t)(middle - (primitives.data() + first));
+
+	uint32_t left = (uint32_t)nodes.size();
+	nodes[index].left = left;
+	Node leftNode = { bounds, first, leftCountTotal, 0 };
+	Node rightNode = { bounds, first + leftCountTotal, count - leftCountTotal, 0 };
+	nodes.push_back(leftNode);
+	nodes.push_back(rightNode);
+
+	buildNode(left, depth + 1, boxes, centroids);
+	buildNode(left + 1, depth + 1, boxes, centroids);
+}
+
+void Bvh::refit(const std::vector<Aabb>& boxes)
+{
+	if (boxes.size() != primitives.size() || nodes.empty())
+	{
+		build(boxes);
+		return;
+	}
+
+	orderedBounds.clear();
+	for (uint32_t primitive : primitives)
+		orderedBounds.add(boxes[primitive]);
+	refitNodes();
+	refitCount++;
+
+	if (sahCost() > builtCost * REBUILD_COST_RATIO)
+		build(boxes);
+}
+
+void Bvh::refitNodes()
+{
+	// children always come after their parent, so a reverse walk sees them first
+	for (std::size_t i = nodes.size(); i-- > 0;)
+	{
+		Node& node = nodes[i];
+		if (node.left == 0)
+		{
+			node.bounds = orderedBounds.box(node.first);
+			for (uint32_t primitive = node.first + 1; primitive < node.first + node.count; ++primitive)
+				UGrow(node.bounds, orderedBounds.box(primitive));
+		}
+		else
+		{
+			node.bounds = nodes[node.left].bounds;
+			UGrow(node.bounds, nodes[node.left + 1].bounds);
+		}
+	}
+}
+
+float Bvh::sahCost() const
+{
+	if (nodes.empty())
+		return 0.0f;
+
+	float cost = 0.0f;
+	for (const Node& node : nodes)
+		cost += USurfaceArea(node.bounds) * (node.left ? TRAVERSAL_COST : (float)node.count);
+
+	float rootArea = USurfaceArea(nodes[0].bounds);
+	return rootArea > 0.0f ? cost / rootArea : cost;
+}
+
+void Bvh::cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const
+{
+	if (nodes.empty())
+		return;
+
+	// planes a node is known to be entirely inside are dropped for its children
+	const uint32_t ALL_PLANES = (1u << 6) - 1;
+	uint32_t stack[MAX_DEPTH + 2], planeStack[MAX_DEPTH + 2];
+	int top = 0;
+	stack[top] = 0;
+	planeStack[top++] = ALL_PLANES;
+
+	while (top > 0)
+	{
+		--top;
+		const Node& node = nodes[stack[top]];
+		uint32_t planes = planeStack[top];
+
+		glm::vec3 center = (node.bounds.boundsMin + node.bounds.boundsMax) * 0.5f;
+		glm::vec3 extent = (node.bounds.boundsMax - node.bounds.boundsMin) * 0.5f;
+		bool outside = false;
+		for (int plane = 0; plane < 6 && !outside; ++plane)
+		{
+			if (!(planes & (1u << plane)))
+				continue;
+			const glm::vec4& p = frustum.planes[plane];
+			float distance = glm::dot(glm::vec3(p), center) + p.w;
+			float radius = glm::dot(glm::abs(glm::vec3(p)), extent);
+			if (distance + radius < 0.0f)
+				outside = true;
+			else if (distance - radius >= 0.0f)
+				planes &= ~(1u << plane);
+		}
+		if (outside)
+			continue;
+
+		if (planes == 0)
+		{
+			visible.insert(visible.end(), primitives.begin() + node.first, primitives.begin() + node.first + node.count);
+		}
+		else if (node.left == 0)
+		{
+			std::size_t firstVisible = visible.size();
+			UCullBounds(frustum, orderedBounds, node.first, node.count, visible);
+			for (std::size_t i = firstVisible; i < visible.size(); ++i)
+				visible[i] = primitives[visible[i]];
+		}
+		else
+		{
+			stack[top] = node.left;
+			planeStack[top++] = planes;
+			stack[top] = node.left + 1;
+			planeStack[top++] = planes;
+		}
+	}
+}
+
+void Bvh::overlapSphere(const glm::vec3& center, float radius, std::vector<uint32_t>& result) const
+{
+	if (nodes.empty())
+		return;
+
+	auto overlaps = [&](const Aabb& box) {
+		glm::vec3 offset = glm::clamp(center, box.boundsMin, box.boundsMax) - center;
+		return glm::dot(offset, offset) <= radius * radius;
+	};
+
+	uint32_t stack[MAX_DEPTH + 2];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (!overlaps(node.bounds))
+			continue;
+
+		if (node.left == 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				if (overlaps(orderedBounds.box(i)))
+					result.push_back(primitives[i]);
+			}
+		}
+		else
+		{
+			stack[top++] = node.left;
+			stack[top++] = node.left + 1;
+		}
+	}
+}
+
+bool Bvh::raycastBoxes(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, uint32_t& hit) const
+{
+	return raycast(origin, direction, maxDistance, hit, [](uint32_t, float entry, float& distance) {
+		distance = entry;
+		return true;
+	});
+}
+
+bool Bvh::URayBox(const glm::vec3& origin, const glm::vec3& inverseDirection, const Aabb& box, float maxDistance, float& entry)
+{
+	glm::vec3 t1 = (box.boundsMin - origin) * inverseDirection;
+	glm::vec3 t2 = (box.boundsMax - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t1, t2), tFar = glm::max(t1, t2);
+
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	if (enter > exit || enter > maxDistance)
+		return false;
+
+	entry = enter;
+	return true;
+}
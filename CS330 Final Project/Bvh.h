@@ -0,0 +1,139 @@
+/*
+	Bvh.h
+	Bounding volume hierarchy over a list of axis-aligned boxes (scene instances), so frustum
+	culling, ray picks and proximity queries visit O(log n) nodes instead of every box.
+
+	build() splits nodes with the surface area heuristic, evaluated over a fixed number of
+	centroid bins per axis. Each node covers a contiguous range of the reordered primitives,
+	so a node entirely inside the frustum accepts its whole range without visiting children,
+	and leaves are tested with the SIMD box tests of FrustumCull.h. Queries return the
+	caller's box indices, not the reordered ones.
+
+	refit() keeps the tree shape and recomputes node bounds bottom up for boxes that moved.
+	Refitting degrades the tree as things move apart, so once its SAH cost has grown to
+	REBUILD_COST_RATIO times the cost of the last build it rebuilds instead.
+*/
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "FrustumCull.h"
+
+class Bvh
+{
+public:
+	Bvh();
+
+	void build(const std::vector<Aabb>& boxes);
+	// Same boxes as the last build(), in the same order, possibly moved
+	void refit(const std::vector<Aabb>& boxes);
+
+	std::size_t size() const { return primitives.size(); }
+	std::size_t nodeCount() const { return nodes.size(); }
+	std::size_t rebuilds() const { return buildCount; }
+	std::size_t refits() const { return refitCount; }
+
+	// Appends the index of every box at least partly inside the frustum
+	void cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+	// Appends the index of every box that overlaps the sphere
+	void overlapSphere(const glm::vec3& center, float radius, std::vector<uint32_t>& result) const;
+
+	// Visits the boxes the ray enters, nearest node first. test(index, entry, maxDistance) is
+	// given the box's entry distance, returns true on a hit and shortens maxDistance to it;
+	// the index of the nearest hit is returned in hit.
+	template <typename HitTest>
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, uint32_t& hit, HitTest test) const;
+	// Nearest box the ray enters, with maxDistance set to the entry distance
+	bool raycastBoxes(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, uint32_t& hit) const;
+
+	// Entry distance of the ray into the box, false if it misses or enters beyond maxDistance
+	static bool URayBox(const glm::vec3& origin, const glm::vec3& inverseDirection, const Aabb& box, float maxDistance,
+		float& entry);
+
+private:
+	// Nodes cover primitives [first, first + count); interior nodes have children left and left + 1
+	struct Node
+	{
+		Aabb bounds;
+		uint32_t first, count;
+		uint32_t left;			// 0 for leaves, the root is never a child
+	};
+
+	static const int BIN_COUNT = 12;
+	static const uint32_t MAX_LEAF_SIZE = 8;
+	static const int MAX_DEPTH = 48;
+	static const float REBUILD_COST_RATIO;
+
+	void buildNode(uint32_t node, int depth, const std::vector<Aabb>& boxes, std::vector<glm::vec3>& centroids);
+	void refitNodes();
+	float sahCost() const;
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> primitives;	// caller's index of each reordered box
+	BoundsList orderedBounds;			// boxes in node order, for the SIMD leaf tests
+	float builtCost;
+	std::size_t buildCount, refitCount;
+};
+
+template <typename HitTest>
+bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, uint32_t& hit, HitTest test) const
+{
+	if (nodes.empty())
+		return false;
+
+	glm::vec3 inverseDirection = 1.0f / direction;
+	bool found = false;
+	float entry;
+	if (!URayBox(origin, inverseDirection, nodes[0].bounds, maxDistance, entry))
+		return false;
+
+	uint32_t stack[MAX_DEPTH + 2];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		// the ray may have been shortened since this node was pushed
+		if (!URayBox(origin, inverseDirection, node.bounds, maxDistance, entry))
+			continue;
+
+		if (node.left == 0)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				if (URayBox(origin, inverseDirection, orderedBounds.box(i), maxDistance, entry) &&
+					test(primitives[i], entry, maxDistance))
+				{
+					hit = primitives[i];
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// the nearer child is pushed last so it is searched first
+		float leftEntry, rightEntry;
+		bool hitLeft = URayBox(origin, inverseDirection, nodes[node.left].bounds, maxDistance, leftEntry);
+		bool hitRight = URayBox(origin, inverseDirection, nodes[node.left + 1].bounds, maxDistance, rightEntry);
+		if (hitLeft && hitRight && rightEntry < leftEntry)
+		{
+			stack[top++] = node.left;
+			stack[top++] = node.left + 1;
+		}
+		else
+		{
+			if (hitRight)
+				stack[top++] = node.left + 1;
+			if (hitLeft)
+				stack[top++] = node.left;
+		}
+	}
+	return found;
+}
+
+#endif // BVH_H
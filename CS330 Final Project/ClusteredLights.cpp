@@ -0,0 +1,219 @@
+/*
+	ClusteredLights.cpp
+	CPU light-to-cluster assignment and shader storage uploads.
+*/
+
+#include "ClusteredLights.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Benchmark.h"
+
+float UPointLightRange(const PointLight& light)
+{
+	const float threshold = 5.0f / 256.0f;
+	float intensity = std::max(light.diffuse.r, std::max(light.diffuse.g, light.diffuse.b));
+	float c = light.attenuation.x, l = light.attenuation.y, q = light.attenuation.z;
+
+	// solve c + l*d + q*d^2 = intensity / threshold for d
+	float target = intensity / threshold;
+	if (target <= c)
+		return 0.0f;
+	if (q <= 0.0f)
+		return l > 0.0f ? (target - c) / l : 1.0e30f;
+	return (-l + std::sqrt(l * l - 4.0f * q * (c - target))) / (2.0f * q);
+}
+
+ClusterLightGrid::ClusterLightGrid()
+	: lightSsbo(0), gridSsbo(0), indexSsbo(0), lightCapacity(0), indexCapacity(0),
+	  cachedProjection(0.0f), nearPlane(0.1f), farPlane(100.0f), width(0), height(0), params(0.0f), assignMs(0.0)
+{
+}
+
+void ClusterLightGrid::create()
+{
+	glGenBuffers(1, &lightSsbo);
+	glGenBuffers(1, &gridSsbo);
+	glGenBuffers(1, &indexSsbo);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridSsbo);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec2) * CLUSTER_COUNT, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// binding points are context state, set once
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, lightSsbo);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, gridSsbo);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDEX_BINDING, indexSsbo);
+
+	grid.assign(CLUSTER_COUNT, glm::uvec2(0));
+	counts.assign(CLUSTER_COUNT, 0);
+}
+
+void ClusterLightGrid::destroy()
+{
+	glDeleteBuffers(1, &lightSsbo);
+	glDeleteBuffers(1, &gridSsbo);
+	glDeleteBuffers(1, &indexSsbo);
+	lightSsbo = gridSsbo = indexSsbo = 0;
+	lightCapacity = indexCapacity = 0;
+}
+
+void ClusterLightGrid::setProjection(const glm::mat4& projection, float zNear, float zFar, int viewportWidth, int viewportHeight)
+{
+	if (projection == cachedProjection && viewportWidth == width && viewportHeight == height)
+		return;
+
+	cachedProjection = projection;
+	nearPlane = zNear;
+	farPlane = zFar;
+	width = viewportWidth;
+	height = viewportHeight;
+
+	// slice = log(depth) * scale + bias maps [near, far] exponentially onto [0, CLUSTER_Z]
+	float logRatio = std::log(farPlane / nearPlane);
+	params.x = CLUSTER_Z / logRatio;
+	params.y = -CLUSTER_Z * std::log(nearPlane) / logRatio;
+	params.z = (float)width / CLUSTER_X;
+	params.w = (float)height / CLUSTER_Y;
+
+	clusterMin.resize(CLUSTER_COUNT);
+	clusterMax.resize(CLUSTER_COUNT);
+
+	// Works for perspective and orthographic projections: each tile corner is unprojected to a
+	// view-space line, which is cut by the slice's near/far depth planes.
+	glm::mat4 inverseProjection = glm::inverse(projection);
+	for (int y = 0; y < CLUSTER_Y; ++y)
+	{
+		for (int x = 0; x < CLUSTER_X; ++x)
+		{
+			glm::vec3 lineStart[4], lineDir[4];
+			for (int corner = 0; corner < 4; ++corner)
+			{
+				float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / CLUSTER_X;
+				float ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / CLUSTER_Y;
+				glm::vec4 p0 = inverseProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+				glm::vec4 p1 = inverseProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+				lineStart[corner] = glm::vec3(p0) / p0.w;
+				lineDir[corner] = glm::vec3(p1) / p1.w - lineStart[corner];
+			}
+
+			for (int z = 0; z < CLUSTER_Z; ++z)
+			{
+				float sliceNear = nearPlane * std::pow(farPlane / nearPlane, (float)z / CLUSTER_Z);
+				float sliceFar = nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / CLUSTER_Z);
+
+				glm::vec3 minPoint(1.0e30f), maxPoint(-1.0e30f);
+				for (int corner = 0; corner < 4; ++corner)
+				{
+					for (float depth : { sliceNear, sliceFar })
+					{
+						// view space looks down -z
+						float t = (-depth - lineStart[corner].z) / lineDir[corner].z;
+						glm::vec3 p = lineStart[corner] + t * lineDir[corner];
+						minPoint = glm::min(minPoint, p);
+						maxPoint = glm::max(maxPoint, p);
+					}
+				}
+
+				int index = x + CLUSTER_X * (y + CLUSTER_Y * z);
+				clusterMin[index] = minPoint;
+				clusterMax[index] = maxPoint;
+			}
+		}
+	}
+}
+
+int ClusterLightGrid::sliceOfDepth(float depth) const
+{
+	if (depth <= nearPlane)
+		return 0;
+	int slice = (int)(std::log(depth) * params.x + params.y);
+	return std::min(std::max(slice, 0), CLUSTER_Z - 1);
+}
+
+void ClusterLightGrid::assign(const std::vector<PointLight>& lights, const glm::mat4& view)
+{
+	std::fill(counts.begin(), counts.end(), 0);
+	pairs.clear();
+
+	for (std::size_t i = 0; i < lights.size(); ++i)
+	{
+		float range = lights[i].attenuation.w;
+		glm::vec3 center = glm::vec3(view * glm::vec4(glm::vec3(lights[i].position), 1.0f));
+
+		// entirely behind the camera or past the far plane
+		float depth = -center.z;
+		if (depth + range < nearPlane || depth - range > farPlane)
+			continue;
+
+		int firstSlice = sliceOfDepth(depth - range);
+		int lastSlice = sliceOfDepth(depth + range);
+
+		for (int z = firstSlice; z <= lastSlice; ++z)
+		{
+			for (int tile = 0; tile < CLUSTER_X * CLUSTER_Y; ++tile)
+			{
+				int index = tile + CLUSTER_X * CLUSTER_Y * z;
+
+				// sphere vs AABB: squared distance from the center to the closest point of the box
+				glm::vec3 closest = glm::clamp(center, clusterMin[index], clusterMax[index]);
+				glm::vec3 delta = closest - center;
+				if (glm::dot(delta, delta) > range * range)
+					continue;
+
+				pairs.push_back(glm::uvec2((GLuint)index, (GLuint)i));
+				++counts[index];
+			}
+		}
+	}
+
+	// counting sort of the (cluster, light) pairs into one flat index list
+	GLuint offset = 0;
+	for (int c = 0; c < CLUSTER_COUNT; ++c)
+	{
+		grid[c] = glm::uvec2(offset, 0);
+		offset += counts[c];
+	}
+
+	indices.resize(pairs.size());
+	for (const glm::uvec2& pair : pairs)
+	{
+		glm::uvec2& cell = grid[pair.x];
+		indices[cell.x + cell.y] = pair.y;
+		++cell.y;
+	}
+}
+
+void ClusterLightGrid::update(const std::vector<PointLight>& lights, const glm::mat4& view)
+{
+	CpuTimer timer;
+	assign(lights, view);
+	assignMs = timer.elapsedMs();
+
+	// lights, grown geometrically so steady frames never reallocate
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightSsbo);
+	if (lights.size() > lightCapacity || lightCapacity == 0)
+	{
+		lightCapacity = std::max<std::size_t>(lights.size() * 2, 16);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PointLight) * lightCapacity, NULL, GL_DYNAMIC_DRAW);
+	}
+	if (!lights.empty())
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(PointLight) * lights.size(), lights.data());
+
+	// grid is fixed size
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridSsbo);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::uvec2) * grid.size(), grid.data());
+
+	// index list
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexSsbo);
+	if (indices.size() > indexCapacity || indexCapacity == 0)
+	{
+		indexCapacity = std::max<std::size_t>(indices.size() * 2, 1024);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * indexCapacity, NULL, GL_DYNAMIC_DRAW);
+	}
+	if (!indices.empty())
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * indices.size(), indices.data());
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
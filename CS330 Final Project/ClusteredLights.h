@@ -0,0 +1,75 @@
+/*
+	ClusteredLights.h
+	Clustered forward shading support. The view frustum is split into a grid of
+	CLUSTER_X x CLUSTER_Y screen tiles and CLUSTER_Z exponential depth slices. Every frame
+	the CPU assigns each point light to the clusters its range sphere touches, and the
+	fragment shader only loops over the lights listed for its own cluster.
+
+	GPU data (std430 shader storage buffers):
+		LIGHT_BUFFER_BINDING		PointLight lights[]
+		CLUSTER_GRID_BINDING		uvec2 clusterGrid[]		(offset, count) into clusterLightIndices
+		CLUSTER_INDEX_BINDING		uint clusterLightIndices[]
+*/
+
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "ShaderBlocks.h"
+
+const int CLUSTER_X = 16;
+const int CLUSTER_Y = 9;
+const int CLUSTER_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+// Distance at which a light's attenuated intensity drops below 5/256, used as its cluster range
+float UPointLightRange(const PointLight& light);
+
+class ClusterLightGrid
+{
+public:
+	ClusterLightGrid();
+
+	void create();
+	void destroy();
+
+	// Rebuilds the view-space cluster bounds, needed whenever the projection or viewport changes
+	void setProjection(const glm::mat4& projection, float zNear, float zFar, int viewportWidth, int viewportHeight);
+
+	// Assigns lights to clusters on the CPU and uploads lights, grid and index list
+	void update(const std::vector<PointLight>& lights, const glm::mat4& view);
+
+	// Cluster lookup constants for FrameBlock
+	glm::vec4 sliceParams() const { return params; }
+
+	double lastAssignMs() const { return assignMs; }
+	std::size_t lastIndexCount() const { return indices.size(); }
+
+private:
+	void assign(const std::vector<PointLight>& lights, const glm::mat4& view);
+	int sliceOfDepth(float depth) const;
+
+	GLuint lightSsbo, gridSsbo, indexSsbo;
+	std::size_t lightCapacity, indexCapacity;
+
+	glm::mat4 cachedProjection;
+	float nearPlane, farPlane;
+	int width, height;
+	glm::vec4 params;					// x = slice scale, y = slice bias, z/w = tile size in pixels
+
+	std::vector<glm::vec3> clusterMin;	// view-space bounds per cluster
+	std::vector<glm::vec3> clusterMax;
+
+	std::vector<glm::uvec2> grid;		// offset, count per cluster
+	std::vector<GLuint> indices;
+	std::vector<GLuint> counts;
+	std::vector<glm::uvec2> pairs;		// (cluster, light) produced by the assignment pass
+
+	double assignMs;
+};
+
+#endif // CLUSTERED_LIGHTS_H
@@ -73,6 +73,9 @@ void Cylinder::set(float baseRadius, float topRadius, float height, int sectors,
         buildVerticesSmooth();
     else
         buildVerticesFlat();
+
+    if(!lodSectorCounts.empty())
+        buildLods();
 }
 
 void Cylinder::setBaseRadius(float radius)
@@ -115,6 +118,15 @@ void Cylinder::setSmooth(bool smooth)
         buildVerticesSmooth();
     else
         buildVerticesFlat();
+
+    if(!lodSectorCounts.empty())
+        buildLods();
+}
+
+void Cylinder::setLodSectorCounts(const int* sectorCounts, int levelCount)
+{
+    lodSectorCounts.assign(sectorCounts, sectorCounts + levelCount);
+    buildLods();
 }
 
 
@@ -621,6 +633,30 @@ void Cylinder::buildUnitCircleVertices()
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+// build every level of the LOD chain as a cylinder of the same size and
+// concatenate their interleaved vertices and indices
+///////////////////////////////////////////////////////////////////////////////
+void Cylinder::buildLods()
+{
+    std::vector<float>().swap(lodVertices);
+    std::vector<unsigned int>().swap(lodIndices);
+    lodVertexStarts.assign(1, 0);
+    lodIndexStarts.assign(1, 0);
+
+    for(std::size_t i = 0; i < lodSectorCounts.size(); ++i)
+    {
+        Cylinder level(baseRadius, topRadius, height, lodSectorCounts[i], stackCount, smooth);
+        lodSectorCounts[i] = level.getSectorCount();
+        lodVertices.insert(lodVertices.end(), level.interleavedVertices.begin(), level.interleavedVertices.end());
+        lodIndices.insert(lodIndices.end(), level.indices.begin(), level.indices.end());
+        lodVertexStarts.push_back((unsigned int)(lodVertices.size() / 8));
+        lodIndexStarts.push_back((unsigned int)lodIndices.size());
+    }
+}
+
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // add single vertex to array
 ///////////////////////////////////////////////////////////////////////////////
@@ -74,6 +74,20 @@ public:
     unsigned int getTopStartIndex() const   { return topIndex; }
     unsigned int getSideStartIndex() const  { return 0; }   // side starts from the begining
 
+    // level of detail chain: the same cylinder rebuilt with each of the given sector
+    // counts, finest first, with every level's interleaved vertices and indices
+    // concatenated so they can share one buffer. Indices are relative to the first
+    // vertex of their level. set() and setSmooth() rebuild the chain.
+    void setLodSectorCounts(const int* sectorCounts, int levelCount);
+    int getLodCount() const                                 { return (int)lodSectorCounts.size(); }
+    int getLodSectorCount(int level) const                  { return lodSectorCounts[level]; }
+    const float* getLodInterleavedVertices() const          { return lodVertices.data(); }
+    const unsigned int* getLodIndices() const               { return lodIndices.data(); }
+    unsigned int getLodVertexStart(int level) const         { return lodVertexStarts[level]; }
+    unsigned int getLodVertexCount(int level) const         { return lodVertexStarts[level + 1] - lodVertexStarts[level]; }
+    unsigned int getLodIndexStart(int level) const          { return lodIndexStarts[level]; }
+    unsigned int getLodIndexCount(int level) const          { return lodIndexStarts[level + 1] - lodIndexStarts[level]; }
+
     // draw in VertexArray mode
     void draw() const;          // draw all
     void drawBase() const;      // draw base cap only
@@ -94,6 +108,7 @@ private:
     void buildVerticesFlat();
     void buildInterleavedVertices();
     void buildUnitCircleVertices();
+    void buildLods();
     void addVertex(float x, float y, float z);
     void addNormal(float x, float y, float z);
     void addTexCoord(float s, float t);
@@ -123,6 +138,13 @@ private:
     std::vector<float> interleavedVertices;
     int interleavedStride;                  // # of bytes to hop to the next vertex (should be 32 bytes)
 
+    // level of detail chain, starts have one extra entry for the end of the last level
+    std::vector<int> lodSectorCounts;
+    std::vector<float> lodVertices;
+    std::vector<unsigned int> lodIndices;
+    std::vector<unsigned int> lodVertexStarts;
+    std::vector<unsigned int> lodIndexStarts;
+
 };
 
 #endif
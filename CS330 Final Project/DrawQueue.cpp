@@ -0,0 +1,110 @@
+/*
+	DrawQueue.cpp
+	Sort key packing, radix sort and state-filtered submission.
+*/
+
+#include "DrawQueue.h"
+
+#include <cstring>
+
+uint64_t UDrawSortKey(uint32_t programIndex, uint32_t vaoIndex, uint32_t material, float depth)
+{
+	// anything behind the camera sorts as nearest; -0.0 and NaN fail the test as well
+	if (!(depth > 0.0f))
+		depth = 0.0f;
+	uint32_t depthBits;
+	memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	return ((uint64_t)(programIndex & 0xffu) << 56) | ((uint64_t)(vaoIndex & 0xfffu) << 44) |
+		((uint64_t)(material & 0xfffu) << 32) | depthBits;
+}
+
+DrawQueue::DrawQueue()
+{
+	lastStats.draws = lastStats.programBinds = lastStats.vaoBinds = 0;
+}
+
+void DrawQueue::clear()
+{
+	keys.clear();
+	order.clear();
+	commands.clear();
+}
+
+void DrawQueue::push(uint64_t key, const DrawCommand& command)
+{
+	order.push_back((uint32_t)commands.size());
+	keys.push_back(key);
+	commands.push_back(command);
+}
+
+void DrawQueue::sort()
+{
+	std::size_t count = keys.size();
+	scratchKeys.resize(count);
+	scratchOrder.resize(count);
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		std::size_t histogram[256] = {};
+		for (uint64_t key : keys)
+			histogram[(key >> shift) & 0xff]++;
+
+		// every key has the same byte here, this pass would not move anything
+		if (count == 0 || histogram[(keys[0] >> shift) & 0xff] == count)
+			continue;
+
+		std::size_t offset = 0;
+		for (std::size_t& bucket : histogram)
+		{
+			std::size_t bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			std::size_t to = histogram[(keys[i] >> shift) & 0xff]++;
+			scratchKeys[to] = keys[i];
+			scratchOrder[to] = order[i];
+		}
+		keys.swap(scratchKeys);
+		order.swap(scratchOrder);
+	}
+}
+
+void DrawQueue::submit()
+{
+	DrawQueueStats stats = { keys.size(), 0, 0 };
+
+	// no GL object has this name, so the first draw binds everything
+	const GLuint UNBOUND = ~0u;
+	GLuint program = UNBOUND, vao = UNBOUND, indirectBuffer = UNBOUND;
+
+	for (uint32_t index : order)
+	{
+		const DrawCommand& command = commands[index];
+		if (command.program != program)
+		{
+			program = command.program;
+			glUseProgram(program);
+			stats.programBinds++;
+		}
+		if (command.vao != vao)
+		{
+			vao = command.vao;
+			glBindVertexArray(vao);
+			stats.vaoBinds++;
+		}
+		if (command.indirectBuffer != indirectBuffer)
+		{
+			indirectBuffer = command.indirectBuffer;
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		}
+
+		glMultiDrawElementsIndirect(GL_TRIANGLES, command.indexType, (void*)command.indirectOffset, command.drawCount, 0);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	lastStats = stats;
+}
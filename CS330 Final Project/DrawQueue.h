@@ -0,0 +1,79 @@
+/*
+	DrawQueue.h
+	Per-frame list of indirect multi-draws, each tagged with a 64-bit sort key. The queue is
+	radix sorted before submission so draws sharing a program and VAO run back to back (and,
+	within those, nearest first for early-Z), and only binds that actually change state are issued.
+	Textures are not part of a draw's state; MaterialLibrary makes them all reachable at once.
+
+	MeshArena queues one multi-draw per pipeline under a single VAO, with materials varying
+	per instance inside it, so its keys only carry the program and the pipeline's nearest
+	depth; the front-to-back order within each multi-draw comes from the arena's
+	depth-sorted instance stream, not from this queue.
+
+	Sort key, most significant first:
+		program index	8 bits
+		VAO index		12 bits
+		material		12 bits
+		view depth		32 bits		bit pattern of a non-negative float, orders like the float
+*/
+
+#ifndef DRAW_QUEUE_H
+#define DRAW_QUEUE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+
+struct DrawCommand
+{
+	GLuint program;
+	GLuint vao;
+	GLenum indexType;			// of the VAO's element array, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	// glMultiDrawElementsIndirect over drawCount tightly packed commands
+	GLuint indirectBuffer;
+	GLintptr indirectOffset;
+	GLsizei drawCount;
+};
+
+// Binds issued by the last submit(), against one program and one VAO bind per draw
+struct DrawQueueStats
+{
+	std::size_t draws;
+	std::size_t programBinds;
+	std::size_t vaoBinds;
+
+	std::size_t bindsSkipped() const { return draws * 2 - programBinds - vaoBinds; }
+};
+
+// Program and VAO indices are small caller-chosen ids, not GL names; depth is view-space distance
+uint64_t UDrawSortKey(uint32_t programIndex, uint32_t vaoIndex, uint32_t material, float depth);
+
+class DrawQueue
+{
+public:
+	DrawQueue();
+
+	void clear();
+	void push(uint64_t key, const DrawCommand& command);
+	std::size_t size() const { return keys.size(); }
+
+	// LSD radix sort on the keys, a byte per pass; passes where every key has the same byte are skipped
+	void sort();
+	// Issues the draws in sorted order. Bound state is not carried over from earlier frames.
+	void submit();
+
+	const DrawQueueStats& stats() const { return lastStats; }
+
+private:
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> order;			// command index of each key
+	std::vector<DrawCommand> commands;
+
+	std::vector<uint64_t> scratchKeys;
+	std::vector<uint32_t> scratchOrder;
+
+	DrawQueueStats lastStats;
+};
+
+#endif // DRAW_QUEUE_H
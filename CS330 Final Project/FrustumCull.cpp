@@ -0,0 +1,168 @@
+/*
+	FrustumCull.cpp
+	Plane extraction and the batched box/plane tests.
+*/
+
+#include "FrustumCull.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULL_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// A box is outside when even its corner farthest along a plane's normal is behind that plane
+	inline bool UBoxInside(const Frustum& frustum, float cx, float cy, float cz, float ex, float ey, float ez)
+	{
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			float distance = plane.x * cx + plane.y * cy + plane.z * cz + plane.w;
+			float radius = std::fabs(plane.x) * ex + std::fabs(plane.y) * ey + std::fabs(plane.z) * ez;
+			if (distance + radius < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	// Pushes first + i for every set bit i of mask
+	inline void UAppendMask(std::vector<uint32_t>& visible, std::size_t first, int mask)
+	{
+		while (mask)
+		{
+			int bit = 0;
+			while (!(mask & (1 << bit)))
+				++bit;
+			visible.push_back((uint32_t)(first + bit));
+			mask &= mask - 1;
+		}
+	}
+}
+
+Aabb UTransformAabb(const Aabb& local, const glm::mat4& model)
+{
+	glm::vec3 center = glm::vec3(model * glm::vec4((local.boundsMin + local.boundsMax) * 0.5f, 1.0f));
+	glm::vec3 extent = (local.boundsMax - local.boundsMin) * 0.5f;
+
+	// extent of the rotated box along each world axis is the absolute matrix times the local extent
+	glm::mat3 absolute(glm::abs(glm::vec3(model[0])), glm::abs(glm::vec3(model[1])), glm::abs(glm::vec3(model[2])));
+	glm::vec3 worldExtent = absolute * extent;
+
+	Aabb world = { center - worldExtent, center + worldExtent };
+	return world;
+}
+
+Frustum UExtractFrustum(const glm::mat4& m)
+{
+	// rows of the matrix; glm is column major, m[column][row]
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row3 + row2;
+	frustum.planes[5] = row3 - row2;
+
+	for (glm::vec4& plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+	return frustum;
+}
+
+void BoundsList::clear()
+{
+	centerX.clear(); centerY.clear(); centerZ.clear();
+	extentX.clear(); extentY.clear(); extentZ.clear();
+}
+
+void BoundsList::reserve(std::size_t count)
+{
+	centerX.reserve(count); centerY.reserve(count); centerZ.reserve(count);
+	extentX.reserve(count); extentY.reserve(count); extentZ.reserve(count);
+}
+
+void BoundsList::add(const Aabb& box)
+{
+	glm::vec3 center = (box.boundsMin + box.boundsMax) * 0.5f;
+	glm::vec3 extent = (box.boundsMax - box.boundsMin) * 0.5f;
+
+	centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+	extentX.push_back(extent.x); extentY.push_back(extent.y); extentZ.push_back(extent.z);
+}
+
+Aabb BoundsList::box(std::size_t index) const
+{
+	glm::vec3 center(centerX[index], centerY[index], centerZ[index]);
+	glm::vec3 extent(extentX[index], extentY[index], extentZ[index]);
+	Aabb result = { center - extent, center + extent };
+	return result;
+}
+
+void UCullBounds(const Frustum& frustum, const BoundsList& bounds, std::size_t first, std::size_t count,
+	std::vector<uint32_t>& visible)
+{
+	std::size_t i = first;
+	const std::size_t end = first + count;
+
+	const float* cx = bounds.centerX.data();
+	const float* cy = bounds.centerY.data();
+	const float* cz = bounds.centerZ.data();
+	const float* ex = bounds.extentX.data();
+	const float* ey = bounds.extentY.data();
+	const float* ez = bounds.extentZ.data();
+
+#if defined(__AVX__)
+	const __m256 signMask8 = _mm256_set1_ps(-0.0f);
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 centerX = _mm256_loadu_ps(cx + i), centerY = _mm256_loadu_ps(cy + i), centerZ = _mm256_loadu_ps(cz + i);
+		__m256 extentX = _mm256_loadu_ps(ex + i), extentY = _mm256_loadu_ps(ey + i), extentZ = _mm256_loadu_ps(ez + i);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			__m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z);
+			__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, centerX), _mm256_mul_ps(ny, centerY)),
+				_mm256_add_ps(_mm256_mul_ps(nz, centerZ), _mm256_set1_ps(plane.w)));
+			__m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask8, nx), extentX),
+				_mm256_mul_ps(_mm256_andnot_ps(signMask8, ny), extentY)), _mm256_mul_ps(_mm256_andnot_ps(signMask8, nz), extentZ));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+		UAppendMask(visible, i, _mm256_movemask_ps(inside));
+	}
+#endif
+#if defined(FRUSTUM_CULL_SSE2)
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 centerX = _mm_loadu_ps(cx + i), centerY = _mm_loadu_ps(cy + i), centerZ = _mm_loadu_ps(cz + i);
+		__m128 extentX = _mm_loadu_ps(ex + i), extentY = _mm_loadu_ps(ey + i), extentZ = _mm_loadu_ps(ez + i);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			__m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, centerX), _mm_mul_ps(ny, centerY)),
+				_mm_add_ps(_mm_mul_ps(nz, centerZ), _mm_set1_ps(plane.w)));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), extentX),
+				_mm_mul_ps(_mm_andnot_ps(signMask, ny), extentY)), _mm_mul_ps(_mm_andnot_ps(signMask, nz), extentZ));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+		UAppendMask(visible, i, _mm_movemask_ps(inside));
+	}
+#endif
+	for (; i < end; ++i)
+	{
+		if (UBoxInside(frustum, cx[i], cy[i], cz[i], ex[i], ey[i], ez[i]))
+			visible.push_back((uint32_t)i);
+	}
+}
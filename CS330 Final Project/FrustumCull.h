@@ -0,0 +1,58 @@
+/*
+	FrustumCull.h
+	View frustum culling of world-space axis-aligned boxes. Boxes are stored as separate
+	center and extent arrays (structure of arrays) so the plane tests run 8 boxes at a time
+	with AVX or 4 with SSE2 when the compiler targets them, and one at a time otherwise.
+	A box is culled when it lies entirely behind one of the six planes; boxes straddling a
+	corner of the frustum can pass, which only costs a draw, never a missing object.
+*/
+
+#ifndef FRUSTUM_CULL_H
+#define FRUSTUM_CULL_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Axis-aligned box
+struct Aabb
+{
+	glm::vec3 boundsMin, boundsMax;
+};
+
+// World-space box around a local-space box moved by model
+Aabb UTransformAabb(const Aabb& local, const glm::mat4& model);
+
+// Planes as (normal, distance) with normals pointing into the frustum
+struct Frustum
+{
+	glm::vec4 planes[6];	// left, right, bottom, top, near, far
+};
+
+// Planes of an OpenGL clip space (-w <= x, y, z <= w) view-projection matrix
+Frustum UExtractFrustum(const glm::mat4& viewProjection);
+
+class BoundsList
+{
+public:
+	void clear();
+	void reserve(std::size_t count);
+	void add(const Aabb& box);
+
+	std::size_t size() const { return centerX.size(); }
+	Aabb box(std::size_t index) const;
+
+private:
+	friend void UCullBounds(const Frustum& frustum, const BoundsList& bounds, std::size_t first, std::size_t count,
+		std::vector<uint32_t>& visible);
+
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;	// half sizes
+};
+
+// Appends the indices of the boxes in [first, first + count) that are at least partly inside
+void UCullBounds(const Frustum& frustum, const BoundsList& bounds, std::size_t first, std::size_t count,
+	std::vector<uint32_t>& visible);
+
+#endif // FRUSTUM_CULL_H
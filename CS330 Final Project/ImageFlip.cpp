@@ -0,0 +1,77 @@
+/*
+	ImageFlip.cpp
+	Row swapping for vertical image flips.
+*/
+
+#include "ImageFlip.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_FLIP_SSE2
+#include <emmintrin.h>
+#endif
+
+void USwapRows(unsigned char* a, unsigned char* b, std::size_t bytes)
+{
+	std::size_t i = 0;
+
+#if defined(__AVX2__)
+	for (; i + 32 <= bytes; i += 32)
+	{
+		__m256i rowA = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i rowB = _mm256_loadu_si256((const __m256i*)(b + i));
+		_mm256_storeu_si256((__m256i*)(a + i), rowB);
+		_mm256_storeu_si256((__m256i*)(b + i), rowA);
+	}
+#endif
+
+#if defined(IMAGE_FLIP_SSE2)
+	for (; i + 16 <= bytes; i += 16)
+	{
+		__m128i rowA = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i rowB = _mm_loadu_si128((const __m128i*)(b + i));
+		_mm_storeu_si128((__m128i*)(a + i), rowB);
+		_mm_storeu_si128((__m128i*)(b + i), rowA);
+	}
+#else
+	// no vector unit we know of, swap through a scratch block the compiler can keep in registers
+	unsigned char scratch[64];
+	for (; i + sizeof(scratch) <= bytes; i += sizeof(scratch))
+	{
+		memcpy(scratch, a + i, sizeof(scratch));
+		memcpy(a + i, b + i, sizeof(scratch));
+		memcpy(b + i, scratch, sizeof(scratch));
+	}
+#endif
+
+	for (; i < bytes; ++i)
+	{
+		unsigned char tmp = a[i];
+		a[i] = b[i];
+		b[i] = tmp;
+	}
+}
+
+void UFlipImageRows(unsigned char* data, std::size_t rowBytes, int rows)
+{
+	if (!data || rows < 2)
+		return;
+
+	unsigned char* top = data;
+	unsigned char* bottom = data + (rows - 1) * rowBytes;
+	for (int j = 0; j < rows / 2; ++j)
+	{
+		USwapRows(top, bottom, rowBytes);
+		top += rowBytes;
+		bottom -= rowBytes;
+	}
+}
+
+void flipImageVertically(unsigned char* image, int width, int height, int channels)
+{
+	UFlipImageRows(image, (std::size_t)width * channels, height);
+}
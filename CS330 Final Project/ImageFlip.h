@@ -0,0 +1,22 @@
+/*
+	ImageFlip.h
+	In-place vertical flip of tightly packed images by swapping whole rows. Rows are swapped 32
+	or 16 bytes at a time with AVX2/SSE2 when the compiler targets them, and through a small
+	memcpy scratch block otherwise. Used by the texture loader and --bench-flip.
+*/
+
+#ifndef IMAGE_FLIP_H
+#define IMAGE_FLIP_H
+
+#include <cstddef>
+
+// Swaps the contents of two non-overlapping byte ranges
+void USwapRows(unsigned char* a, unsigned char* b, std::size_t bytes);
+
+// Reverses the order of rows rows of rowBytes bytes each
+void UFlipImageRows(unsigned char* data, std::size_t rowBytes, int rows);
+
+// Flipping image on Y axis
+void flipImageVertically(unsigned char* image, int width, int height, int channels);
+
+#endif // IMAGE_FLIP_H
@@ -0,0 +1,269 @@
+/*
+	MaterialLibrary.cpp
+	Texture array layers filled by rendering, and bindless handle tables.
+*/
+
+#include "MaterialLibrary.h"
+
+#include <iostream>
+
+#include "ShaderBlocks.h"
+
+#ifndef GLSL
+#define GLSL(Version, Source) "#version " #Version " core \n" #Source
+#endif
+
+namespace
+{
+	// 1x1 placeholder texel of materials that have not loaded yet
+	const unsigned char GREY_TEXEL[4] = { 128, 128, 128, 255 };
+
+	// Layer lookup, linked next to the object fragment shader
+	const char* const arrayMaterialShaderSource = GLSL(440,
+		uniform sampler2DArray uMaterials;
+
+		vec3 materialColor(uint material, vec2 uv)
+		{
+			return texture(uMaterials, vec3(uv, float(material))).rgb;
+		}
+	);
+
+	// Handle lookup; #extension cannot go through the GLSL macro. The material differs between
+	// instances of one multi-draw, and only NV_gpu_shader5 allows indexing samplers with a value
+	// that isn't dynamically uniform
+	const char* const bindlessMaterialShaderSource =
+		"#version 440 core\n"
+		"#extension GL_ARB_bindless_texture : require\n"
+		"#extension GL_NV_gpu_shader5 : require\n"
+		"layout(std430, binding = 5) readonly buffer MaterialHandles\n"
+		"{\n"
+		"	sampler2D materialTextures[];\n"
+		"};\n"
+		"vec3 materialColor(uint material, vec2 uv)\n"
+		"{\n"
+		"	return texture(materialTextures[material], uv).rgb;\n"
+		"}\n";
+
+	// Fullscreen triangle from gl_VertexID, resampling the bound texture into one layer
+	const char* const copyVertexShaderSource = GLSL(440,
+		out vec2 uv;
+
+		void main()
+		{
+			uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+			gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+		}
+	);
+
+	const char* const copyFragmentShaderSource = GLSL(440,
+		in vec2 uv;
+		out vec4 color;
+
+		uniform sampler2D uSource;
+
+		void main()
+		{
+			color = texture(uSource, uv);
+		}
+	);
+
+	GLuint UCompileCopyShader(GLenum type, const char* source)
+	{
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+
+		int success = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::MATERIAL_COPY::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+}
+
+MaterialLibrary::MaterialLibrary()
+	: materialCount(0), useBindless(false), textureArray(0), levelCount(0), copyProgram(0), copyVao(0),
+	  copyFbo(0), copySampler(0), handleBuffer(0), greyTexture(0)
+{
+}
+
+bool MaterialLibrary::create(GLuint count, bool allowBindless)
+{
+	materialCount = count;
+	// without NV_gpu_shader5 the per-instance sampler index is undefined behavior, so use the array
+	useBindless = allowBindless && GLEW_ARB_bindless_texture && GLEW_NV_gpu_shader5;
+
+	if (useBindless)
+	{
+		glGenTextures(1, &greyTexture);
+		glBindTexture(GL_TEXTURE_2D, greyTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, GREY_TEXEL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		GLuint64 greyHandle = glGetTextureHandleARB(greyTexture);
+		glMakeTextureHandleResidentARB(greyHandle);
+		residentHandles.push_back(greyHandle);
+		handles.assign(materialCount, greyHandle);
+
+		glGenBuffers(1, &handleBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, handleBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, handles.size() * sizeof(GLuint64), handles.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return true;
+	}
+
+	levelCount = 1;
+	while ((MATERIAL_LAYER_SIZE >> levelCount) > 0)
+		++levelCount;
+
+	glGenTextures(1, &textureArray);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, GL_RGBA8, MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE, materialCount);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	for (GLsizei level = 0; level < levelCount; ++level)
+		glClearTexImage(textureArray, level, GL_RGBA, GL_UNSIGNED_BYTE, GREY_TEXEL);
+
+	return createCopyProgram();
+}
+
+bool MaterialLibrary::createCopyProgram()
+{
+	GLuint vertexShader = UCompileCopyShader(GL_VERTEX_SHADER, copyVertexShaderSource);
+	GLuint fragmentShader = UCompileCopyShader(GL_FRAGMENT_SHADER, copyFragmentShaderSource);
+	if (!vertexShader || !fragmentShader)
+		return false;
+
+	copyProgram = glCreateProgram();
+	glAttachShader(copyProgram, vertexShader);
+	glAttachShader(copyProgram, fragmentShader);
+	glLinkProgram(copyProgram);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	int success = 0;
+	glGetProgramiv(copyProgram, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		char infoLog[512];
+		glGetProgramInfoLog(copyProgram, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::SHADER::MATERIAL_COPY::LINKING_FAILED\n" << infoLog << std::endl;
+		return false;
+	}
+
+	// core profile draws need a VAO even without attributes
+	glGenVertexArrays(1, &copyVao);
+	glGenFramebuffers(1, &copyFbo);
+
+	// sources are sampled with their mips so large images are averaged, not skipped over
+	glGenSamplers(1, &copySampler);
+	glSamplerParameteri(copySampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glSamplerParameteri(copySampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(copySampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(copySampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return true;
+}
+
+void MaterialLibrary::destroy()
+{
+	for (GLuint64 handle : residentHandles)
+		glMakeTextureHandleNonResidentARB(handle);
+	residentHandles.clear();
+	handles.clear();
+
+	glDeleteBuffers(1, &handleBuffer);
+	glDeleteTextures(1, &greyTexture);
+	glDeleteTextures(1, &textureArray);
+	glDeleteProgram(copyProgram);
+	glDeleteVertexArrays(1, &copyVao);
+	glDeleteFramebuffers(1, &copyFbo);
+	glDeleteSamplers(1, &copySampler);
+
+	handleBuffer = greyTexture = textureArray = copyProgram = copyVao = copyFbo = copySampler = 0;
+}
+
+void MaterialLibrary::setTexture(GLuint material, GLuint texture)
+{
+	if (material >= materialCount)
+		return;
+
+	if (useBindless)
+	{
+		// taking a handle freezes the texture, which is why this waits until it has loaded
+		GLuint64 handle = glGetTextureHandleARB(texture);
+		glMakeTextureHandleResidentARB(handle);
+		residentHandles.push_back(handle);
+		handles[material] = handle;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, handleBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, material * sizeof(GLuint64), sizeof(GLuint64), &handle);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return;
+	}
+
+	// everything changed here is put back, this runs between frames while textures stream in
+	GLint viewport[4], drawFramebuffer = 0, program = 0;
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copyFbo);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureArray, 0, (GLint)material);
+	glViewport(0, 0, MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE);
+	glDisable(GL_DEPTH_TEST);
+
+	glUseProgram(copyProgram);
+	glBindVertexArray(copyVao);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glBindSampler(0, copySampler);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindSampler(0, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindVertexArray(0);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)drawFramebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glUseProgram((GLuint)program);
+	if (depthTest)
+		glEnable(GL_DEPTH_TEST);
+
+	// rebuild the mips of this layer only, through a 2D view of it
+	GLuint layerView;
+	glGenTextures(1, &layerView);
+	glTextureView(layerView, GL_TEXTURE_2D, textureArray, GL_RGBA8, 0, levelCount, material, 1);
+	glBindTexture(GL_TEXTURE_2D, layerView);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glDeleteTextures(1, &layerView);
+}
+
+void MaterialLibrary::bind() const
+{
+	if (useBindless)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_HANDLE_BINDING, handleBuffer);
+	}
+	else
+	{
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+	}
+}
+
+const char* MaterialLibrary::materialShaderSource() const
+{
+	return useBindless ? bindlessMaterialShaderSource : arrayMaterialShaderSource;
+}
@@ -0,0 +1,70 @@
+/*
+	MaterialLibrary.h
+	Every material texture reachable from one shader without per-draw binds or uniforms.
+	The fragment shader looks materials up by the index streamed with each instance.
+
+	Texture array path: each material gets a layer of one GL_TEXTURE_2D_ARRAY with a fixed
+	layer size and a full mip chain. Source textures differ in size and format (RGB, RGBA,
+	BC1, BC3), so setTexture() renders the finished texture into its layer with a
+	fullscreen triangle, which also resamples it, and rebuilds that layer's mips. The layers
+	are uncompressed RGBA8, so the source texture can and should be deleted once copied; in
+	this path the BC1/BC3 texture cache only saves decoding and upload time, not memory.
+
+	Bindless path (ARB_bindless_texture): the finished textures stay as they are and their
+	resident handles are stored in a shader storage buffer at MATERIAL_HANDLE_BINDING.
+	Materials still loading use the handle of a 1x1 grey texture. The handle index varies
+	within a draw, which ARB_bindless_texture only allows together with NV_gpu_shader5, so
+	without it the array path is used.
+
+	materialShaderSource() is a second fragment shader object defining
+		vec3 materialColor(uint material, vec2 uv);
+	for the path in use, to be linked next to the object fragment shader.
+*/
+
+#ifndef MATERIAL_LIBRARY_H
+#define MATERIAL_LIBRARY_H
+
+#include <vector>
+
+#include <GL/glew.h>
+
+// Width and height of every texture array layer
+const GLsizei MATERIAL_LAYER_SIZE = 1024;
+
+class MaterialLibrary
+{
+public:
+	MaterialLibrary();
+
+	// Creates storage for materialCount grey materials, bindless if allowed and supported
+	bool create(GLuint materialCount, bool allowBindless);
+	void destroy();
+
+	// Points a material at a texture that has finished loading. GL thread only.
+	void setTexture(GLuint material, GLuint texture);
+
+	// Binds the array to unit 0, or the handle buffer to its storage binding
+	void bind() const;
+
+	bool bindless() const { return useBindless; }
+	const char* materialShaderSource() const;
+
+private:
+	bool createCopyProgram();
+
+	GLuint materialCount;
+	bool useBindless;
+
+	// texture array path
+	GLuint textureArray;
+	GLsizei levelCount;
+	GLuint copyProgram, copyVao, copyFbo, copySampler;
+
+	// bindless path
+	GLuint handleBuffer;
+	GLuint greyTexture;
+	std::vector<GLuint64> handles;			// per material, uploaded to handleBuffer
+	std::vector<GLuint64> residentHandles;	// every handle made resident, released by destroy()
+};
+
+#endif // MATERIAL_LIBRARY_H
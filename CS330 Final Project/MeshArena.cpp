@@ -0,0 +1,593 @@
+/*
+	MeshArena.cpp
+	Shared geometry buffers, instance storage and bounds, frustum and occlusion culling and
+	indirect command upload.
+*/
+
+#include "MeshArena.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include "Benchmark.h"
+#include "ShaderBlocks.h"
+
+namespace
+{
+	// position, normal and uv
+	const GLsizei FLOATS_PER_VERTEX = 8;
+
+	// a level is left once its instance is this much past its size threshold
+	const float LOD_HYSTERESIS = 0.1f;
+
+	// LSD radix sort of depth keys on their 16 depth bits (32 to 47), the same passes as DrawQueue::sort
+	void USortDepthKeys(std::vector<uint64_t>& keys, std::vector<uint64_t>& scratch)
+	{
+		std::size_t count = keys.size();
+		scratch.resize(count);
+		for (int shift = 32; shift < 48; shift += 8)
+		{
+			std::size_t histogram[256] = {};
+			for (uint64_t key : keys)
+				histogram[(key >> shift) & 0xff]++;
+			if (count == 0 || histogram[(keys[0] >> shift) & 0xff] == count)
+				continue;
+
+			std::size_t offset = 0;
+			for (std::size_t& bucket : histogram)
+			{
+				std::size_t bucketCount = bucket;
+				bucket = offset;
+				offset += bucketCount;
+			}
+			for (uint64_t key : keys)
+				scratch[histogram[(key >> shift) & 0xff]++] = key;
+			keys.swap(scratch);
+		}
+	}
+}
+
+MeshArena::MeshArena()
+	: vao(0), vbo(0), ibo(0), visibleVbo(0), instanceBuffer(0), indirectBuffer(0), meshDecodeBuffer(0), instanceCapacity(0),
+	  vertexBytes(0), indexBytes(0), elementType(GL_UNSIGNED_INT), packed(false), dirty(false), uploadPending(false), groupCount(0), occlusionEnabled(false), lastDrawCalls(0), lastOccluded(0),
+	  lastTriangles(0), cullMs(0.0), occlusionMs(0.0)
+{
+}
+
+uint32_t MeshArena::addMesh(const GLfloat* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount, uint32_t pipeline)
+{
+	std::vector<GLfloat> meshVertices;
+	std::vector<GLuint> meshIndices;
+	Mesh mesh;
+	mesh.lods.push_back(appendGeometry(vertices, vertexCount, indices, indexCount, meshVertices, meshIndices));
+	// the bounds, BVH and occluder copy are of the optimized geometry the arena draws
+	vertices = meshVertices.data();
+	vertexCount = (GLsizei)(meshVertices.size() / FLOATS_PER_VERTEX);
+	indices = meshIndices.data();
+	mesh.firstGroup = groupCount++;
+	mesh.pipeline = pipeline;
+	mesh.firstInstance = 0;
+	mesh.uploadedCount = 0;
+
+	mesh.bounds.boundsMin = mesh.bounds.boundsMax = glm::vec3(vertices[0], vertices[1], vertices[2]);
+	for (GLsizei i = 1; i < vertexCount; ++i)
+	{
+		glm::vec3 position(vertices[i * FLOATS_PER_VERTEX], vertices[i * FLOATS_PER_VERTEX + 1], vertices[i * FLOATS_PER_VERTEX + 2]);
+		mesh.bounds.boundsMin = glm::min(mesh.bounds.boundsMin, position);
+		mesh.bounds.boundsMax = glm::max(mesh.bounds.boundsMax, position);
+	}
+	meshes.push_back(mesh);
+	meshes.back().triangles.build(vertices, vertexCount, indices, indexCount);
+	meshes.back().positions.resize(vertexCount);
+	for (GLsizei i = 0; i < vertexCount; ++i)
+		meshes.back().positions[i] = glm::vec3(vertices[i * FLOATS_PER_VERTEX], vertices[i * FLOATS_PER_VERTEX + 1], vertices[i * FLOATS_PER_VERTEX + 2]);
+	meshes.back().indices.assign(indices, indices + indexCount);
+
+	if (pipeline >= pipelines.size())
+		pipelines.resize(pipeline + 1, PipelineRange{ 0, 0, 0.0f });
+
+	return (uint32_t)(meshes.size() - 1);
+}
+
+void MeshArena::addLod(uint32_t mesh, const GLfloat* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount,
+	float maxScreenSize)
+{
+	std::vector<GLfloat> meshVertices;
+	std::vector<GLuint> meshIndices;
+	Lod lod = appendGeometry(vertices, vertexCount, indices, indexCount, meshVertices, meshIndices);
+	lod.maxScreenSize = maxScreenSize;
+	meshes[mesh].lods.push_back(lod);
+
+	// group numbers of the meshes after this one move up by the new level
+	groupCount++;
+	for (uint32_t later = mesh + 1; later < meshes.size(); ++later)
+		meshes[later].firstGroup++;
+}
+
+MeshArena::Lod MeshArena::appendGeometry(const GLfloat* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount,
+	std::vector<GLfloat>& meshVertices, std::vector<GLuint>& meshIndices)
+{
+	meshVertices.assign(vertices, vertices + vertexCount * FLOATS_PER_VERTEX);
+	meshIndices.assign(indices, indices + indexCount);
+	MeshOptimizeStats optimized = UOptimizeMesh(meshVertices, meshIndices);
+
+	// indices stay local to the mesh, baseVertex moves them to where its vertices start
+	Lod lod = { (GLuint)indexData.size(), (GLuint)indexCount, (GLint)(vertexData.size() / FLOATS_PER_VERTEX),
+		(GLuint)optimized.verticesAfter, FLT_MAX, optimized };
+	vertexData.insert(vertexData.end(), meshVertices.begin(), meshVertices.end());
+	indexData.insert(indexData.end(), meshIndices.begin(), meshIndices.end());
+	return lod;
+}
+
+void MeshArena::create(bool packedVertices)
+{
+	packed = packedVertices;
+
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	if (packed)
+	{
+		// every level of a mesh is quantized over the box around all of them
+		std::vector<PackedVertex> packedData(vertexData.size() / FLOATS_PER_VERTEX);
+		std::vector<MeshDecode> decode(meshes.size());
+		for (std::size_t meshIndex = 0; meshIndex < meshes.size(); ++meshIndex)
+		{
+			const Mesh& mesh = meshes[meshIndex];
+			glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+			for (const Lod& lod : mesh.lods)
+			{
+				for (GLuint v = 0; v < lod.vertexCount; ++v)
+				{
+					const GLfloat* vertex = &vertexData[(lod.baseVertex + v) * FLOATS_PER_VERTEX];
+					boxMin = glm::min(boxMin, glm::vec3(vertex[0], vertex[1], vertex[2]));
+					boxMax = glm::max(boxMax, glm::vec3(vertex[0], vertex[1], vertex[2]));
+				}
+			}
+
+			decode[meshIndex].positionScale = glm::vec4(boxMax - boxMin, 0.0f);
+			decode[meshIndex].positionOffset = glm::vec4(boxMin, 0.0f);
+			for (const Lod& lod : mesh.lods)
+			{
+				for (GLuint v = 0; v < lod.vertexCount; ++v)
+				{
+					packedData[lod.baseVertex + v] = UPackVertex(&vertexData[(lod.baseVertex + v) * FLOATS_PER_VERTEX],
+						boxMin, boxMax - boxMin);
+				}
+			}
+		}
+
+		vertexBytes = packedData.size() * sizeof(PackedVertex);
+		glBufferData(GL_ARRAY_BUFFER, vertexBytes, packedData.data(), GL_STATIC_DRAW);
+
+		glGenBuffers(1, &meshDecodeBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshDecodeBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, decode.size() * sizeof(MeshDecode), decode.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+	else
+	{
+		vertexBytes = vertexData.size() * sizeof(GLfloat);
+		glBufferData(GL_ARRAY_BUFFER, vertexBytes, vertexData.data(), GL_STATIC_DRAW);
+	}
+
+	// indices are relative to each level's baseVertex, so 16 bits do while no level has more
+	// than 65536 vertices, halving the index buffer
+	bool shortIndices = true;
+	for (const Mesh& mesh : meshes)
+	{
+		for (const Lod& lod : mesh.lods)
+			shortIndices = shortIndices && lod.vertexCount <= 65536;
+	}
+
+	// the element array binding is stored in the VAO
+	glGenBuffers(1, &ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	if (shortIndices)
+	{
+		std::vector<GLushort> shortData(indexData.begin(), indexData.end());
+		elementType = GL_UNSIGNED_SHORT;
+		indexBytes = shortData.size() * sizeof(GLushort);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, shortData.data(), GL_STATIC_DRAW);
+	}
+	else
+	{
+		elementType = GL_UNSIGNED_INT;
+		indexBytes = indexData.size() * sizeof(GLuint);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indexData.data(), GL_STATIC_DRAW);
+	}
+
+	USetVertexAttributes(packed);
+
+	// indices of the visible instances, rewritten every frame by queueDraws()
+	glGenBuffers(1, &visibleVbo);
+	glBindBuffer(GL_ARRAY_BUFFER, visibleVbo);
+	glVertexAttribIPointer(INSTANCE_INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+	glEnableVertexAttribArray(INSTANCE_INDEX_ATTRIBUTE);
+	glVertexAttribDivisor(INSTANCE_INDEX_ATTRIBUTE, 1);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &instanceBuffer);
+	glGenBuffers(1, &indirectBuffer);
+
+	// the GPU copy is all that is needed from here on
+	std::vector<GLfloat>().swap(vertexData);
+	std::vector<GLuint>().swap(indexData);
+
+	dirty = true;
+}
+
+const char* MeshArena::vertexShaderSource() const
+{
+	return UVertexFormatShaderSource(packed);
+}
+
+void MeshArena::destroy()
+{
+	glDeleteVertexArrays(1, &vao);
+	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &ibo);
+	glDeleteBuffers(1, &visibleVbo);
+	glDeleteBuffers(1, &instanceBuffer);
+	glDeleteBuffers(1, &indirectBuffer);
+	glDeleteBuffers(1, &meshDecodeBuffer);
+
+	vao = vbo = ibo = visibleVbo = instanceBuffer = indirectBuffer = meshDecodeBuffer = 0;
+	instanceCapacity = 0;
+
+	occlusion.stop();
+}
+
+void MeshArena::setOcclusionCulling(int width, int height, unsigned int threadCount)
+{
+	occlusionEnabled = width > 0 && height > 0;
+	lastOccluded = 0;
+	occlusionMs = 0.0;
+	if (!occlusionEnabled)
+	{
+		occlusion.stop();
+		return;
+	}
+
+	occlusion.resize(width, height);
+	occlusion.start(threadCount);
+}
+
+void MeshArena::setInstances(uint32_t mesh, const std::vector<MeshInstance>& instances)
+{
+	meshes[mesh].instances = instances;
+	dirty = true;
+}
+
+void MeshArena::updateInstances()
+{
+	std::size_t total = 0;
+	for (const Mesh& mesh : meshes)
+		total += mesh.instances.size();
+
+	// the BVH's leaves are kept if every mesh still has as many instances, only their boxes move
+	bool sameInstances = total > 0 && bvh.size() == total;
+	for (const Mesh& mesh : meshes)
+		sameInstances = sameInstances && mesh.instances.size() == mesh.uploadedCount;
+
+	// grouped by pipeline so each pipeline's commands come out contiguous when culling
+	instanceBounds.clear();
+	instanceModels.clear();
+	instanceMaterials.clear();
+	instanceMeshes.clear();
+	instanceOccluders.clear();
+	for (uint32_t pipeline = 0; pipeline < pipelines.size(); ++pipeline)
+	{
+		for (uint32_t meshIndex = 0; meshIndex < meshes.size(); ++meshIndex)
+		{
+			Mesh& mesh = meshes[meshIndex];
+			if (mesh.pipeline != pipeline)
+				continue;
+
+			mesh.firstInstance = instanceModels.size();
+			mesh.uploadedCount = mesh.instances.size();
+			for (const MeshInstance& instance : mesh.instances)
+			{
+				instanceBounds.push_back(UTransformAabb(mesh.bounds, instance.model));
+				instanceModels.push_back(instance.model);
+				instanceMaterials.push_back(instance.material);
+				instanceMeshes.push_back(meshIndex);
+				instanceOccluders.push_back(instance.occluder ? 1 : 0);
+			}
+		}
+	}
+
+	if (sameInstances)
+	{
+		bvh.refit(instanceBounds);
+	}
+	else
+	{
+		bvh.build(instanceBounds);
+		instanceLods.assign(total, 0);
+	}
+
+	dirty = false;
+	uploadPending = true;
+}
+
+void MeshArena::uploadInstances()
+{
+	std::size_t total = instanceModels.size();
+	if (total > instanceCapacity)
+	{
+		// grow geometrically so adding props one at a time does not reallocate every frame
+		instanceCapacity = std::max(total, instanceCapacity * 2);
+
+		glBindBuffer(GL_ARRAY_BUFFER, visibleVbo);
+		glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, instanceCapacity * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	std::vector<InstanceData> instanceData(total);
+	for (std::size_t i = 0; i < total; ++i)
+	{
+		instanceData[i].model = instanceModels[i];
+		// once per change here instead of an inverse per vertex in the shader
+		glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(instanceModels[i]));
+		for (int column = 0; column < 3; ++column)
+			instanceData[i].normalMatrix[column] = glm::vec4(normalMatrix[column], 0.0f);
+		instanceData[i].material = glm::uvec4(instanceMaterials[i], instanceMeshes[i], 0u, 0u);
+	}
+
+	if (!instanceData.empty())
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instanceData.size() * sizeof(InstanceData), instanceData.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	uploadPending = false;
+}
+
+void MeshArena::cull(const glm::mat4& viewProjection)
+{
+	if (dirty)
+		updateInstances();
+
+	CpuTimer timer;
+	visible.clear();
+	bvh.cullFrustum(UExtractFrustum(viewProjection), visible);
+
+	// occluders in view are drawn, then everything else in view is tested against them
+	occlusionMs = 0.0;
+	lastOccluded = 0;
+	if (occlusionEnabled)
+	{
+		CpuTimer occlusionTimer;
+		occlusion.begin(viewProjection);
+		for (uint32_t index : visible)
+		{
+			if (!instanceOccluders[index])
+				continue;
+			const Mesh& mesh = meshes[instanceMeshes[index]];
+			occlusion.addOccluder(mesh.positions.data(), mesh.indices.data(), mesh.indices.size(), instanceModels[index]);
+		}
+		if (occlusion.triangleCount())
+		{
+			std::size_t inFrustum = visible.size();
+			occlusion.render();
+			occlusion.cullOccluded(instanceBounds, instanceOccluders, visible);
+			lastOccluded = inFrustum - visible.size();
+		}
+		occlusionMs = occlusionTimer.elapsedMs();
+	}
+
+	selectLods(viewProjection);
+
+	// the BVH returns instances in tree order; count them per mesh and level and find how far
+	// each is along the view direction (its box center's clip w)
+	glm::vec4 wRow(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+	groupVisibleCount.assign(groupCount, 0);
+	groupNearest.assign(groupCount, FLT_MAX);
+	depthKeys.resize(visible.size());
+	for (std::size_t i = 0; i < visible.size(); ++i)
+	{
+		uint32_t index = visible[i];
+		uint32_t group = meshes[instanceMeshes[index]].firstGroup + instanceLods[index];
+		glm::vec3 center = (instanceBounds[index].boundsMin + instanceBounds[index].boundsMax) * 0.5f;
+		float depth = std::max(glm::dot(glm::vec3(wRow), center) + wRow.w, 0.0f);
+		groupVisibleCount[group]++;
+		groupNearest[group] = std::min(groupNearest[group], depth);
+
+		// non-negative floats order like their bit patterns; the top 16 (exponent and 7 bits of
+		// mantissa, under 1% apart) are plenty for front to back and take two radix passes
+		uint32_t depthBits;
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+		depthKeys[i] = ((uint64_t)(depthBits >> 16) << 32) | index;
+	}
+
+	// each group's visible instances become one run of the visible stream and one command;
+	// a pipeline's commands go nearest group first, and every run nearest instance first, so
+	// the multi-draw fills the depth buffer front to back for early-Z
+	commands.clear();
+	groupVisibleStart.assign(groupCount, 0);
+	std::size_t runStart = 0;
+	lastTriangles = 0;
+	for (uint32_t pipeline = 0; pipeline < pipelines.size(); ++pipeline)
+	{
+		pipelines[pipeline].offset = (GLintptr)(commands.size() * sizeof(IndirectCommand));
+		pipelines[pipeline].count = 0;
+		pipelines[pipeline].nearest = FLT_MAX;
+
+		pipelineGroups.clear();
+		for (uint32_t meshIndex = 0; meshIndex < meshes.size(); ++meshIndex)
+		{
+			const Mesh& mesh = meshes[meshIndex];
+			if (mesh.pipeline != pipeline)
+				continue;
+			for (uint32_t level = 0; level < mesh.lods.size(); ++level)
+			{
+				if (groupVisibleCount[mesh.firstGroup + level] > 0)
+					pipelineGroups.push_back(std::make_pair(meshIndex, level));
+			}
+		}
+		std::sort(pipelineGroups.begin(), pipelineGroups.end(),
+			[this](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) {
+				return groupNearest[meshes[a.first].firstGroup + a.second] < groupNearest[meshes[b.first].firstGroup + b.second];
+			});
+
+		for (const auto& meshLevel : pipelineGroups)
+		{
+			const Mesh& mesh = meshes[meshLevel.first];
+			uint32_t group = mesh.firstGroup + meshLevel.second;
+			std::size_t visibleCount = groupVisibleCount[group];
+			groupVisibleStart[group] = runStart;
+
+			const Lod& lod = mesh.lods[meshLevel.second];
+			IndirectCommand command = { lod.indexCount, (GLuint)visibleCount, lod.firstIndex, lod.baseVertex, (GLuint)runStart };
+			commands.push_back(command);
+			pipelines[pipeline].count++;
+			pipelines[pipeline].nearest = std::min(pipelines[pipeline].nearest, groupNearest[group]);
+			runStart += visibleCount;
+			lastTriangles += lod.indexCount / 3 * visibleCount;
+		}
+	}
+
+	// sorting by depth first and scattering into the runs in that order keeps every run sorted
+	USortDepthKeys(depthKeys, depthScratch);
+	sortedVisible.resize(visible.size());
+	for (uint64_t key : depthKeys)
+	{
+		uint32_t index = (uint32_t)key;
+		sortedVisible[groupVisibleStart[meshes[instanceMeshes[index]].firstGroup + instanceLods[index]]++] = index;
+	}
+	visible.swap(sortedVisible);
+	cullMs = timer.elapsedMs() - occlusionMs;
+}
+
+void MeshArena::queueDraws(DrawQueue& queue, const GLuint* pipelinePrograms, const glm::mat4& viewProjection)
+{
+	cull(viewProjection);
+	if (uploadPending)
+		uploadInstances();
+
+	// orphan both buffers so the driver does not wait on last frame's draws
+	if (!visible.empty())
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, visibleVbo);
+		glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, visible.size() * sizeof(GLuint), visible.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(IndirectCommand), commands.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, instanceBuffer);
+	if (packed)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_DECODE_BINDING, meshDecodeBuffer);
+
+	// one arena VAO, and materials change per instance inside a draw, so the key holds the
+	// program and the pipeline's nearest instance; the order within a draw is in the stream
+	lastDrawCalls = 0;
+	for (uint32_t pipeline = 0; pipeline < pipelines.size(); ++pipeline)
+	{
+		const PipelineRange& range = pipelines[pipeline];
+		if (range.count == 0)
+			continue;
+
+		DrawCommand command = { pipelinePrograms[pipeline], vao, elementType, indirectBuffer, range.offset, range.count };
+		queue.push(UDrawSortKey(pipeline, 0, 0, range.nearest), command);
+		lastDrawCalls++;
+	}
+}
+
+void MeshArena::selectLods(const glm::mat4& viewProjection)
+{
+	// a sphere's diameter on screen, over the viewport height, is its radius times the length
+	// of the y row of the view-projection over its clip w; for perspective and orthographic
+	// projections alike
+	glm::vec3 yRow(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]);
+	glm::vec4 wRow(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+	float yScale = glm::length(yRow);
+
+	for (uint32_t index : visible)
+	{
+		const Mesh& mesh = meshes[instanceMeshes[index]];
+		if (mesh.lods.size() < 2)
+			continue;
+
+		const Aabb& box = instanceBounds[index];
+		glm::vec3 center = (box.boundsMin + box.boundsMax) * 0.5f;
+		float radius = glm::length(box.boundsMax - center);
+		float w = glm::dot(wRow, glm::vec4(center, 1.0f));
+		// with the camera inside the sphere it can cover the whole screen
+		float size = w > radius ? radius * yScale / w : FLT_MAX;
+
+		uint8_t& level = instanceLods[index];
+		while (level + 1u < mesh.lods.size() && size < mesh.lods[level + 1].maxScreenSize * (1.0f - LOD_HYSTERESIS))
+			++level;
+		while (level > 0 && size > mesh.lods[level].maxScreenSize * (1.0f + LOD_HYSTERESIS))
+			--level;
+	}
+}
+
+std::size_t MeshArena::lodInstanceCount(uint32_t mesh, uint32_t level) const
+{
+	if (level >= meshes[mesh].lods.size() || groupVisibleCount.empty())
+		return 0;
+	return groupVisibleCount[meshes[mesh].firstGroup + level];
+}
+
+InstanceRef MeshArena::instanceRef(uint32_t index) const
+{
+	InstanceRef ref = { instanceMeshes[index], (uint32_t)(index - meshes[instanceMeshes[index]].firstInstance) };
+	return ref;
+}
+
+bool MeshArena::raycastBounds(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, InstanceRef& hit) const
+{
+	uint32_t index;
+	if (!bvh.raycastBoxes(origin, direction, maxDistance, index))
+		return false;
+	hit = instanceRef(index);
+	return true;
+}
+
+void MeshArena::instancesNear(const glm::vec3& center, float radius, std::vector<InstanceRef>& result) const
+{
+	std::vector<uint32_t> indices;
+	bvh.overlapSphere(center, radius, indices);
+	for (uint32_t index : indices)
+		result.push_back(instanceRef(index));
+}
+
+bool MeshArena::pick(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, PickHit& hit) const
+{
+	// an instance's ray keeps the world ray's parameter, so distances compare across instances
+	TriangleHit nearest;
+	uint32_t index;
+	bool found = bvh.raycast(origin, direction, maxDistance, index,
+		[&](uint32_t instance, float, float& distance) {
+			glm::mat4 toLocal = glm::inverse(instanceModels[instance]);
+			glm::vec3 localOrigin = glm::vec3(toLocal * glm::vec4(origin, 1.0f));
+			glm::vec3 localDirection = glm::vec3(toLocal * glm::vec4(direction, 0.0f));
+			return meshes[instanceMeshes[instance]].triangles.raycast(localOrigin, localDirection, distance, nearest);
+		});
+	if (!found)
+		return false;
+
+	hit.instance = instanceRef(index);
+	hit.triangle = nearest.triangle;
+	hit.uv = nearest.uv;
+	hit.distance = nearest.distance;
+	hit.position = origin + direction * nearest.distance;
+	return true;
+}
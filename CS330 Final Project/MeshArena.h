@@ -0,0 +1,244 @@
+/*
+	MeshArena.h
+	Every unit mesh of the scene packed into one vertex buffer and one index buffer, 16-bit
+	unless a level needs more, under a single VAO, drawn with one glMultiDrawElementsIndirect per pipeline.
+
+	Model matrices, normal matrices and material indices live in a shader storage buffer at
+	INSTANCE_BUFFER_BINDING, grouped by mesh, and are uploaded only when the instances
+	change, together with a world-space box per instance and a BVH over those boxes (rebuilt
+	when instances are added or removed, refit when they only move). Every frame the BVH is
+	frustum culled, instances marked as occluders are drawn into a CPU depth buffer when
+	occlusion culling is on and instances hidden behind them are dropped (see OcclusionCull.h),
+	and the indices of the visible instances are streamed per mesh as
+	an unsigned integer attribute (attribute 3, divisor 1). Each mesh with anything visible
+	is one indirect command per level of detail in use, whose baseInstance is the start of
+	its run in that stream. Commands are ordered by their nearest instance and every run
+	nearest first, so each multi-draw renders roughly front to back;
+	GLSL 4.40 has neither gl_DrawID nor gl_BaseInstance, so the attribute is how the shader
+	finds the storage buffer element of the instance it is drawing.
+
+	A frame queues one draw per pipeline whatever the number of objects. cull() is the CPU half
+	of queueDraws() and makes no GL calls, so headless tests can run it without create().
+
+	A mesh can have coarser levels of detail in the same buffers. Each visible instance
+	picks its level from the size of its bounding sphere on screen; a level is only left once
+	the size is LOD_HYSTERESIS past its threshold, so an instance sitting on a threshold does
+	not switch back and forth every frame.
+
+	Geometry is welded and reordered for the vertex cache on the way in (see MeshOptimizer.h),
+	so triangle numbers refer to the arena's copy, not to the arrays passed to addMesh().
+
+	create() stores the vertices either as they are added or in the 16-byte packed layout of
+	VertexFormat.h, quantized over each mesh's box; the object vertex shader is linked with
+	vertexShaderSource() to read them.
+
+	Each mesh also keeps a TriangleBvh of its finest geometry, so pick() can follow a ray
+	through the instance BVH into the triangles of every instance it reaches, in instance space.
+*/
+
+#ifndef MESH_ARENA_H
+#define MESH_ARENA_H
+
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "DrawQueue.h"
+#include "Bvh.h"
+#include "FrustumCull.h"
+#include "MeshOptimizer.h"
+#include "OcclusionCull.h"
+#include "TriangleBvh.h"
+#include "VertexFormat.h"
+
+// Unsigned integer attribute holding the visible instance's element in the instance buffer
+const GLuint INSTANCE_INDEX_ATTRIBUTE = 3;
+
+// One prop: where it is and what it is textured with
+struct MeshInstance
+{
+	glm::mat4 model;
+	GLuint material;	// MaterialLibrary layer or handle index
+	bool occluder;		// drawn into the occlusion buffer, never occlusion culled itself
+};
+
+// A scene query result: which mesh, and which of that mesh's instances
+struct InstanceRef
+{
+	uint32_t mesh;
+	uint32_t instance;
+};
+
+// The triangle a pick ray hit first
+struct PickHit
+{
+	InstanceRef instance;
+	uint32_t triangle;		// in the mesh's index list, index / 3
+	glm::vec2 uv;			// texture coordinate at the hit, as stored in the mesh
+	glm::vec3 position;		// world space
+	float distance;			// along the ray, in units of its direction's length
+};
+
+class MeshArena
+{
+public:
+	MeshArena();
+
+	// Appends a mesh of interleaved position/normal/uv vertices to be drawn with the
+	// program of the given pipeline, and builds its triangle BVH. Returns its index, in the
+	// order meshes are added.
+	uint32_t addMesh(const GLfloat* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount, uint32_t pipeline);
+	// Appends a coarser level of detail to a mesh, drawn for instances whose bounding sphere's
+	// diameter on screen is at most maxScreenSize times the viewport height. Levels are added
+	// from finest to coarsest with decreasing sizes.
+	void addLod(uint32_t mesh, const GLfloat* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount,
+		float maxScreenSize);
+	// Uploads the meshes added so far, packed when packedVertices is set; none can be added afterwards
+	void create(bool packedVertices);
+	void destroy();
+
+	// Vertex layout chosen by create(), the vertex shader object that decodes it, and the sizes of
+	// the vertex and index buffers in bytes
+	bool packedVertices() const { return packed; }
+	const char* vertexShaderSource() const;
+	std::size_t vertexBufferBytes() const { return vertexBytes; }
+	std::size_t indexBufferBytes() const { return indexBytes; }
+	// GL_UNSIGNED_SHORT while every level has at most 65536 vertices, else GL_UNSIGNED_INT
+	GLenum indexType() const { return elementType; }
+
+	void setInstances(uint32_t mesh, const std::vector<MeshInstance>& instances);
+	std::size_t instanceCount(uint32_t mesh) const { return meshes[mesh].instances.size(); }
+
+	// Occlusion culling against the occluder instances, with a depth buffer of the given size
+	// and threadCount threads as for OcclusionBuffer::start(); 0 by 0 turns it off
+	void setOcclusionCulling(int width, int height, unsigned int threadCount = 0);
+	bool occlusionCulling() const { return occlusionEnabled; }
+
+	// Culls the instances against the view-projection's frustum and the occluders and builds
+	// the indirect commands, without uploading anything
+	void cull(const glm::mat4& viewProjection);
+	// cull(), then uploads the instances if they changed and queues one multi-draw for each
+	// pipeline with instances in view. pipelinePrograms[p] is the program of pipeline p.
+	void queueDraws(DrawQueue& queue, const GLuint* pipelinePrograms, const glm::mat4& viewProjection);
+
+	// Draw calls, indirect commands and instances kept or culled by the last cull()
+	std::size_t drawCalls() const { return lastDrawCalls; }
+	std::size_t commandCount() const { return commands.size(); }
+	std::size_t visibleCount() const { return visible.size(); }
+	std::size_t culledCount() const { return bvh.size() - visible.size(); }
+	std::size_t occludedCount() const { return lastOccluded; }
+	std::size_t triangleCount() const { return lastTriangles; }
+	// Instances of a mesh drawn at a level by the last cull()
+	std::size_t lodInstanceCount(uint32_t mesh, uint32_t level) const;
+	// Meshes, their levels of detail and what optimizing each level's geometry did
+	std::size_t meshCount() const { return meshes.size(); }
+	std::size_t lodCount(uint32_t mesh) const { return meshes[mesh].lods.size(); }
+	const MeshOptimizeStats& optimizeStats(uint32_t mesh, uint32_t level) const { return meshes[mesh].lods[level].optimized; }
+	// frustum culling and command building, and the occlusion pass, in milliseconds
+	double lastCullMs() const { return cullMs; }
+	double lastOcclusionMs() const { return occlusionMs; }
+	const OcclusionBuffer& occlusionBuffer() const { return occlusion; }
+
+	// Scene queries against the instances as of the last queueDraws()
+	// Nearest instance whose world box the ray enters within maxDistance, which is set to the entry distance
+	bool raycastBounds(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, InstanceRef& hit) const;
+	// Every instance whose world box overlaps the sphere
+	void instancesNear(const glm::vec3& center, float radius, std::vector<InstanceRef>& result) const;
+	// Nearest triangle of any instance the ray hits within maxDistance
+	bool pick(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, PickHit& hit) const;
+
+	const TriangleBvh& triangles(uint32_t mesh) const { return meshes[mesh].triangles; }
+
+	const Bvh& hierarchy() const { return bvh; }
+
+private:
+	// GL_DRAW_INDIRECT_BUFFER record
+	struct IndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	// One level of detail, level 0 being the mesh as added
+	struct Lod
+	{
+		GLuint firstIndex, indexCount;
+		GLint baseVertex;
+		GLuint vertexCount;
+		float maxScreenSize;
+		MeshOptimizeStats optimized;
+	};
+
+	struct Mesh
+	{
+		std::vector<Lod> lods;
+		uint32_t firstGroup;				// visible runs are grouped by mesh and level
+		uint32_t pipeline;
+		Aabb bounds;						// local space
+		TriangleBvh triangles;				// local space
+		std::vector<glm::vec3> positions;	// local space, for drawing occluders
+		std::vector<uint32_t> indices;
+		std::vector<MeshInstance> instances;
+		std::size_t firstInstance;			// in the instance buffer and the BVH
+		std::size_t uploadedCount;			// instances when the BVH was last built or refit
+	};
+
+	// Commands of one pipeline, contiguous in the indirect buffer
+	struct PipelineRange
+	{
+		GLintptr offset;
+		GLsizei count;
+		float nearest;						// view depth of the nearest visible instance
+	};
+
+	// Optimizes a copy of the geometry into meshVertices and meshIndices and appends it to the shared arrays
+	Lod appendGeometry(const GLfloat* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount,
+		std::vector<GLfloat>& meshVertices, std::vector<GLuint>& meshIndices);
+	void updateInstances();
+	void uploadInstances();
+	void selectLods(const glm::mat4& viewProjection);
+	InstanceRef instanceRef(uint32_t index) const;
+
+	std::vector<GLfloat> vertexData;
+	std::vector<GLuint> indexData;
+	std::vector<Mesh> meshes;
+	std::vector<PipelineRange> pipelines;
+
+	GLuint vao, vbo, ibo;
+	GLuint visibleVbo, instanceBuffer, indirectBuffer, meshDecodeBuffer;
+	std::size_t instanceCapacity, vertexBytes, indexBytes;
+	GLenum elementType;
+	bool packed;
+	bool dirty, uploadPending;
+
+	// world-space box, model matrix, material, mesh and occluder flag of every instance, in
+	// instance buffer order
+	std::vector<Aabb> instanceBounds;
+	std::vector<glm::mat4> instanceModels;
+	std::vector<GLuint> instanceMaterials;
+	std::vector<uint32_t> instanceMeshes;
+	std::vector<uint8_t> instanceOccluders;
+	std::vector<uint8_t> instanceLods;		// level drawn last frame, kept while the instances only move
+	Bvh bvh;
+	// rebuilt every frame
+	std::vector<uint32_t> visible, sortedVisible;
+	std::vector<std::size_t> groupVisibleStart, groupVisibleCount;
+	std::vector<float> groupNearest;
+	std::vector<uint64_t> depthKeys, depthScratch;		// top 16 view depth bits over instance index
+	std::vector<std::pair<uint32_t, uint32_t> > pipelineGroups;		// mesh and level
+	uint32_t groupCount;
+	std::vector<IndirectCommand> commands;
+
+	OcclusionBuffer occlusion;
+	bool occlusionEnabled;
+
+	std::size_t lastDrawCalls, lastOccluded, lastTriangles;
+	double cullMs, occlusionMs;
+};
+
+#endif // MESH_ARENA_H
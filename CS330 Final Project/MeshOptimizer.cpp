@@ -0,0 +1,254 @@
+/*
+	MeshOptimizer.cpp
+	Vertex welding, Tipsify triangle ordering, cluster sorting for overdraw and vertex fetch
+	renumbering.
+*/
+
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+namespace
+{
+	// position, normal and uv
+	const std::size_t FLOATS_PER_VERTEX = 8;
+	const GLuint NO_VERTEX = ~0u;
+
+	// Merges vertices whose 8 floats are bit for bit the same and rewrites the indices
+	void UWeldVertices(std::vector<GLfloat>& vertices, std::vector<GLuint>& indices)
+	{
+		const std::size_t vertexCount = vertices.size() / FLOATS_PER_VERTEX;
+		auto vertex = [&](GLuint v) { return &vertices[v * FLOATS_PER_VERTEX]; };
+
+		std::vector<GLuint> order(vertexCount);
+		for (GLuint v = 0; v < vertexCount; ++v)
+			order[v] = v;
+		std::sort(order.begin(), order.end(), [&](GLuint a, GLuint b) {
+			int compare = memcmp(vertex(a), vertex(b), FLOATS_PER_VERTEX * sizeof(GLfloat));
+			return compare < 0 || (compare == 0 && a < b);
+		});
+
+		// every vertex points at the first of its equals, which is kept
+		std::vector<GLuint> remap(vertexCount);
+		for (std::size_t i = 0; i < vertexCount; ++i)
+		{
+			bool same = i > 0 && memcmp(vertex(order[i]), vertex(order[i - 1]), FLOATS_PER_VERTEX * sizeof(GLfloat)) == 0;
+			remap[order[i]] = same ? remap[order[i - 1]] : order[i];
+		}
+		for (GLuint& index : indices)
+			index = remap[index];
+	}
+
+	// Tipsify: fans around one vertex at a time, moving on to the neighbour that is still in the
+	// cache and has the most triangles left, or back to a recent vertex when the fan dead-ends.
+	// clusterStarts gets the output triangle of every restart from outside the cache.
+	std::vector<GLuint> UTipsify(const std::vector<GLuint>& indices, std::size_t vertexCount, unsigned int cacheSize,
+		std::vector<std::size_t>& clusterStarts)
+	{
+		const std::size_t triangleCount = indices.size() / 3;
+
+		// triangles around each vertex, as offsets into one array
+		std::vector<std::size_t> adjacencyStart(vertexCount + 1, 0);
+		for (GLuint index : indices)
+			adjacencyStart[index + 1]++;
+		for (std::size_t v = 0; v < vertexCount; ++v)
+			adjacencyStart[v + 1] += adjacencyStart[v];
+		std::vector<GLuint> adjacency(indices.size());
+		std::vector<std::size_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for (std::size_t i = 0; i < indices.size(); ++i)
+			adjacency[fill[indices[i]]++] = (GLuint)(i / 3);
+
+		std::vector<int> liveTriangles(vertexCount);
+		for (std::size_t v = 0; v < vertexCount; ++v)
+			liveTriangles[v] = (int)(adjacencyStart[v + 1] - adjacencyStart[v]);
+
+		std::vector<unsigned int> cacheTime(vertexCount, 0);
+		std::vector<char> emitted(triangleCount, 0);
+		std::vector<GLuint> deadEnds, candidates, ordered;
+		ordered.reserve(indices.size());
+		clusterStarts.assign(1, 0);
+
+		unsigned int time = cacheSize + 1;
+		std::size_t cursor = 0;
+		GLuint fanning = indices.empty() ? NO_VERTEX : 0;
+		while (fanning != NO_VERTEX)
+		{
+			candidates.clear();
+			for (std::size_t a = adjacencyStart[fanning]; a < adjacencyStart[fanning + 1]; ++a)
+			{
+				GLuint triangle = adjacency[a];
+				if (emitted[triangle])
+					continue;
+				emitted[triangle] = 1;
+				for (int corner = 0; corner < 3; ++corner)
+				{
+					GLuint v = indices[triangle * 3 + corner];
+					ordered.push_back(v);
+					deadEnds.push_back(v);
+					candidates.push_back(v);
+					liveTriangles[v]--;
+					if (time - cacheTime[v] > cacheSize)
+						cacheTime[v] = time++;
+				}
+			}
+
+			// the candidate with live triangles that stays in the cache longest after its fan
+			GLuint next = NO_VERTEX;
+			int bestPriority = -1;
+			for (GLuint v : candidates)
+			{
+				if (liveTriangles[v] <= 0)
+					continue;
+				int priority = 0;
+				if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+					priority = (int)(time - cacheTime[v]);
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					next = v;
+				}
+			}
+
+			if (next == NO_VERTEX)
+			{
+				// dead end: the most recent vertex with triangles left, else the next one in input order
+				while (!deadEnds.empty() && next == NO_VERTEX)
+				{
+					GLuint v = deadEnds.back();
+					deadEnds.pop_back();
+					if (liveTriangles[v] > 0)
+						next = v;
+				}
+				while (next == NO_VERTEX && cursor < vertexCount)
+				{
+					if (liveTriangles[cursor] > 0)
+						next = (GLuint)cursor;
+					++cursor;
+				}
+				if (next != NO_VERTEX && time - cacheTime[next] > cacheSize && ordered.size() / 3 > clusterStarts.back())
+					clusterStarts.push_back(ordered.size() / 3);
+			}
+			fanning = next;
+		}
+		return ordered;
+	}
+
+	// Draws clusters that face away from the middle of the mesh first: on a convex-ish mesh
+	// they are the ones in front, so the clusters behind them fail the depth test instead of
+	// being shaded and then overwritten
+	void USortClustersForOverdraw(const std::vector<GLfloat>& vertices, std::vector<GLuint>& indices,
+		const std::vector<std::size_t>& clusterStarts)
+	{
+		const std::size_t triangleCount = indices.size() / 3;
+		if (clusterStarts.size() < 2)
+			return;
+
+		auto position = [&](GLuint v) {
+			const GLfloat* p = &vertices[v * FLOATS_PER_VERTEX];
+			return glm::vec3(p[0], p[1], p[2]);
+		};
+
+		// area weighted centroid and normal of every cluster, and of the whole mesh
+		std::vector<glm::vec3> clusterCentroid(clusterStarts.size(), glm::vec3(0.0f));
+		std::vector<glm::vec3> clusterNormal(clusterStarts.size(), glm::vec3(0.0f));
+		std::vector<float> clusterArea(clusterStarts.size(), 0.0f);
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (std::size_t cluster = 0; cluster < clusterStarts.size(); ++cluster)
+		{
+			std::size_t end = cluster + 1 < clusterStarts.size() ? clusterStarts[cluster + 1] : triangleCount;
+			for (std::size_t t = clusterStarts[cluster]; t < end; ++t)
+			{
+				glm::vec3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+				glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				float area = glm::length(normal);
+				clusterCentroid[cluster] += (p0 + p1 + p2) * (area / 3.0f);
+				clusterNormal[cluster] += normal;
+				clusterArea[cluster] += area;
+			}
+			meshCentroid += clusterCentroid[cluster];
+			meshArea += clusterArea[cluster];
+		}
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+
+		std::vector<float> outwards(clusterStarts.size(), 0.0f);
+		for (std::size_t cluster = 0; cluster < clusterStarts.size(); ++cluster)
+		{
+			float normalLength = glm::length(clusterNormal[cluster]);
+			if (clusterArea[cluster] > 0.0f && normalLength > 0.0f)
+				outwards[cluster] = glm::dot(clusterCentroid[cluster] / clusterArea[cluster] - meshCentroid, clusterNormal[cluster] / normalLength);
+		}
+
+		std::vector<std::size_t> order(clusterStarts.size());
+		for (std::size_t cluster = 0; cluster < order.size(); ++cluster)
+			order[cluster] = cluster;
+		std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return outwards[a] > outwards[b]; });
+
+		std::vector<GLuint> sorted;
+		sorted.reserve(indices.size());
+		for (std::size_t cluster : order)
+		{
+			std::size_t end = cluster + 1 < clusterStarts.size() ? clusterStarts[cluster + 1] : triangleCount;
+			sorted.insert(sorted.end(), indices.begin() + clusterStarts[cluster] * 3, indices.begin() + end * 3);
+		}
+		indices.swap(sorted);
+	}
+
+	// Renumbers vertices in the order the indices first use them, dropping unused ones
+	void UReorderVertexFetch(std::vector<GLfloat>& vertices, std::vector<GLuint>& indices)
+	{
+		std::vector<GLuint> remap(vertices.size() / FLOATS_PER_VERTEX, NO_VERTEX);
+		std::vector<GLfloat> reordered;
+		reordered.reserve(vertices.size());
+		GLuint used = 0;
+		for (GLuint& index : indices)
+		{
+			if (remap[index] == NO_VERTEX)
+			{
+				remap[index] = used++;
+				reordered.insert(reordered.end(), vertices.begin() + index * FLOATS_PER_VERTEX,
+					vertices.begin() + (index + 1) * FLOATS_PER_VERTEX);
+			}
+			index = remap[index];
+		}
+		vertices.swap(reordered);
+	}
+}
+
+MeshOptimizeStats UOptimizeMesh(std::vector<GLfloat>& vertices, std::vector<GLuint>& indices)
+{
+	MeshOptimizeStats stats;
+	stats.verticesBefore = vertices.size() / FLOATS_PER_VERTEX;
+	stats.acmrBefore = UComputeAcmr(indices.data(), indices.size(), stats.verticesBefore, VERTEX_CACHE_SIZE);
+
+	UWeldVertices(vertices, indices);
+	std::vector<std::size_t> clusterStarts;
+	indices = UTipsify(indices, stats.verticesBefore, VERTEX_CACHE_SIZE, clusterStarts);
+	USortClustersForOverdraw(vertices, indices, clusterStarts);
+	UReorderVertexFetch(vertices, indices);
+
+	stats.verticesAfter = vertices.size() / FLOATS_PER_VERTEX;
+	stats.acmrAfter = UComputeAcmr(indices.data(), indices.size(), stats.verticesAfter, VERTEX_CACHE_SIZE);
+	return stats;
+}
+
+float UComputeAcmr(const GLuint* indices, std::size_t indexCount, std::size_t vertexCount, unsigned int cacheSize)
+{
+	if (indexCount < 3)
+		return 0.0f;
+
+	// a vertex is in the cache while fewer than cacheSize misses came after its own
+	std::vector<std::size_t> missTime(vertexCount, 0);
+	std::size_t misses = 0;
+	for (std::size_t i = 0; i < indexCount; ++i)
+	{
+		std::size_t& loaded = missTime[indices[i]];
+		if (loaded == 0 || misses - loaded >= cacheSize)
+			loaded = ++misses;
+	}
+	return misses / (float)(indexCount / 3);
+}
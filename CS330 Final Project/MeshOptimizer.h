@@ -0,0 +1,39 @@
+/*
+	MeshOptimizer.h
+	Offline-style processing of interleaved meshes before they go into the arena: identical
+	vertices are welded into one, triangles are reordered with Tipsify (Sander, Nehab and
+	Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw") so the
+	post-transform vertex cache is reused, the clusters Tipsify leaves behind are sorted so
+	outward facing ones draw first, and vertices are renumbered in the order they are first
+	used so the vertex fetch walks the buffer forwards.
+
+	ACMR (average cache miss ratio) is the number of vertices the vertex shader runs per
+	triangle on a FIFO cache of VERTEX_CACHE_SIZE entries: 3 without any reuse, about 0.5 at
+	best on a large regular grid.
+*/
+
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Post-transform cache the orderings are tuned for and measured against
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct MeshOptimizeStats
+{
+	std::size_t verticesBefore, verticesAfter;
+	float acmrBefore, acmrAfter;
+};
+
+// Welds, reorders and renumbers a triangle list of position/normal/uv vertices, 8 floats each,
+// in place. Triangles keep their winding.
+MeshOptimizeStats UOptimizeMesh(std::vector<GLfloat>& vertices, std::vector<GLuint>& indices);
+
+// Vertices transformed per triangle on a FIFO cache of cacheSize entries
+float UComputeAcmr(const GLuint* indices, std::size_t indexCount, std::size_t vertexCount, unsigned int cacheSize);
+
+#endif // MESH_OPTIMIZER_H
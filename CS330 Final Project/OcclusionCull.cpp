@@ -0,0 +1,422 @@
+/*
+	OcclusionCull.cpp
+	Occluder clipping, the banded depth rasterizer, the depth pyramid and the box tests.
+*/
+
+#include "OcclusionCull.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_CULL_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// Triangles are clipped to the near plane and to a guard band this many times the screen,
+	// so edge functions stay within float precision whatever the occluder's size
+	const float GUARD_BAND = 2.0f;
+	const int CLIP_PLANE_COUNT = 5;
+	const glm::vec4 CLIP_PLANES[CLIP_PLANE_COUNT] = {
+		glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),			// near, z >= -w
+		glm::vec4(1.0f, 0.0f, 0.0f, GUARD_BAND),
+		glm::vec4(-1.0f, 0.0f, 0.0f, GUARD_BAND),
+		glm::vec4(0.0f, 1.0f, 0.0f, GUARD_BAND),
+		glm::vec4(0.0f, -1.0f, 0.0f, GUARD_BAND)
+	};
+	// beyond the far plane, rejected but never clipped
+	const uint32_t FAR_OUTCODE = 1u << CLIP_PLANE_COUNT;
+
+	// fewer boxes than this are tested on the calling thread alone
+	const std::size_t PARALLEL_TEST_MIN = 256;
+
+	uint32_t UOutcode(const glm::vec4& clip)
+	{
+		uint32_t code = 0;
+		for (int plane = 0; plane < CLIP_PLANE_COUNT; ++plane)
+		{
+			if (glm::dot(CLIP_PLANES[plane], clip) < 0.0f)
+				code |= 1u << plane;
+		}
+		if (clip.z > clip.w)
+			code |= FAR_OUTCODE;
+		return code;
+	}
+}
+
+OcclusionBuffer::OcclusionBuffer()
+	: viewProjection(1.0f), testBoxes(nullptr), testCandidates(nullptr), job(nullptr), jobSliceCount(1), jobGeneration(0),
+	  jobsRemaining(0), stopping(false)
+{
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+	stop();
+}
+
+void OcclusionBuffer::resize(int width, int height)
+{
+	width = std::max(4, (width + 3) & ~3);
+	height = std::max(1, height);
+
+	// each level halves the one before, rounding up, down to a single texel
+	levels.clear();
+	levelWidth.clear();
+	levelHeight.clear();
+	for (;;)
+	{
+		levels.push_back(std::vector<float>((std::size_t)width * height, 1.0f));
+		levelWidth.push_back(width);
+		levelHeight.push_back(height);
+		if (width == 1 && height == 1)
+			break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+}
+
+void OcclusionBuffer::start(unsigned int threadCount)
+{
+	stop();
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+	stopping = false;
+	for (unsigned int i = 0; i < threadCount; ++i)
+		workers.push_back(std::thread(&OcclusionBuffer::workerLoop, this, i + 1, jobGeneration));
+}
+
+void OcclusionBuffer::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+void OcclusionBuffer::begin(const glm::mat4& newViewProjection)
+{
+	viewProjection = newViewProjection;
+	triangles.clear();
+}
+
+void OcclusionBuffer::addOccluder(const glm::vec3* positions, const uint32_t* indices, std::size_t indexCount, const glm::mat4& model)
+{
+	glm::mat4 modelViewProjection = viewProjection * model;
+	for (std::size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		glm::vec4 corners[3];
+		uint32_t codes[3];
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			corners[corner] = modelViewProjection * glm::vec4(positions[indices[i + corner]], 1.0f);
+			codes[corner] = UOutcode(corners[corner]);
+		}
+
+		// all corners outside one plane
+		if (codes[0] & codes[1] & codes[2])
+			continue;
+		if (((codes[0] | codes[1] | codes[2]) & ~FAR_OUTCODE) == 0)
+		{
+			addClipped(corners, 3);
+			continue;
+		}
+
+		// Sutherland-Hodgman, every plane adds at most one corner
+		glm::vec4 polygon[3 + CLIP_PLANE_COUNT], clipped[3 + CLIP_PLANE_COUNT];
+		int count = 3;
+		std::copy(corners, corners + 3, polygon);
+		for (int plane = 0; plane < CLIP_PLANE_COUNT && count > 0; ++plane)
+		{
+			int clippedCount = 0;
+			for (int corner = 0; corner < count; ++corner)
+			{
+				const glm::vec4& a = polygon[corner];
+				const glm::vec4& b = polygon[(corner + 1) % count];
+				float da = glm::dot(CLIP_PLANES[plane], a), db = glm::dot(CLIP_PLANES[plane], b);
+				if (da >= 0.0f)
+					clipped[clippedCount++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					clipped[clippedCount++] = a + (b - a) * (da / (da - db));
+			}
+			count = clippedCount;
+			std::copy(clipped, clipped + count, polygon);
+		}
+		addClipped(polygon, count);
+	}
+}
+
+void OcclusionBuffer::addClipped(const glm::vec4* polygon, int count)
+{
+	const float w = (float)width(), h = (float)height();
+
+	// fan of the clipped polygon, every corner has w > 0 after the near plane
+	for (int corner = 2; corner < count; ++corner)
+	{
+		const glm::vec4* fan[3] = { &polygon[0], &polygon[corner - 1], &polygon[corner] };
+		ScreenTriangle triangle;
+		for (int i = 0; i < 3; ++i)
+		{
+			float inverseW = 1.0f / fan[i]->w;
+			triangle.x[i] = (fan[i]->x * inverseW * 0.5f + 0.5f) * w;
+			triangle.y[i] = (fan[i]->y * inverseW * 0.5f + 0.5f) * h;
+			triangle.z[i] = fan[i]->z * inverseW * 0.5f + 0.5f;
+		}
+		triangles.push_back(triangle);
+	}
+}
+
+void OcclusionBuffer::render()
+{
+	std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+	runParallel(&OcclusionBuffer::rasterizeSlice);
+	buildPyramid();
+}
+
+void OcclusionBuffer::rasterizeSlice(unsigned int slice, unsigned int sliceCount)
+{
+	// each thread owns a band of rows, so no two threads write the same pixel
+	int rowBegin = height() * (int)slice / (int)sliceCount;
+	int rowEnd = height() * (int)(slice + 1) / (int)sliceCount;
+	for (const ScreenTriangle& triangle : triangles)
+		rasterize(triangle, rowBegin, rowEnd);
+}
+
+void OcclusionBuffer::rasterize(const ScreenTriangle& triangle, int rowBegin, int rowEnd)
+{
+	float x0 = triangle.x[0], y0 = triangle.y[0];
+	float x1 = triangle.x[1], y1 = triangle.y[1];
+	float x2 = triangle.x[2], y2 = triangle.y[2];
+	float area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+	if (std::fabs(area) < 1.0e-6f)
+		return;
+
+	int minX = std::max(0, (int)std::floor(std::min(x0, std::min(x1, x2))));
+	int maxX = std::min(width() - 1, (int)std::floor(std::max(x0, std::max(x1, x2))));
+	int minY = std::max(rowBegin, (int)std::floor(std::min(y0, std::min(y1, y2))));
+	int maxY = std::min(rowEnd - 1, (int)std::floor(std::max(y0, std::max(y1, y2))));
+	if (minX > maxX || minY > maxY)
+		return;
+
+	// edge functions a * x + b * y + c, positive inside whichever way the triangle winds.
+	// Each is lowered by its largest change across half a pixel, so a pixel counts only
+	// when its whole square is inside.
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+	float xs[3] = { x0, x1, x2 }, ys[3] = { y0, y1, y2 };
+	float edgeA[3], edgeB[3], edgeC[3];
+	for (int edge = 0; edge < 3; ++edge)
+	{
+		int next = (edge + 1) % 3;
+		edgeA[edge] = -(ys[next] - ys[edge]) * sign;
+		edgeB[edge] = (xs[next] - xs[edge]) * sign;
+		edgeC[edge] = -(edgeA[edge] * xs[edge] + edgeB[edge] * ys[edge])
+			- 0.5f * (std::fabs(edgeA[edge]) + std::fabs(edgeB[edge]));
+	}
+
+	// depth plane, raised to the farthest depth inside the pixel and never past the farthest corner
+	float depthX = ((triangle.z[1] - triangle.z[0]) * (y2 - y0) - (triangle.z[2] - triangle.z[0]) * (y1 - y0)) / area;
+	float depthY = ((triangle.z[2] - triangle.z[0]) * (x1 - x0) - (triangle.z[1] - triangle.z[0]) * (x2 - x0)) / area;
+	float depthC = triangle.z[0] - depthX * x0 - depthY * y0 + 0.5f * (std::fabs(depthX) + std::fabs(depthY));
+	float depthMax = std::max(triangle.z[0], std::max(triangle.z[1], triangle.z[2]));
+
+	// rows start on a multiple of 4 so the SSE2 path stores aligned groups; pixels left of the
+	// box are outside an edge and stay untouched
+	minX &= ~3;
+	const int rowWidth = width();
+	for (int y = minY; y <= maxY; ++y)
+	{
+		float* row = &levels[0][(std::size_t)y * rowWidth];
+		float py = y + 0.5f;
+		int x = minX;
+
+#if defined(OCCLUSION_CULL_SSE2)
+		const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 farthest = _mm_set1_ps(depthMax);
+		__m128 a0 = _mm_set1_ps(edgeA[0]), a1 = _mm_set1_ps(edgeA[1]), a2 = _mm_set1_ps(edgeA[2]);
+		__m128 c0 = _mm_set1_ps(edgeB[0] * py + edgeC[0]);
+		__m128 c1 = _mm_set1_ps(edgeB[1] * py + edgeC[1]);
+		__m128 c2 = _mm_set1_ps(edgeB[2] * py + edgeC[2]);
+		__m128 dx = _mm_set1_ps(depthX), dc = _mm_set1_ps(depthY * py + depthC);
+		for (; x <= maxX; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), c0), zero),
+				_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), c1), zero),
+					_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), c2), zero)));
+			if (!_mm_movemask_ps(inside))
+				continue;
+
+			__m128 depth = _mm_min_ps(_mm_add_ps(_mm_mul_ps(dx, px), dc), farthest);
+			__m128 current = _mm_loadu_ps(row + x);
+			__m128 written = _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(current, depth)), _mm_andnot_ps(inside, current));
+			_mm_storeu_ps(row + x, written);
+		}
+#else
+		for (; x <= maxX; ++x)
+		{
+			float px = x + 0.5f;
+			if (edgeA[0] * px + edgeB[0] * py + edgeC[0] < 0.0f ||
+				edgeA[1] * px + edgeB[1] * py + edgeC[1] < 0.0f ||
+				edgeA[2] * px + edgeB[2] * py + edgeC[2] < 0.0f)
+				continue;
+			float depth = std::min(depthX * px + depthY * py + depthC, depthMax);
+			row[x] = std::min(row[x], depth);
+		}
+#endif
+	}
+}
+
+void OcclusionBuffer::buildPyramid()
+{
+	// a texel keeps the farthest of the up to 2x2 texels below it
+	for (std::size_t level = 1; level < levels.size(); ++level)
+	{
+		const std::vector<float>& below = levels[level - 1];
+		int belowWidth = levelWidth[level - 1], belowHeight = levelHeight[level - 1];
+		std::vector<float>& texels = levels[level];
+		for (int y = 0; y < levelHeight[level]; ++y)
+		{
+			const float* row0 = &below[(std::size_t)(2 * y) * belowWidth];
+			const float* row1 = &below[(std::size_t)std::min(2 * y + 1, belowHeight - 1) * belowWidth];
+			float* out = &texels[(std::size_t)y * levelWidth[level]];
+			for (int x = 0; x < levelWidth[level]; ++x)
+			{
+				int left = 2 * x, right = std::min(2 * x + 1, belowWidth - 1);
+				out[x] = std::max(std::max(row0[left], row0[right]), std::max(row1[left], row1[right]));
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::testBox(const Aabb& box) const
+{
+	glm::vec2 screenMin(0.0f), screenMax(0.0f);
+	float nearest = 1.0f;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		glm::vec3 position((corner & 1) ? box.boundsMax.x : box.boundsMin.x,
+			(corner & 2) ? box.boundsMax.y : box.boundsMin.y,
+			(corner & 4) ? box.boundsMax.z : box.boundsMin.z);
+		glm::vec4 clip = viewProjection * glm::vec4(position, 1.0f);
+		// a corner in front of the near plane has no place on screen
+		if (clip.z < -clip.w || clip.w <= 0.0f)
+			return true;
+
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		glm::vec2 screen = glm::vec2(ndc) * 0.5f + 0.5f;
+		screenMin = corner ? glm::min(screenMin, screen) : screen;
+		screenMax = corner ? glm::max(screenMax, screen) : screen;
+		nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+
+	float w = (float)width(), h = (float)height();
+	if (screenMax.x < 0.0f || screenMax.y < 0.0f || screenMin.x >= 1.0f || screenMin.y >= 1.0f)
+		return false;
+	int x0 = std::max(0, (int)(screenMin.x * w)), x1 = std::min(width() - 1, (int)(screenMax.x * w));
+	int y0 = std::max(0, (int)(screenMin.y * h)), y1 = std::min(height() - 1, (int)(screenMax.y * h));
+
+	// coarsest level where the rectangle touches at most 2x2 texels
+	int level = 0;
+	while (level + 1 < levelCount() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		++level;
+
+	for (int y = y0 >> level; y <= y1 >> level; ++y)
+	{
+		for (int x = x0 >> level; x <= x1 >> level; ++x)
+		{
+			if (nearest <= depth(level, x, y))
+				return true;
+		}
+	}
+	return false;
+}
+
+void OcclusionBuffer::cullOccluded(const std::vector<Aabb>& boxes, const std::vector<uint8_t>& skip, std::vector<uint32_t>& candidates)
+{
+	testBoxes = &boxes;
+	testCandidates = &candidates;
+	candidateVisible.resize(candidates.size());
+	if (candidates.size() < PARALLEL_TEST_MIN)
+		testSlice(0, 1);
+	else
+		runParallel(&OcclusionBuffer::testSlice);
+
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < candidates.size(); ++i)
+	{
+		if (skip[candidates[i]] || candidateVisible[i])
+			candidates[kept++] = candidates[i];
+	}
+	candidates.resize(kept);
+}
+
+void OcclusionBuffer::testSlice(unsigned int slice, unsigned int sliceCount)
+{
+	std::size_t count = testCandidates->size();
+	std::size_t first = count * slice / sliceCount, last = count * (slice + 1) / sliceCount;
+	for (std::size_t i = first; i < last; ++i)
+		candidateVisible[i] = testBox((*testBoxes)[(*testCandidates)[i]]);
+}
+
+void OcclusionBuffer::runParallel(SliceJob newJob)
+{
+	if (workers.empty())
+	{
+		(this->*newJob)(0, 1);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		job = newJob;
+		jobSliceCount = threadCount();
+		jobsRemaining = (unsigned int)workers.size();
+		jobGeneration++;
+	}
+	jobReady.notify_all();
+
+	// the calling thread takes slice 0
+	(this->*newJob)(0, threadCount());
+
+	std::unique_lock<std::mutex> lock(jobMutex);
+	jobDone.wait(lock, [this] { return jobsRemaining == 0; });
+}
+
+void OcclusionBuffer::workerLoop(unsigned int slice, uint64_t seenGeneration)
+{
+	// seenGeneration is the job count when the pool started, a worker that is slow to start
+	// still runs every job after it
+	for (;;)
+	{
+		SliceJob current;
+		unsigned int sliceCount;
+		{
+			std::unique_lock<std::mutex> lock(jobMutex);
+			jobReady.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+			if (stopping)
+				return;
+			seenGeneration = jobGeneration;
+			current = job;
+			sliceCount = jobSliceCount;
+		}
+
+		(this->*current)(slice, sliceCount);
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			last = --jobsRemaining == 0;
+		}
+		if (last)
+			jobDone.notify_one();
+	}
+}
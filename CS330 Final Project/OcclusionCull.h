@@ -0,0 +1,107 @@
+/*
+	OcclusionCull.h
+	Software occlusion culling against a few large occluders (the table top, the book). The
+	occluders are rasterized on the CPU into a small depth buffer, a hierarchical-Z pyramid of
+	farthest depths is built from it, and each world-space box is tested at the pyramid level
+	where its screen rectangle covers at most 2x2 texels. Nothing here calls OpenGL, so culling
+	rates can be checked in headless tests on machines without a GPU.
+
+	The depth buffer is split into horizontal bands, rasterized in parallel by a pool of worker
+	threads and the calling thread, 4 pixels at a time with SSE2 when the compiler targets it
+	and one at a time otherwise. Box tests are split between the same threads.
+
+	Culling errs on the side of drawing: an occluder only writes pixels it covers entirely, at
+	the farthest depth it reaches inside the pixel, a box is compared with its nearest depth,
+	and boxes crossing the near plane are always visible.
+*/
+
+#ifndef OCCLUSION_CULL_H
+#define OCCLUSION_CULL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "FrustumCull.h"
+
+class OcclusionBuffer
+{
+public:
+	OcclusionBuffer();
+	~OcclusionBuffer();
+
+	// Depth buffer size in pixels, the width is rounded up to a multiple of 4
+	void resize(int width, int height);
+	int width() const { return levelWidth.empty() ? 0 : levelWidth[0]; }
+	int height() const { return levelHeight.empty() ? 0 : levelHeight[0]; }
+
+	// Starts the worker threads, 0 picks one less than the number of hardware threads
+	void start(unsigned int threadCount = 0);
+	void stop();
+	// Threads sharing the work, the caller included
+	unsigned int threadCount() const { return (unsigned int)workers.size() + 1; }
+
+	// Forgets the last frame's occluders; the next ones are drawn as seen through viewProjection
+	void begin(const glm::mat4& viewProjection);
+	// Queues the triangles of one occluder, positions in model space
+	void addOccluder(const glm::vec3* positions, const uint32_t* indices, std::size_t indexCount, const glm::mat4& model);
+	// Rasterizes the queued occluders and builds the pyramid
+	void render();
+
+	// Triangles queued since begin(), after clipping
+	std::size_t triangleCount() const { return triangles.size(); }
+
+	// False when the box is entirely behind the occluders or off screen
+	bool testBox(const Aabb& box) const;
+	// Removes the indices of hidden boxes from candidates, keeping the order of the rest.
+	// Candidates with skip[index] set are kept without a test.
+	void cullOccluded(const std::vector<Aabb>& boxes, const std::vector<uint8_t>& skip, std::vector<uint32_t>& candidates);
+
+	// Farthest depth in [0, 1] of a texel of a pyramid level, 0 being the full resolution buffer
+	int levelCount() const { return (int)levels.size(); }
+	float depth(int level, int x, int y) const { return levels[level][y * levelWidth[level] + x]; }
+
+private:
+	// Clipped triangle in pixels (y up), depth in [0, 1]
+	struct ScreenTriangle
+	{
+		float x[3], y[3], z[3];
+	};
+
+	typedef void (OcclusionBuffer::*SliceJob)(unsigned int slice, unsigned int sliceCount);
+
+	void addClipped(const glm::vec4* polygon, int count);
+	void rasterizeSlice(unsigned int slice, unsigned int sliceCount);
+	void rasterize(const ScreenTriangle& triangle, int rowBegin, int rowEnd);
+	void testSlice(unsigned int slice, unsigned int sliceCount);
+	void buildPyramid();
+
+	// Runs job on every thread with its own slice, returns when all are done
+	void runParallel(SliceJob job);
+	void workerLoop(unsigned int slice, uint64_t seenGeneration);
+
+	glm::mat4 viewProjection;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<std::vector<float> > levels;
+	std::vector<int> levelWidth, levelHeight;
+
+	// arguments of the box tests being run by testSlice()
+	const std::vector<Aabb>* testBoxes;
+	const std::vector<uint32_t>* testCandidates;
+	std::vector<uint8_t> candidateVisible;
+
+	std::vector<std::thread> workers;
+	std::mutex jobMutex;
+	std::condition_variable jobReady, jobDone;
+	SliceJob job;
+	unsigned int jobSliceCount;
+	uint64_t jobGeneration;
+	unsigned int jobsRemaining;
+	bool stopping;
+};
+
+#endif // OCCLUSION_CULL_H
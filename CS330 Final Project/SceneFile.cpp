@@ -0,0 +1,345 @@
+/*
+	SceneFile.cpp
+	Scene text compiler and mapped binary reader.
+*/
+
+#include "SceneFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include "TextureCache.h"
+
+namespace
+{
+	const char SCENE_MAGIC[8] = { 'U', 'S', 'C', 'E', 'N', 'E', '\0', '\0' };
+	const uint32_t SCENE_VERSION = 3;
+
+	const char* const MESH_NAMES[SCENE_MESH_COUNT] = { "plane", "bookBox", "cubeBox", "taperedCylinder", "cylinder" };
+
+	bool UReadText(const std::string& path, std::string& contents)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary);
+		if (!file)
+			return false;
+		contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return true;
+	}
+
+	bool USceneError(const std::string& path, int lineNumber, const std::string& message)
+	{
+		std::cout << "Scene " << path << ":" << lineNumber << ": " << message << std::endl;
+		return false;
+	}
+
+	// Reads the rest of a node or instance line: transforms multiplied left to right, a parent
+	// node, and for instances their flags. An empty error means the line was fine.
+	std::string UParseTransforms(std::istringstream& tokens, const std::vector<std::string>& nodeNames, bool isInstance,
+		glm::mat4& model, uint32_t& parent, uint32_t& flags)
+	{
+		model = glm::mat4(1.0f);
+		parent = SCENE_NO_PARENT;
+		flags = 0;
+
+		std::string op;
+		while (tokens >> op)
+		{
+			if (op == "occluder" && isInstance)
+			{
+				flags |= SCENE_INSTANCE_OCCLUDER;
+				continue;
+			}
+			if (op == "parent")
+			{
+				// parents are defined first, so nodes stay in update order
+				std::string name;
+				if (!(tokens >> name))
+					return "parent needs a node name";
+				for (uint32_t node = 0; node < nodeNames.size(); ++node)
+					if (nodeNames[node] == name)
+						parent = node;
+				if (parent == SCENE_NO_PARENT)
+					return "unknown node " + name + ", nodes must come before what they parent";
+				continue;
+			}
+
+			float angle = 0.0f;
+			glm::vec3 v;
+			if (op == "rotate" && !(tokens >> angle))
+				return "rotate needs an angle in radians and an axis";
+			if (!(tokens >> v.x >> v.y >> v.z))
+				return op + " needs three numbers";
+
+			if (op == "translate")
+				model = model * glm::translate(v);
+			else if (op == "rotate")
+				model = model * glm::rotate(angle, v);
+			else if (op == "scale")
+				model = model * glm::scale(v);
+			else
+				return "unknown transform " + op;
+		}
+		return std::string();
+	}
+}
+
+const char* USceneMeshName(uint32_t mesh)
+{
+	return mesh < SCENE_MESH_COUNT ? MESH_NAMES[mesh] : "unknown";
+}
+
+SceneFile::SceneFile()
+	: header(nullptr), textures(nullptr), lights(nullptr), nodes(nullptr), instances(nullptr), strings(nullptr)
+{
+}
+
+bool SceneFile::load(const std::string& textPath, const std::string& binaryPath)
+{
+	std::string text;
+	if (!UReadText(textPath, text))
+	{
+		// shipped without the authoring form, the binary is all there is
+		if (map(binaryPath))
+			return true;
+		std::cout << "Failed to load scene " << binaryPath << std::endl;
+		return false;
+	}
+
+	if (map(binaryPath) && header->sourceHash == UHashBytes(text.data(), text.size()))
+		return true;
+
+	close();
+	if (!UCompileScene(textPath, binaryPath))
+		return false;
+	std::cout << "INFO: Compiled scene " << textPath << std::endl;
+
+	if (!map(binaryPath))
+	{
+		std::cout << "Failed to load scene " << binaryPath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void SceneFile::close()
+{
+	file.close();
+	header = nullptr;
+	textures = nullptr;
+	lights = nullptr;
+	nodes = nullptr;
+	instances = nullptr;
+	strings = nullptr;
+}
+
+bool SceneFile::map(const std::string& binaryPath)
+{
+	close();
+	if (!file.open(binaryPath.c_str()))
+		return false;
+
+	const unsigned char* data = file.data();
+	const SceneFileHeader* mappedHeader = (const SceneFileHeader*)data;
+	if (file.size() < sizeof(SceneFileHeader) || memcmp(mappedHeader->magic, SCENE_MAGIC, sizeof(SCENE_MAGIC)) != 0 ||
+		mappedHeader->version != SCENE_VERSION)
+	{
+		close();
+		return false;
+	}
+
+	std::size_t texturesAt = sizeof(SceneFileHeader);
+	std::size_t lightsAt = texturesAt + mappedHeader->textureCount * sizeof(SceneTexture);
+	std::size_t nodesAt = lightsAt + mappedHeader->lightCount * sizeof(SceneLight);
+	std::size_t instancesAt = nodesAt + mappedHeader->nodeCount * sizeof(SceneNode);
+	std::size_t stringsAt = instancesAt + mappedHeader->instanceCount * sizeof(SceneInstance);
+	if (stringsAt + mappedHeader->stringBytes > file.size() ||
+		(mappedHeader->stringBytes > 0 && data[stringsAt + mappedHeader->stringBytes - 1] != '\0'))
+	{
+		close();
+		return false;
+	}
+
+	header = mappedHeader;
+	textures = (const SceneTexture*)(data + texturesAt);
+	lights = (const SceneLight*)(data + lightsAt);
+	nodes = (const SceneNode*)(data + nodesAt);
+	instances = (const SceneInstance*)(data + instancesAt);
+	strings = (const char*)(data + stringsAt);
+
+	for (uint32_t i = 0; i < header->textureCount; ++i)
+	{
+		if (textures[i].pathOffset >= header->stringBytes || textures[i].unit >= SCENE_TEXTURE_UNITS)
+		{
+			close();
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->nodeCount; ++i)
+	{
+		if (nodes[i].parent != SCENE_NO_PARENT && nodes[i].parent >= i)
+		{
+			close();
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->instanceCount; ++i)
+	{
+		// the same limits the compiler enforces, a stale or edited file must not index past them
+		if ((instances[i].parent != SCENE_NO_PARENT && instances[i].parent >= header->nodeCount) ||
+			instances[i].mesh >= SCENE_MESH_COUNT || instances[i].material >= SCENE_TEXTURE_UNITS)
+		{
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool UCompileScene(const std::string& textPath, const std::string& binaryPath)
+{
+	std::string text;
+	if (!UReadText(textPath, text))
+	{
+		std::cout << "Failed to open scene " << textPath << std::endl;
+		return false;
+	}
+
+	std::vector<SceneTexture> textures;
+	std::vector<SceneLight> lights;
+	std::vector<SceneNode> nodes;
+	std::vector<std::string> nodeNames;
+	std::vector<SceneInstance> instances;
+	std::string strings;
+
+	std::istringstream lines(text);
+	std::string line;
+	for (int lineNumber = 1; std::getline(lines, line); ++lineNumber)
+	{
+		std::size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream tokens(line);
+		std::string keyword;
+		if (!(tokens >> keyword))
+			continue;
+
+		if (keyword == "texture")
+		{
+			// texture <unit> <path to end of line>
+			SceneTexture texture;
+			std::string path;
+			if (!(tokens >> texture.unit) || texture.unit >= SCENE_TEXTURE_UNITS)
+				return USceneError(textPath, lineNumber, "texture unit must be 0-" + std::to_string(SCENE_TEXTURE_UNITS - 1));
+			std::getline(tokens >> std::ws, path);
+			while (!path.empty() && (path.back() == '\r' || path.back() == ' ' || path.back() == '\t'))
+				path.pop_back();
+			if (path.empty())
+				return USceneError(textPath, lineNumber, "texture needs a file path");
+
+			texture.pathOffset = (uint32_t)strings.size();
+			strings += path;
+			strings += '\0';
+			textures.push_back(texture);
+		}
+		else if (keyword == "light")
+		{
+			// light <r g b> <x y z>
+			SceneLight light;
+			if (!(tokens >> light.color[0] >> light.color[1] >> light.color[2] >> light.position[0] >> light.position[1] >> light.position[2]))
+				return USceneError(textPath, lineNumber, "light needs a color and a position");
+			lights.push_back(light);
+		}
+		else if (keyword == "node")
+		{
+			// node <name> followed by transforms and its parent
+			std::string name;
+			if (!(tokens >> name))
+				return USceneError(textPath, lineNumber, "node needs a name");
+			for (const std::string& existing : nodeNames)
+				if (existing == name)
+					return USceneError(textPath, lineNumber, "node " + name + " is already defined");
+
+			SceneNode node;
+			glm::mat4 local;
+			uint32_t flags;
+			std::string error = UParseTransforms(tokens, nodeNames, false, local, node.parent, flags);
+			if (!error.empty())
+				return USceneError(textPath, lineNumber, error);
+			memcpy(node.local, &local[0][0], sizeof(node.local));
+			nodes.push_back(node);
+			nodeNames.push_back(name);
+		}
+		else if (keyword == "instance")
+		{
+			// instance <mesh> <texture unit> followed by transforms, its parent and flags
+			std::string meshName;
+			SceneInstance instance;
+			if (!(tokens >> meshName >> instance.material))
+				return USceneError(textPath, lineNumber, "instance needs a mesh and a texture unit");
+			if (instance.material >= SCENE_TEXTURE_UNITS)
+				return USceneError(textPath, lineNumber, "texture unit must be 0-" + std::to_string(SCENE_TEXTURE_UNITS - 1));
+
+			instance.mesh = SCENE_MESH_COUNT;
+			for (uint32_t mesh = 0; mesh < SCENE_MESH_COUNT; ++mesh)
+				if (meshName == MESH_NAMES[mesh])
+					instance.mesh = mesh;
+			if (instance.mesh == SCENE_MESH_COUNT)
+				return USceneError(textPath, lineNumber, "unknown mesh " + meshName);
+
+			glm::mat4 model;
+			std::string error = UParseTransforms(tokens, nodeNames, true, model, instance.parent, instance.flags);
+			if (!error.empty())
+				return USceneError(textPath, lineNumber, error);
+			memcpy(instance.model, &model[0][0], sizeof(instance.model));
+			instances.push_back(instance);
+		}
+		else
+		{
+			return USceneError(textPath, lineNumber, "unknown keyword " + keyword);
+		}
+	}
+
+	SceneFileHeader header;
+	memcpy(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC));
+	header.version = SCENE_VERSION;
+	header.textureCount = (uint32_t)textures.size();
+	header.lightCount = (uint32_t)lights.size();
+	header.instanceCount = (uint32_t)instances.size();
+	header.stringBytes = (uint32_t)strings.size();
+	header.nodeCount = (uint32_t)nodes.size();
+	header.sourceHash = UHashBytes(text.data(), text.size());
+
+	// temporary name and rename, a half written scene would otherwise be mapped next run
+	std::string temporaryPath = binaryPath + ".tmp";
+	std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "Failed to write scene " << binaryPath << std::endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)textures.data(), textures.size() * sizeof(SceneTexture));
+	file.write((const char*)lights.data(), lights.size() * sizeof(SceneLight));
+	file.write((const char*)nodes.data(), nodes.size() * sizeof(SceneNode));
+	file.write((const char*)instances.data(), instances.size() * sizeof(SceneInstance));
+	file.write(strings.data(), strings.size());
+	file.close();
+
+	remove(binaryPath.c_str());
+	if (file.fail() || rename(temporaryPath.c_str(), binaryPath.c_str()) != 0)
+	{
+		remove(temporaryPath.c_str());
+		std::cout << "Failed to write scene " << binaryPath << std::endl;
+		return false;
+	}
+	return true;
+}
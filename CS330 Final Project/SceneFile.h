@@ -0,0 +1,123 @@
+/*
+	SceneFile.h
+	Scene description: textures, point lights, transform nodes and mesh instances. Scenes are authored as text
+	(see Resources/Scenes/table.scene) and compiled to a flat binary that is memory mapped and
+	read in place. load() recompiles the binary whenever it is missing or was built from a
+	different version of the text, so editing the text never needs a rebuild.
+
+	Binary layout (little endian):
+		SceneFileHeader
+		SceneTexture[textureCount]
+		SceneLight[lightCount]
+		SceneNode[nodeCount]				every node after its parent
+		SceneInstance[instanceCount]
+		char strings[stringBytes]			zero terminated texture paths
+*/
+
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <cstdint>
+#include <string>
+
+#include "MappedFile.h"
+
+// Unit meshes an instance can reference, names as written in the text form
+enum SceneMesh
+{
+	SCENE_MESH_PLANE,				// plane
+	SCENE_MESH_BOOK_BOX,			// bookBox
+	SCENE_MESH_CUBE_BOX,			// cubeBox
+	SCENE_MESH_TAPERED_CYLINDER,	// taperedCylinder
+	SCENE_MESH_CYLINDER,			// cylinder
+	SCENE_MESH_COUNT
+};
+
+// Name of a SceneMesh as written in the text form
+const char* USceneMeshName(uint32_t mesh);
+
+// Texture units available to scene materials
+const uint32_t SCENE_TEXTURE_UNITS = 5;
+
+struct SceneFileHeader
+{
+	char magic[8];				// "USCENE\0\0"
+	uint32_t version;
+	uint32_t textureCount;
+	uint32_t lightCount;
+	uint32_t instanceCount;
+	uint32_t stringBytes;
+	uint32_t nodeCount;
+	uint64_t sourceHash;		// hash of the text the binary was compiled from
+};
+
+struct SceneTexture
+{
+	uint32_t unit;
+	uint32_t pathOffset;		// into the string table
+};
+
+struct SceneLight
+{
+	float color[3];
+	float position[3];
+};
+
+// parent of nodes and instances placed directly in the world
+const uint32_t SCENE_NO_PARENT = ~0u;
+
+// A transform the nodes and instances under it follow, e.g. the perfume bottle its cap sits on
+struct SceneNode
+{
+	uint32_t parent;			// earlier node or SCENE_NO_PARENT
+	float local[16];			// relative to the parent, column major
+};
+
+// SceneInstance flags
+const uint32_t SCENE_INSTANCE_OCCLUDER = 1;		// hides what is behind it from occlusion culling
+
+struct SceneInstance
+{
+	uint32_t mesh;				// SceneMesh
+	uint32_t material;			// texture unit
+	uint32_t flags;				// SCENE_INSTANCE_*
+	uint32_t parent;			// node or SCENE_NO_PARENT
+	float model[16];			// relative to the parent, column major
+};
+
+class SceneFile
+{
+public:
+	SceneFile();
+
+	// Maps binaryPath, compiling textPath into it first when the binary is missing or stale
+	bool load(const std::string& textPath, const std::string& binaryPath);
+	void close();
+
+	uint32_t textureCount() const { return header ? header->textureCount : 0; }
+	uint32_t lightCount() const { return header ? header->lightCount : 0; }
+	uint32_t nodeCount() const { return header ? header->nodeCount : 0; }
+	uint32_t instanceCount() const { return header ? header->instanceCount : 0; }
+
+	const SceneTexture& texture(uint32_t i) const { return textures[i]; }
+	const char* texturePath(uint32_t i) const { return strings + textures[i].pathOffset; }
+	const SceneLight& light(uint32_t i) const { return lights[i]; }
+	const SceneNode& node(uint32_t i) const { return nodes[i]; }
+	const SceneInstance& instance(uint32_t i) const { return instances[i]; }
+
+private:
+	bool map(const std::string& binaryPath);
+
+	MappedFile file;
+	const SceneFileHeader* header;
+	const SceneTexture* textures;
+	const SceneLight* lights;
+	const SceneNode* nodes;
+	const SceneInstance* instances;
+	const char* strings;
+};
+
+// Parses the text form and writes the binary form, reporting errors with their line number
+bool UCompileScene(const std::string& textPath, const std::string& binaryPath);
+
+#endif // SCENE_FILE_H
@@ -0,0 +1,70 @@
+/*
+	ShaderBlocks.h
+	CPU mirrors of the uniform block and shader storage layouts shared by every object
+	shader program. Every member is a vec4/mat4 (or packed into one) so the C++ layout
+	matches std140/std430 without manual padding. Binding points are fixed in the GLSL
+	with layout(binding = N).
+*/
+
+#ifndef SHADER_BLOCKS_H
+#define SHADER_BLOCKS_H
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+// uniform block binding points
+const unsigned int FRAME_BLOCK_BINDING = 0;
+
+// shader storage binding points, see ClusteredLights.h
+const unsigned int LIGHT_BUFFER_BINDING = 2;
+const unsigned int CLUSTER_GRID_BINDING = 3;
+const unsigned int CLUSTER_INDEX_BINDING = 4;
+// bindless sampler handle of each material, see MaterialLibrary.h
+const unsigned int MATERIAL_HANDLE_BINDING = 5;
+// model matrix and material of every drawn instance, see MeshArena.h
+const unsigned int INSTANCE_BUFFER_BINDING = 6;
+// packed vertex position box of every mesh, see VertexFormat.h
+const unsigned int MESH_DECODE_BINDING = 7;
+
+// layout(std140, binding = 0) uniform FrameBlock
+struct FrameBlock
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 viewPosition;		// xyz = camera position
+	glm::vec4 clusterParams;	// x = depth slice scale, y = depth slice bias, z/w = tile size in pixels
+	glm::uvec4 clusterDims;		// xyz = cluster grid size
+};
+
+// one element of the LightBuffer shader storage block
+struct PointLight
+{
+	glm::vec4 position;			// xyz
+	glm::vec4 ambient;			// rgb
+	glm::vec4 diffuse;			// rgb
+	glm::vec4 specular;			// rgb
+	glm::vec4 attenuation;		// x = constant, y = linear, z = quadratic, w = range used for clustering
+};
+
+// one element of the InstanceBuffer shader storage block
+struct InstanceData
+{
+	glm::mat4 model;
+	glm::vec4 normalMatrix[3];	// columns of the inverse transpose of the model's upper 3x3, as a std430 mat3
+	glm::uvec4 material;		// x = MaterialLibrary layer or handle index, y = arena mesh
+};
+
+// one element of the MeshDecodeBuffer shader storage block
+struct MeshDecode
+{
+	glm::vec4 positionScale;	// xyz = size of the mesh's bounding box
+	glm::vec4 positionOffset;	// xyz = its minimum corner
+};
+
+static_assert(sizeof(FrameBlock) == 176, "FrameBlock must match the std140 layout");
+static_assert(sizeof(PointLight) == 80, "PointLight must match the std430 layout");
+static_assert(sizeof(InstanceData) == 128, "InstanceData must match the std430 layout");
+static_assert(sizeof(MeshDecode) == 32, "MeshDecode must match the std430 layout");
+
+#endif // SHADER_BLOCKS_H
@@ -0,0 +1,420 @@
+/*
+	ShaderRegistry.cpp
+	Program deduplication, the compile and link steps polled across frames and the program binary
+	cache.
+*/
+
+#include "ShaderRegistry.h"
+
+#include "MappedFile.h"
+#include "TextureCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	const char PROGRAM_CACHE_MAGIC[8] = { 'U', 'P', 'R', 'O', 'G', 'B', 'I', 'N' };
+	const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+	std::string UProgramCachePath(const std::string& cacheDirectory, uint64_t sourceHash)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.uprog", (unsigned long long)sourceHash);
+		return cacheDirectory + name;
+	}
+
+	const char* UStageName(GLenum stage)
+	{
+		return stage == GL_VERTEX_SHADER ? "VERTEX" : stage == GL_FRAGMENT_SHADER ? "FRAGMENT" : "UNKNOWN";
+	}
+}
+
+ShaderRegistry::ShaderRegistry()
+	: parallel(false), driver(0), driverKnown(false), compiled(0), cacheHits(0), shared(0)
+{
+}
+
+bool ShaderRegistry::enableParallelCompile()
+{
+	// 0xFFFFFFFF lets the driver pick how many threads to use
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	else
+		return false;
+
+	parallel = true;
+	return true;
+}
+
+GLuint ShaderRegistry::request(const ShaderStageSource* stages, std::size_t stageCount)
+{
+	// the stage enums are part of the key, the same text can't be both a vertex and a fragment shader
+	uint64_t sourceHash = UHashBytes(&stageCount, sizeof(stageCount));
+	for (std::size_t i = 0; i < stageCount; ++i)
+	{
+		sourceHash = UHashBytes(&stages[i].stage, sizeof(stages[i].stage), sourceHash);
+		sourceHash = UHashBytes(stages[i].source, strlen(stages[i].source), sourceHash);
+	}
+
+	for (Entry& entry : entries)
+	{
+		if (entry.sourceHash == sourceHash)
+		{
+			++entry.references;
+			++shared;
+			return entry.program;
+		}
+	}
+
+	Entry entry;
+	entry.sourceHash = sourceHash;
+	entry.program = glCreateProgram();
+	entry.references = 1;
+	for (std::size_t i = 0; i < stageCount; ++i)
+		entry.sources.push_back(std::make_pair(stages[i].stage, std::string(stages[i].source)));
+
+	if (loadBinary(entry))
+		entry.state = STATE_LOADING_BINARY;
+	else
+		beginCompile(entry);
+
+	entries.push_back(entry);
+	return entry.program;
+}
+
+GLuint ShaderRegistry::acquire(const ShaderStageSource* stages, std::size_t stageCount)
+{
+	GLuint program = request(stages, stageCount);
+	Entry* entry = find(program);
+	while (entry->state != STATE_READY && entry->state != STATE_FAILED)
+		advance(*entry, true);
+
+	if (entry->state == STATE_FAILED)
+	{
+		release(program);
+		return 0;
+	}
+	return program;
+}
+
+bool ShaderRegistry::release(GLuint program)
+{
+	for (std::size_t i = 0; i < entries.size(); ++i)
+	{
+		if (entries[i].program != program)
+			continue;
+		if (--entries[i].references > 0)
+			return false;
+
+		deleteShaders(entries[i]);
+		glDeleteProgram(program);
+		entries.erase(entries.begin() + i);
+		return true;
+	}
+	return false;
+}
+
+void ShaderRegistry::destroy()
+{
+	for (Entry& entry : entries)
+	{
+		deleteShaders(entry);
+		glDeleteProgram(entry.program);
+	}
+	entries.clear();
+}
+
+void ShaderRegistry::poll()
+{
+	for (Entry& entry : entries)
+	{
+		while (entry.state != STATE_READY && entry.state != STATE_FAILED && advance(entry, false))
+		{
+			// every step may have waited on the compiler, one per frame keeps the stalls short
+			if (!parallel)
+				return;
+		}
+	}
+}
+
+void ShaderRegistry::finish()
+{
+	for (Entry& entry : entries)
+	{
+		while (entry.state != STATE_READY && entry.state != STATE_FAILED)
+			advance(entry, true);
+	}
+}
+
+bool ShaderRegistry::ready(GLuint program) const
+{
+	const Entry* entry = find(program);
+	return entry && entry->state == STATE_READY;
+}
+
+bool ShaderRegistry::failed(GLuint program) const
+{
+	const Entry* entry = find(program);
+	return entry && entry->state == STATE_FAILED;
+}
+
+std::size_t ShaderRegistry::pendingCount() const
+{
+	std::size_t count = 0;
+	for (const Entry& entry : entries)
+	{
+		if (entry.state != STATE_READY && entry.state != STATE_FAILED)
+			++count;
+	}
+	return count;
+}
+
+ShaderRegistry::Entry* ShaderRegistry::find(GLuint program)
+{
+	for (Entry& entry : entries)
+	{
+		if (entry.program == program)
+			return &entry;
+	}
+	return nullptr;
+}
+
+const ShaderRegistry::Entry* ShaderRegistry::find(GLuint program) const
+{
+	for (const Entry& entry : entries)
+	{
+		if (entry.program == program)
+			return &entry;
+	}
+	return nullptr;
+}
+
+bool ShaderRegistry::loadBinary(Entry& entry)
+{
+	if (cacheDirectory.empty())
+		return false;
+
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	if (formatCount <= 0)
+		return false;
+
+	MappedFile file;
+	if (!file.open(UProgramCachePath(cacheDirectory, entry.sourceHash).c_str()))
+		return false;
+
+	ProgramCacheHeader header;
+	if (file.size() < sizeof(header))
+		return false;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0 || header.version != PROGRAM_CACHE_VERSION ||
+		header.sourceHash != entry.sourceHash || header.driverHash != driverHash() || header.binarySize == 0 ||
+		file.size() < sizeof(header) + header.binarySize)
+		return false;
+
+	// whether the driver accepts it is only asked for in advance()
+	glProgramBinary(entry.program, header.binaryFormat, file.data() + sizeof(header), (GLsizei)header.binarySize);
+	return true;
+}
+
+void ShaderRegistry::saveBinary(const Entry& entry)
+{
+	if (cacheDirectory.empty())
+		return;
+
+	GLint length = 0;
+	glGetProgramiv(entry.program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<unsigned char> binary((std::size_t)length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(entry.program, length, &written, &format, binary.data());
+	if (written <= 0)
+		return;
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+	header.version = PROGRAM_CACHE_VERSION;
+	header.binaryFormat = format;
+	header.binarySize = (uint32_t)written;
+	header.reserved = 0;
+	header.sourceHash = entry.sourceHash;
+	header.driverHash = driverHash();
+
+#ifdef _WIN32
+	_mkdir(cacheDirectory.c_str());
+#else
+	mkdir(cacheDirectory.c_str(), 0755);
+#endif
+
+	// same temporary name and rename as the texture cache
+	std::string path = UProgramCachePath(cacheDirectory, entry.sourceHash);
+	std::string temporaryPath = path + ".tmp";
+	std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+	if (!file)
+		return;
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)binary.data(), written);
+	file.close();
+	bool saved = !file.fail();
+
+	remove(path.c_str());
+	if (!saved || rename(temporaryPath.c_str(), path.c_str()) != 0)
+		remove(temporaryPath.c_str());
+}
+
+uint64_t ShaderRegistry::driverHash()
+{
+	if (!driverKnown)
+	{
+		// a driver update changes the version string, which retires every binary it didn't build
+		const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		driver = UHashBytes(nullptr, 0);
+		for (GLenum name : names)
+		{
+			const char* value = (const char*)glGetString(name);
+			if (value)
+				driver = UHashBytes(value, strlen(value) + 1, driver);
+		}
+		driverKnown = true;
+	}
+	return driver;
+}
+
+void ShaderRegistry::beginCompile(Entry& entry)
+{
+	for (const auto& source : entry.sources)
+	{
+		GLuint shaderId = glCreateShader(source.first);
+		const char* text = source.second.c_str();
+		glShaderSource(shaderId, 1, &text, NULL);
+		glCompileShader(shaderId);
+		entry.shaders.push_back(shaderId);
+	}
+	entry.state = STATE_COMPILING;
+}
+
+bool ShaderRegistry::advance(Entry& entry, bool wait)
+{
+	// for comp and linkage error reporting
+	int success = 0;
+	char infoLog[512];
+
+	switch (entry.state)
+	{
+	case STATE_LOADING_BINARY:
+		if (!wait && !complete(entry.program, true))
+			return false;
+		glGetProgramiv(entry.program, GL_LINK_STATUS, &success);
+		if (success)
+		{
+			++cacheHits;
+			entry.sources.clear();
+			entry.state = STATE_READY;
+		}
+		else
+		{
+			// drivers may still refuse a binary of their own version, the program is built again
+			beginCompile(entry);
+		}
+		return true;
+
+	case STATE_COMPILING:
+		if (!wait)
+		{
+			for (GLuint shaderId : entry.shaders)
+			{
+				if (!complete(shaderId, false))
+					return false;
+			}
+		}
+		for (std::size_t i = 0; i < entry.shaders.size(); ++i)
+		{
+			glGetShaderiv(entry.shaders[i], GL_COMPILE_STATUS, &success);
+			if (!success)
+			{
+				glGetShaderInfoLog(entry.shaders[i], sizeof(infoLog), NULL, infoLog);
+				std::cout << "ERROR::SHADER::" << UStageName(entry.sources[i].first) << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+				fail(entry);
+				return true;
+			}
+		}
+
+		for (GLuint shaderId : entry.shaders)
+			glAttachShader(entry.program, shaderId);
+		// asked before linking so the driver keeps the binary around for glGetProgramBinary
+		if (!cacheDirectory.empty())
+			glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(entry.program);
+		entry.state = STATE_LINKING;
+		return true;
+
+	case STATE_LINKING:
+		if (!wait && !complete(entry.program, true))
+			return false;
+		glGetProgramiv(entry.program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(entry.program, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			fail(entry);
+			return true;
+		}
+
+		// the linked program no longer needs its shader objects
+		deleteShaders(entry);
+		entry.sources.clear();
+		++compiled;
+		saveBinary(entry);
+		entry.state = STATE_READY;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void ShaderRegistry::fail(Entry& entry)
+{
+	deleteShaders(entry);
+	entry.sources.clear();
+	entry.state = STATE_FAILED;
+}
+
+void ShaderRegistry::deleteShaders(Entry& entry)
+{
+	for (GLuint shaderId : entry.shaders)
+	{
+		if (entry.state == STATE_LINKING)
+			glDetachShader(entry.program, shaderId);
+		glDeleteShader(shaderId);
+	}
+	entry.shaders.clear();
+}
+
+bool ShaderRegistry::complete(GLuint object, bool isProgram) const
+{
+	// without the extension there's nothing to ask without waiting, so the next query just waits
+	if (!parallel)
+		return true;
+
+	GLint done = GL_FALSE;
+	if (isProgram)
+		glGetProgramiv(object, GL_COMPLETION_STATUS_KHR, &done);
+	else
+		glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
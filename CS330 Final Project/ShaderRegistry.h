@@ -0,0 +1,128 @@
+/*
+	ShaderRegistry.h
+	Every linked shader program, keyed by a hash of its stages and sources. Asking for a program
+	whose sources were registered before returns the same program with one more reference, so
+	pipelines that share shaders share one program.
+
+	Linked programs are saved with glGetProgramBinary into the cache directory, named after the
+	source hash, and reloaded with glProgramBinary on later runs so warm starts compile no GLSL.
+	Each cache file records a hash of the GL vendor, renderer and version strings; a binary from
+	another driver, or one the driver rejects, is rebuilt from source and rewritten.
+
+	request() only issues the compile, link or binary load and returns the program name at once;
+	poll() moves programs along once a frame and ready() says when one can be drawn with. With
+	KHR_parallel_shader_compile (or the ARB version) the driver compiles on its own threads and
+	poll() only asks for GL_COMPLETION_STATUS, so it never waits. Without it every status query
+	can wait on the compiler, so poll() takes a single step of a single program per call to
+	spread the stalls over frames.
+
+	File layout (little endian):
+		ProgramCacheHeader
+		binary bytes[binarySize]
+*/
+
+#ifndef SHADER_REGISTRY_H
+#define SHADER_REGISTRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+
+struct ProgramCacheHeader
+{
+	char magic[8];				// "UPROGBIN"
+	uint32_t version;
+	uint32_t binaryFormat;		// as returned by glGetProgramBinary
+	uint32_t binarySize;
+	uint32_t reserved;
+	uint64_t sourceHash;
+	uint64_t driverHash;		// GL_VENDOR, GL_RENDERER and GL_VERSION the binary was built by
+};
+
+// One shader object of a program; several of the same stage are linked together
+struct ShaderStageSource
+{
+	GLenum stage;				// GL_VERTEX_SHADER or GL_FRAGMENT_SHADER
+	const char* source;
+};
+
+class ShaderRegistry
+{
+public:
+	ShaderRegistry();
+
+	// Directory binaries are read from and written to; empty keeps everything in memory
+	void setCacheDirectory(const std::string& directory) { cacheDirectory = directory; }
+	// Hands compilation to the driver's threads when it supports parallel shader compiles; needs
+	// a current context. Returns whether it does.
+	bool enableParallelCompile();
+	bool parallelCompile() const { return parallel; }
+
+	// The program linked from these stages, started on first use and not ready yet unless it was
+	// shared. Compile and link errors are printed when poll() reaches them.
+	GLuint request(const ShaderStageSource* stages, std::size_t stageCount);
+	// request() that waits for the program; 0 when it fails to compile or link
+	GLuint acquire(const ShaderStageSource* stages, std::size_t stageCount);
+	// Drops one reference, deleting the program with the last; true when it was deleted
+	bool release(GLuint program);
+	void destroy();
+
+	// Advances requested programs without waiting on the compiler where the driver allows it
+	void poll();
+	// Waits for every requested program
+	void finish();
+	bool ready(GLuint program) const;
+	bool failed(GLuint program) const;
+	std::size_t pendingCount() const;
+
+	// Programs built from source, loaded from the cache and handed out again by request()
+	unsigned int compiledCount() const { return compiled; }
+	unsigned int cacheHitCount() const { return cacheHits; }
+	unsigned int sharedCount() const { return shared; }
+
+private:
+	enum State
+	{
+		STATE_LOADING_BINARY,
+		STATE_COMPILING,
+		STATE_LINKING,
+		STATE_READY,
+		STATE_FAILED
+	};
+
+	struct Entry
+	{
+		uint64_t sourceHash;
+		GLuint program;
+		unsigned int references;
+		State state;
+		// kept until the program is linked, a rejected binary is rebuilt from them
+		std::vector<std::pair<GLenum, std::string> > sources;
+		std::vector<GLuint> shaders;
+	};
+
+	Entry* find(GLuint program);
+	const Entry* find(GLuint program) const;
+	bool loadBinary(Entry& entry);
+	void saveBinary(const Entry& entry);
+	void beginCompile(Entry& entry);
+	// Takes the entry's next step; false when wait is off and the driver isn't done yet
+	bool advance(Entry& entry, bool wait);
+	void fail(Entry& entry);
+	void deleteShaders(Entry& entry);
+	bool complete(GLuint object, bool isProgram) const;
+	uint64_t driverHash();
+
+	std::string cacheDirectory;
+	std::vector<Entry> entries;
+	bool parallel;
+	uint64_t driver;
+	bool driverKnown;
+	unsigned int compiled, cacheHits, shared;
+};
+
+#endif // SHADER_REGISTRY_H
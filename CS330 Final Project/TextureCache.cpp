@@ -0,0 +1,368 @@
+/*
+	TextureCache.cpp
+	BC1/BC3 block encoding, mip generation and cache file I/O.
+*/
+
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	const char CACHE_MAGIC[8] = { 'U', 'T', 'E', 'X', 'B', 'C', 'N', '\0' };
+	const uint32_t CACHE_VERSION = 1;
+
+	// 5:6:5 color to 8 bits per channel, replicating the high bits like the hardware does
+	void UExpand565(uint16_t color, int rgb[3])
+	{
+		int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	uint16_t UPack565(const float rgb[3])
+	{
+		int r = (int)(std::min(std::max(rgb[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		int g = (int)(std::min(std::max(rgb[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+		int b = (int)(std::min(std::max(rgb[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	// BC1 color block: endpoints at the extremes of the block's principal axis
+	void UEncodeColorBlock(const unsigned char block[16][4], unsigned char* out)
+	{
+		float mean[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 3; ++c)
+				mean[c] += block[i][c] / 16.0f;
+
+		// covariance xx, xy, xz, yy, yz, zz
+		float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; ++i)
+		{
+			float d[3] = { block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2] };
+			cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+			cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+		}
+
+		// a few power iterations are enough to separate the dominant axis
+		float axis[3] = { 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 4; ++iteration)
+		{
+			float next[3] = {
+				cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+				cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+				cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+			};
+			float length = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+			if (length < 1.0e-6f)
+				break;
+			for (int c = 0; c < 3; ++c)
+				axis[c] = next[c] / length;
+		}
+
+		int minIndex = 0, maxIndex = 0;
+		float minDot = 1.0e30f, maxDot = -1.0e30f;
+		for (int i = 0; i < 16; ++i)
+		{
+			float dot = block[i][0] * axis[0] + block[i][1] * axis[1] + block[i][2] * axis[2];
+			if (dot < minDot) { minDot = dot; minIndex = i; }
+			if (dot > maxDot) { maxDot = dot; maxIndex = i; }
+		}
+
+		float high[3] = { (float)block[maxIndex][0], (float)block[maxIndex][1], (float)block[maxIndex][2] };
+		float low[3] = { (float)block[minIndex][0], (float)block[minIndex][1], (float)block[minIndex][2] };
+		uint16_t color0 = UPack565(high);
+		uint16_t color1 = UPack565(low);
+
+		// color0 > color1 selects the four color mode
+		if (color0 < color1)
+			std::swap(color0, color1);
+
+		uint32_t indices = 0;
+		if (color0 != color1)
+		{
+			int palette[4][3];
+			UExpand565(color0, palette[0]);
+			UExpand565(color1, palette[1]);
+			for (int c = 0; c < 3; ++c)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+
+			for (int i = 0; i < 16; ++i)
+			{
+				int best = 0, bestError = 1 << 30;
+				for (int p = 0; p < 4; ++p)
+				{
+					int dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+					int error = dr * dr + dg * dg + db * db;
+					if (error < bestError) { bestError = error; best = p; }
+				}
+				indices |= (uint32_t)best << (2 * i);
+			}
+		}
+
+		out[0] = (unsigned char)(color0 & 0xFF);
+		out[1] = (unsigned char)(color0 >> 8);
+		out[2] = (unsigned char)(color1 & 0xFF);
+		out[3] = (unsigned char)(color1 >> 8);
+		for (int b = 0; b < 4; ++b)
+			out[4 + b] = (unsigned char)(indices >> (8 * b));
+	}
+
+	// BC3 alpha block: eight interpolated values between the block's alpha extremes
+	void UEncodeAlphaBlock(const unsigned char block[16][4], unsigned char* out)
+	{
+		int alpha0 = 0, alpha1 = 255;
+		for (int i = 0; i < 16; ++i)
+		{
+			alpha0 = std::max(alpha0, (int)block[i][3]);
+			alpha1 = std::min(alpha1, (int)block[i][3]);
+		}
+
+		out[0] = (unsigned char)alpha0;
+		out[1] = (unsigned char)alpha1;
+
+		uint64_t indices = 0;
+		if (alpha0 != alpha1)
+		{
+			int palette[8] = { alpha0, alpha1 };
+			for (int p = 2; p < 8; ++p)
+				palette[p] = ((8 - p) * alpha0 + (p - 1) * alpha1) / 7;
+
+			for (int i = 0; i < 16; ++i)
+			{
+				int best = 0, bestError = 1 << 30;
+				for (int p = 0; p < 8; ++p)
+				{
+					int error = std::abs(block[i][3] - palette[p]);
+					if (error < bestError) { bestError = error; best = p; }
+				}
+				indices |= (uint64_t)best << (3 * i);
+			}
+		}
+
+		for (int b = 0; b < 6; ++b)
+			out[2 + b] = (unsigned char)(indices >> (8 * b));
+	}
+
+	// 2x2 box filter, odd edges repeat their last row/column
+	void UDownsample(const std::vector<unsigned char>& source, int width, int height, int channels,
+		std::vector<unsigned char>& result, int& resultWidth, int& resultHeight)
+	{
+		resultWidth = std::max(1, width / 2);
+		resultHeight = std::max(1, height / 2);
+		result.resize((std::size_t)resultWidth * resultHeight * channels);
+
+		for (int y = 0; y < resultHeight; ++y)
+		{
+			const unsigned char* row0 = &source[(std::size_t)std::min(2 * y, height - 1) * width * channels];
+			const unsigned char* row1 = &source[(std::size_t)std::min(2 * y + 1, height - 1) * width * channels];
+			for (int x = 0; x < resultWidth; ++x)
+			{
+				int x0 = std::min(2 * x, width - 1) * channels;
+				int x1 = std::min(2 * x + 1, width - 1) * channels;
+				for (int c = 0; c < channels; ++c)
+				{
+					int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+					result[((std::size_t)y * resultWidth + x) * channels + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+	}
+
+	void UEncodeLevel(const unsigned char* pixels, int width, int height, int channels, unsigned char* out)
+	{
+		const int blockBytes = channels == 4 ? 16 : 8;
+		unsigned char block[16][4];
+
+		for (int by = 0; by < (height + 3) / 4; ++by)
+		{
+			for (int bx = 0; bx < (width + 3) / 4; ++bx)
+			{
+				// blocks past the image edge repeat the edge pixels
+				for (int i = 0; i < 16; ++i)
+				{
+					int x = std::min(bx * 4 + (i & 3), width - 1);
+					int y = std::min(by * 4 + (i >> 2), height - 1);
+					const unsigned char* pixel = pixels + ((std::size_t)y * width + x) * channels;
+					block[i][0] = pixel[0];
+					block[i][1] = pixel[1];
+					block[i][2] = pixel[2];
+					block[i][3] = channels == 4 ? pixel[3] : 255;
+				}
+
+				if (channels == 4)
+				{
+					UEncodeAlphaBlock(block, out);
+					UEncodeColorBlock(block, out + 8);
+				}
+				else
+				{
+					UEncodeColorBlock(block, out);
+				}
+				out += blockBytes;
+			}
+		}
+	}
+}
+
+uint64_t UHashBytes(const void* data, std::size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t hash = seed;
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+std::string UTextureCachePath(const std::string& cacheDirectory, uint64_t sourceHash)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.utex", (unsigned long long)sourceHash);
+	return cacheDirectory + name;
+}
+
+bool ULoadCachedTexture(const std::string& path, uint64_t sourceHash, CompressedTexture& texture)
+{
+	if (!texture.file.open(path.c_str()))
+		return false;
+
+	const unsigned char* data = texture.file.data();
+	std::size_t size = texture.file.size();
+
+	CachedTextureHeader header;
+	if (size < sizeof(header))
+	{
+		texture.file.close();
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	std::size_t tableEnd = sizeof(header) + (std::size_t)header.levelCount * sizeof(CachedTextureLevel);
+	if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+		header.sourceHash != sourceHash || header.levelCount == 0 || header.levelCount > 32 || size < tableEnd)
+	{
+		texture.file.close();
+		return false;
+	}
+
+	texture.levels.resize(header.levelCount);
+	memcpy(texture.levels.data(), data + sizeof(header), header.levelCount * sizeof(CachedTextureLevel));
+	for (const CachedTextureLevel& level : texture.levels)
+	{
+		if (level.offset + level.size > size)
+		{
+			texture.levels.clear();
+			texture.file.close();
+			return false;
+		}
+	}
+
+	texture.internalFormat = header.internalFormat;
+	texture.width = (int)header.width;
+	texture.height = (int)header.height;
+	return true;
+}
+
+void UCompressTexture(const unsigned char* pixels, int width, int height, int channels, CompressedTexture& texture)
+{
+	const int blockBytes = channels == 4 ? 16 : 8;
+
+	int levelCount = 1;
+	for (int size = std::max(width, height); size > 1; size /= 2)
+		++levelCount;
+
+	CachedTextureHeader header;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.internalFormat = channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	header.width = (uint32_t)width;
+	header.height = (uint32_t)height;
+	header.levelCount = (uint32_t)levelCount;
+	header.reserved = 0;
+	header.sourceHash = 0;		// filled in by UWriteCachedTexture
+
+	// level table first so the data size is known up front
+	texture.levels.resize(levelCount);
+	uint64_t offset = sizeof(header) + levelCount * sizeof(CachedTextureLevel);
+	for (int level = 0; level < levelCount; ++level)
+	{
+		int levelWidth = std::max(1, width >> level), levelHeight = std::max(1, height >> level);
+		texture.levels[level].offset = offset;
+		texture.levels[level].size = (uint64_t)((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * blockBytes;
+		offset += texture.levels[level].size;
+	}
+
+	texture.encoded.assign((std::size_t)offset, 0);
+	memcpy(texture.encoded.data(), &header, sizeof(header));
+	memcpy(texture.encoded.data() + sizeof(header), texture.levels.data(), levelCount * sizeof(CachedTextureLevel));
+
+	UEncodeLevel(pixels, width, height, channels, texture.encoded.data() + texture.levels[0].offset);
+
+	std::vector<unsigned char> current(pixels, pixels + (std::size_t)width * height * channels), next;
+	int currentWidth = width, currentHeight = height;
+	for (int level = 1; level < levelCount; ++level)
+	{
+		UDownsample(current, currentWidth, currentHeight, channels, next, currentWidth, currentHeight);
+		current.swap(next);
+		UEncodeLevel(current.data(), currentWidth, currentHeight, channels, texture.encoded.data() + texture.levels[level].offset);
+	}
+
+	texture.internalFormat = header.internalFormat;
+	texture.width = width;
+	texture.height = height;
+}
+
+bool UWriteCachedTexture(const std::string& cacheDirectory, uint64_t sourceHash, const CompressedTexture& texture)
+{
+	if (!texture.valid())
+		return false;
+
+#ifdef _WIN32
+	_mkdir(cacheDirectory.c_str());
+#else
+	mkdir(cacheDirectory.c_str(), 0755);
+#endif
+
+	// write to a temporary name and rename, so a crash never leaves a truncated cache file behind
+	std::string path = UTextureCachePath(cacheDirectory, sourceHash);
+	std::string temporaryPath = path + ".tmp";
+	std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+
+	CachedTextureHeader header;
+	memcpy(&header, texture.data(), sizeof(header));
+	header.sourceHash = sourceHash;
+
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)texture.data() + sizeof(header), texture.size() - sizeof(header));
+	file.close();
+	bool written = !file.fail();
+
+	remove(path.c_str());
+	if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+	{
+		remove(temporaryPath.c_str());
+		return false;
+	}
+	return true;
+}
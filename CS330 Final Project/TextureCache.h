@@ -0,0 +1,80 @@
+/*
+	TextureCache.h
+	On-disk cache of block-compressed textures. The first run encodes each decoded image as BC1
+	(RGB) or BC3 (RGBA) with its full box-filtered mip chain and writes it next to the other
+	cached textures, named after a 64-bit hash of the source file. Later runs map the cache file
+	and hand the compressed mips straight to glCompressedTexImage2D.
+
+	File layout (little endian):
+		CachedTextureHeader
+		CachedTextureLevel[levelCount]		byte offset and size of each mip from the file start
+		mip data, level 0 first
+*/
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "MappedFile.h"
+
+struct CachedTextureHeader
+{
+	char magic[8];				// "UTEXBCN\0"
+	uint32_t version;
+	uint32_t internalFormat;	// GL_COMPRESSED_RGB_S3TC_DXT1_EXT or GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+	uint32_t reserved;
+	uint64_t sourceHash;
+};
+
+struct CachedTextureLevel
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Compressed mip chain, backed either by a mapped cache file or by freshly encoded bytes
+class CompressedTexture
+{
+public:
+	CompressedTexture() : internalFormat(0), width(0), height(0) {}
+
+	bool valid() const { return !levels.empty(); }
+	const unsigned char* data() const { return file.isOpen() ? file.data() : encoded.data(); }
+	std::size_t size() const { return file.isOpen() ? file.size() : encoded.size(); }
+
+	GLenum internalFormat;
+	int width, height;
+	std::vector<CachedTextureLevel> levels;		// offsets into data()
+
+private:
+	friend bool ULoadCachedTexture(const std::string&, uint64_t, CompressedTexture&);
+	friend void UCompressTexture(const unsigned char*, int, int, int, CompressedTexture&);
+
+	MappedFile file;
+	std::vector<unsigned char> encoded;		// laid out exactly like a cache file
+};
+
+// 64-bit FNV-1a, pass a previous result as seed to hash several buffers
+uint64_t UHashBytes(const void* data, std::size_t size, uint64_t seed = 14695981039346656037ull);
+
+// cacheDirectory/<16 hex digits of hash>.utex
+std::string UTextureCachePath(const std::string& cacheDirectory, uint64_t sourceHash);
+
+// Maps a cache file, false if it is missing, truncated or was built from a different source
+bool ULoadCachedTexture(const std::string& path, uint64_t sourceHash, CompressedTexture& texture);
+
+// Encodes 3 channel images as BC1 and 4 channel images as BC3, level 0 down to 1x1
+void UCompressTexture(const unsigned char* pixels, int width, int height, int channels, CompressedTexture& texture);
+
+// Writes an encoded texture, creating cacheDirectory if needed
+bool UWriteCachedTexture(const std::string& cacheDirectory, uint64_t sourceHash, const CompressedTexture& texture);
+
+#endif // TEXTURE_CACHE_H
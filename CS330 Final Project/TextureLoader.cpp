@@ -0,0 +1,313 @@
+/*
+	TextureLoader.cpp
+	Worker thread decoding and pixel unpack buffer uploads.
+*/
+
+#include "TextureLoader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <stb_image.h>
+
+#include "ImageFlip.h"
+
+TextureLoader::TextureLoader()
+	: stopping(false), decoded(nullptr), pendingCount(0), unpackBuffer(0), flipRows(false),
+	  useCache(false), hitCount(0), missCount(0)
+{
+}
+
+TextureLoader::~TextureLoader()
+{
+	stop();
+}
+
+void TextureLoader::start(unsigned int threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+	// compressed uploads need S3TC, otherwise the workers hand over raw pixels
+	useCache = !cacheDirectory.empty() && GLEW_EXT_texture_compression_s3tc;
+	if (!cacheDirectory.empty() && !useCache)
+		std::cout << "INFO: S3TC textures not supported, texture cache disabled" << std::endl;
+
+	stopping = false;
+	for (unsigned int i = 0; i < threadCount; ++i)
+		workers.push_back(std::thread(&TextureLoader::workerLoop, this));
+}
+
+void TextureLoader::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		stopping = true;
+		jobs.clear();
+	}
+	jobReady.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+
+	// images decoded after the last poll are dropped, their textures keep the placeholder
+	DecodedImage* image = decoded.exchange(nullptr, std::memory_order_acquire);
+	while (image)
+	{
+		DecodedImage* next = image->next;
+		ready.push_back(image);
+		image = next;
+	}
+	for (DecodedImage* leftover : ready)
+	{
+		stbi_image_free(leftover->pixels);
+		delete leftover;
+	}
+	ready.clear();
+	pendingCount = 0;
+
+	if (unpackBuffer)
+	{
+		glDeleteBuffers(1, &unpackBuffer);
+		unpackBuffer = 0;
+	}
+}
+
+void TextureLoader::request(const char* filename, GLuint& textureId)
+{
+	// placeholder: one mid-grey texel until the real image is uploaded
+	const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+
+	// set texture wrapping params
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// set texture filtering params
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	++pendingCount;
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		Job job = { filename, textureId };
+		jobs.push_back(job);
+	}
+	jobReady.notify_one();
+}
+
+void TextureLoader::workerLoop()
+{
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(jobMutex);
+			jobReady.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (stopping)
+				return;
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		DecodedImage* image = new DecodedImage();
+		image->filename = job.filename;
+		image->textureId = job.textureId;
+		image->pixels = nullptr;
+		image->width = image->height = image->channels = 0;
+		image->next = nullptr;
+
+		decode(image);
+		pushDecoded(image);
+	}
+}
+
+void TextureLoader::decode(DecodedImage* image)
+{
+	std::ifstream file(image->filename.c_str(), std::ios::binary);
+	std::vector<unsigned char> source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (source.empty())
+		return;
+
+	// the key covers the source bytes and everything that changes the decoded pixels
+	unsigned char flipped = flipRows ? 1 : 0;
+	uint64_t sourceHash = UHashBytes(&flipped, 1, UHashBytes(source.data(), source.size()));
+
+	if (useCache && ULoadCachedTexture(UTextureCachePath(cacheDirectory, sourceHash), sourceHash, image->compressed))
+	{
+		++hitCount;
+		return;
+	}
+
+	image->pixels = stbi_load_from_memory(source.data(), (int)source.size(), &image->width, &image->height, &image->channels, 0);
+	if (!image->pixels)
+		return;
+
+	if (flipRows)
+		flipImageVertically(image->pixels, image->width, image->height, image->channels);
+
+	if (useCache && (image->channels == 3 || image->channels == 4))
+	{
+		++missCount;
+		UCompressTexture(image->pixels, image->width, image->height, image->channels, image->compressed);
+		if (!UWriteCachedTexture(cacheDirectory, sourceHash, image->compressed))
+			std::cout << "Failed to write texture cache for " << image->filename << std::endl;
+
+		stbi_image_free(image->pixels);
+		image->pixels = nullptr;
+	}
+}
+
+void TextureLoader::pushDecoded(DecodedImage* image)
+{
+	// lock-free push, release makes the decoded pixels visible to the GL thread's acquire
+	image->next = decoded.load(std::memory_order_relaxed);
+	while (!decoded.compare_exchange_weak(image->next, image, std::memory_order_release, std::memory_order_relaxed))
+		;
+}
+
+void TextureLoader::poll(int maxUploads)
+{
+	// take everything finished so far; the stack is newest first, so reverse it onto the ready list
+	DecodedImage* image = decoded.exchange(nullptr, std::memory_order_acquire);
+	std::size_t insertAt = ready.size();
+	while (image)
+	{
+		DecodedImage* next = image->next;
+		ready.insert(ready.begin() + insertAt, image);
+		image = next;
+	}
+
+	for (int uploads = 0; !ready.empty() && (maxUploads <= 0 || uploads < maxUploads); ++uploads)
+	{
+		DecodedImage* front = ready.front();
+		ready.pop_front();
+		upload(front);
+	}
+}
+
+void TextureLoader::finish()
+{
+	while (pendingCount > 0)
+	{
+		poll(0);
+		if (pendingCount > 0)
+			std::this_thread::yield();
+	}
+}
+
+void TextureLoader::takeUploaded(std::vector<GLuint>& textures)
+{
+	textures.clear();
+	textures.swap(uploaded);
+}
+
+void TextureLoader::upload(DecodedImage* image)
+{
+	if (image->compressed.valid())
+	{
+		uploadCompressed(image);
+		uploaded.push_back(image->textureId);
+	}
+	else if (!image->pixels)
+	{
+		std::cout << "Failed to load texture " << image->filename << std::endl;
+	}
+	else if (image->channels != 3 && image->channels != 4)
+	{
+		std::cout << "Not implemented to handle image with " << image->channels << "channels" << std::endl;
+	}
+	else
+	{
+		GLenum format = image->channels == 3 ? GL_RGB : GL_RGBA;
+		GLenum internalFormat = image->channels == 3 ? GL_RGB8 : GL_RGBA8;
+		GLsizeiptr size = (GLsizeiptr)image->width * image->height * image->channels;
+
+		if (!unpackBuffer)
+			glGenBuffers(1, &unpackBuffer);
+
+		// orphan the previous upload's storage instead of waiting for the driver to finish reading it
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+		const void* source = (const void*)0;
+		if (mapped)
+		{
+			memcpy(mapped, image->pixels, size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		else
+		{
+			// mapping failed, upload straight from client memory
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			source = image->pixels;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, image->textureId);
+		// RGB rows are not always a multiple of 4 bytes
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image->width, image->height, 0, format, GL_UNSIGNED_BYTE, source);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		// generating mipmap for GL_TEXTURE_2D
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		uploaded.push_back(image->textureId);
+	}
+
+	stbi_image_free(image->pixels);
+	delete image;
+	--pendingCount;
+}
+
+void TextureLoader::uploadCompressed(DecodedImage* image)
+{
+	const CompressedTexture& texture = image->compressed;
+
+	// every mip goes through one unpack buffer, offsets relative to the first level
+	GLintptr base = (GLintptr)texture.levels[0].offset;
+	GLsizeiptr size = (GLsizeiptr)(texture.size() - base);
+
+	if (!unpackBuffer)
+		glGenBuffers(1, &unpackBuffer);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+	const unsigned char* source = (const unsigned char*)0;
+	if (mapped)
+	{
+		memcpy(mapped, texture.data() + base, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		source = texture.data() + base;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, image->textureId);
+	for (std::size_t level = 0; level < texture.levels.size(); ++level)
+	{
+		GLsizei levelWidth = std::max(1, texture.width >> level);
+		GLsizei levelHeight = std::max(1, texture.height >> level);
+		glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, texture.internalFormat, levelWidth, levelHeight, 0,
+			(GLsizei)texture.levels[level].size, source + (texture.levels[level].offset - base));
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
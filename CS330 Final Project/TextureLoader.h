@@ -0,0 +1,113 @@
+/*
+	TextureLoader.h
+	Asynchronous texture loading. request() gives the texture a 1x1 placeholder right away and
+	queues the file for a pool of worker threads, which decode the image with stb_image.
+	Decoded images come back to the GL thread through a lock-free queue, and poll() streams them
+	into their textures through a pixel unpack buffer. Texture names never change, so code that
+	binds them does not need to know whether the real image has arrived yet.
+
+	Images keep stb's top-row-first order unless setFlipRows(true) is called; the object shader
+	samples with a flipped V coordinate instead, so no flip is needed at load time.
+
+	With a cache directory set (and S3TC support), workers look up a BC1/BC3 copy of each source
+	file in the TextureCache first. On a miss they decode, compress with a full mip chain and
+	write the cache file; either way the GL thread uploads compressed mips and skips
+	glGenerateMipmap.
+*/
+
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "TextureCache.h"
+
+class TextureLoader
+{
+public:
+	TextureLoader();
+	~TextureLoader();
+
+	// Flip decoded images to bottom-row-first for UVs with V pointing up. Call before start().
+	void setFlipRows(bool flip) { flipRows = flip; }
+
+	// Directory for compressed copies of the sources, empty disables the cache. Call before start().
+	void setCacheDirectory(const std::string& directory) { cacheDirectory = directory; }
+
+	// Starts the worker threads, 0 picks one less than the number of hardware threads
+	void start(unsigned int threadCount = 0);
+	// Joins the workers and frees images that were never uploaded
+	void stop();
+
+	// Creates textureId with a placeholder and queues filename for decoding. GL thread only.
+	void request(const char* filename, GLuint& textureId);
+
+	// Uploads up to maxUploads decoded images (0 = all ready ones). GL thread only.
+	void poll(int maxUploads = 1);
+	// Polls until every requested texture has been uploaded or has failed
+	void finish();
+
+	// Moves the names of textures whose real image was uploaded since the last call into textures
+	void takeUploaded(std::vector<GLuint>& textures);
+
+	int pending() const { return pendingCount; }
+	int cacheHits() const { return hitCount; }
+	int cacheMisses() const { return missCount; }
+
+private:
+	struct Job
+	{
+		std::string filename;
+		GLuint textureId;
+	};
+
+	// Node of the completed queue, holds either raw pixels or a compressed mip chain.
+	// Decoding failed when neither is set.
+	struct DecodedImage
+	{
+		std::string filename;
+		GLuint textureId;
+		unsigned char* pixels;
+		int width, height, channels;
+		CompressedTexture compressed;
+		DecodedImage* next;
+	};
+
+	void workerLoop();
+	void decode(DecodedImage* image);
+	void pushDecoded(DecodedImage* image);
+	void upload(DecodedImage* image);
+	void uploadCompressed(DecodedImage* image);
+
+	std::vector<std::thread> workers;
+
+	// jobs waiting for a worker
+	std::mutex jobMutex;
+	std::condition_variable jobReady;
+	std::deque<Job> jobs;
+	bool stopping;
+
+	// multi-producer single-consumer stack, the GL thread takes the whole list at once
+	std::atomic<DecodedImage*> decoded;
+	// images taken from the stack, oldest first, waiting for their upload slot
+	std::deque<DecodedImage*> ready;
+
+	int pendingCount;
+	GLuint unpackBuffer;
+	std::vector<GLuint> uploaded;
+	bool flipRows;
+
+	std::string cacheDirectory;
+	bool useCache;
+	std::atomic<int> hitCount, missCount;
+};
+
+#endif // TEXTURE_LOADER_H
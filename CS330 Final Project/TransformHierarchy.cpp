@@ -0,0 +1,121 @@
+/*
+	TransformHierarchy.cpp
+	Dirty flag propagation and batched world matrix products.
+*/
+
+#include "TransformHierarchy.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_HIERARCHY_SSE2
+#include <emmintrin.h>
+#endif
+
+TransformHierarchy::TransformHierarchy()
+	: anyDirty(false)
+{
+}
+
+uint32_t TransformHierarchy::add(uint32_t parent, const glm::mat4& local)
+{
+	parents.push_back(parent);
+	depths.push_back(parent == NO_PARENT ? 0 : depths[parent] + 1);
+	locals.push_back(local);
+	worlds.push_back(local);
+	dirtyFlags.push_back(1);
+	anyDirty = true;
+	return (uint32_t)(parents.size() - 1);
+}
+
+void TransformHierarchy::clear()
+{
+	parents.clear();
+	depths.clear();
+	locals.clear();
+	worlds.clear();
+	dirtyFlags.clear();
+	changedNodes.clear();
+	anyDirty = false;
+}
+
+void TransformHierarchy::setLocal(uint32_t node, const glm::mat4& local)
+{
+	locals[node] = local;
+	dirtyFlags[node] = 1;
+	anyDirty = true;
+}
+
+std::size_t TransformHierarchy::update()
+{
+	changedNodes.clear();
+	if (!anyDirty)
+		return 0;
+
+	// parents come first, so one pass carries a flag down any number of levels
+	for (auto& batch : depthBatches)
+		batch.clear();
+	for (uint32_t node = 0; node < parents.size(); ++node)
+	{
+		if (parents[node] != NO_PARENT && dirtyFlags[parents[node]])
+			dirtyFlags[node] = 1;
+		if (!dirtyFlags[node])
+			continue;
+
+		changedNodes.push_back(node);
+		if (depths[node] >= depthBatches.size())
+			depthBatches.resize(depths[node] + 1);
+		depthBatches[depths[node]].push_back(node);
+	}
+
+	// every node of a depth only needs the depth above it, so each depth is one batch
+	if (!depthBatches.empty())
+	{
+		for (uint32_t node : depthBatches[0])
+			worlds[node] = locals[node];
+	}
+	for (std::size_t depth = 1; depth < depthBatches.size(); ++depth)
+	{
+		const std::vector<uint32_t>& batch = depthBatches[depth];
+		batchLeft.resize(batch.size());
+		batchRight.resize(batch.size());
+		batchOut.resize(batch.size());
+		for (std::size_t i = 0; i < batch.size(); ++i)
+		{
+			batchLeft[i] = &worlds[parents[batch[i]]];
+			batchRight[i] = &locals[batch[i]];
+			batchOut[i] = &worlds[batch[i]];
+		}
+		UMultiplyBatch(batchLeft.data(), batchRight.data(), batchOut.data(), batch.size());
+	}
+
+	for (uint32_t node : changedNodes)
+		dirtyFlags[node] = 0;
+	anyDirty = false;
+	return changedNodes.size();
+}
+
+void TransformHierarchy::UMultiplyBatch(const glm::mat4* const* left, const glm::mat4* const* right, glm::mat4* const* out,
+	std::size_t count)
+{
+	for (std::size_t i = 0; i < count; ++i)
+	{
+#if defined(TRANSFORM_HIERARCHY_SSE2)
+		// each column of the product is the left columns weighted by one right column,
+		// the same broadcasts glm_mat4_mul uses
+		const float* a = &(*left[i])[0][0];
+		const float* b = &(*right[i])[0][0];
+		float* c = &(*out[i])[0][0];
+		__m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+		for (int column = 0; column < 4; ++column)
+		{
+			__m128 bc = _mm_loadu_ps(b + column * 4);
+			__m128 sum = _mm_mul_ps(a0, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(0, 0, 0, 0)));
+			sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(1, 1, 1, 1))));
+			sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(2, 2, 2, 2))));
+			sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(3, 3, 3, 3))));
+			_mm_storeu_ps(c + column * 4, sum);
+		}
+#else
+		*out[i] = *left[i] * *right[i];
+#endif
+	}
+}
@@ -0,0 +1,65 @@
+/*
+	TransformHierarchy.h
+	Parent/child transforms of the scene. Nodes live in structure-of-arrays storage (parents,
+	depths, local and world matrices and dirty flags side by side) and are always added after
+	their parent, so index order is a valid update order.
+
+	setLocal() only marks a node dirty. update() spreads the flags down to every descendant,
+	groups the nodes to recompute by depth, and multiplies each group's parent world matrices
+	by their local matrices as one batch, 4 columns at a time with SSE2 when the compiler
+	targets it. Nothing is recomputed while no node changes.
+*/
+
+#ifndef TRANSFORM_HIERARCHY_H
+#define TRANSFORM_HIERARCHY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class TransformHierarchy
+{
+public:
+	static const uint32_t NO_PARENT = ~0u;
+
+	TransformHierarchy();
+
+	// Adds a node under parent, which must already exist, or at the root; returns its index
+	uint32_t add(uint32_t parent, const glm::mat4& local);
+	void clear();
+
+	// Replaces a node's transform relative to its parent; applied by the next update()
+	void setLocal(uint32_t node, const glm::mat4& local);
+
+	// Recomputes the world matrices of changed nodes and their descendants, returns how many
+	std::size_t update();
+	// Nodes whose world matrix the last update() recomputed, in index order
+	const std::vector<uint32_t>& changed() const { return changedNodes; }
+	bool dirty() const { return anyDirty; }
+
+	std::size_t size() const { return parents.size(); }
+	uint32_t parent(uint32_t node) const { return parents[node]; }
+	const glm::mat4& local(uint32_t node) const { return locals[node]; }
+	const glm::mat4& world(uint32_t node) const { return worlds[node]; }
+
+	// out[i] = left[i] * right[i] for count matrices
+	static void UMultiplyBatch(const glm::mat4* const* left, const glm::mat4* const* right, glm::mat4* const* out, std::size_t count);
+
+private:
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> depths;
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	std::vector<uint8_t> dirtyFlags;
+	bool anyDirty;
+
+	// rebuilt by update()
+	std::vector<uint32_t> changedNodes;
+	std::vector<std::vector<uint32_t> > depthBatches;
+	std::vector<const glm::mat4*> batchLeft, batchRight;
+	std::vector<glm::mat4*> batchOut;
+};
+
+#endif // TRANSFORM_HIERARCHY_H
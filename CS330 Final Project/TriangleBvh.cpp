@@ -0,0 +1,204 @@
+/*
+	TriangleBvh.cpp
+	Morton ordered triangle packets and the packet ray tests.
+*/
+
+#include "TriangleBvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRIANGLE_BVH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// position, normal and uv
+	const GLsizei FLOATS_PER_VERTEX = 8;
+	// determinants this small are edge-on triangles (or padding) and never hit
+	const float PARALLEL_EPSILON = 1.0e-12f;
+
+	// spreads the low 10 bits of x to every third bit
+	uint32_t USpreadBits(uint32_t x)
+	{
+		x = (x | (x << 16)) & 0x030000ffu;
+		x = (x | (x << 8)) & 0x0300f00fu;
+		x = (x | (x << 4)) & 0x030c30c3u;
+		x = (x | (x << 2)) & 0x09249249u;
+		return x;
+	}
+
+	uint32_t UMortonCode(const glm::vec3& unit)
+	{
+		glm::uvec3 cell = glm::uvec3(glm::clamp(unit * 1024.0f, glm::vec3(0.0f), glm::vec3(1023.0f)));
+		return (USpreadBits(cell.x) << 2) | (USpreadBits(cell.y) << 1) | USpreadBits(cell.z);
+	}
+}
+
+void TriangleBvh::build(const GLfloat* vertices, GLsizei vertexCount, const GLuint* meshIndices, GLsizei indexCount)
+{
+	indices.assign(meshIndices, meshIndices + indexCount);
+	uvs.resize(vertexCount);
+	for (GLsizei i = 0; i < vertexCount; ++i)
+		uvs[i] = glm::vec2(vertices[i * FLOATS_PER_VERTEX + 6], vertices[i * FLOATS_PER_VERTEX + 7]);
+
+	auto position = [&](GLuint vertex) {
+		const GLfloat* p = vertices + vertex * FLOATS_PER_VERTEX;
+		return glm::vec3(p[0], p[1], p[2]);
+	};
+
+	// triangles close along the curve are close in space, so each packet stays compact
+	const uint32_t triangles = (uint32_t)(indexCount / 3);
+	std::vector<glm::vec3> centroids(triangles);
+	glm::vec3 centroidMin(0.0f), centroidMax(0.0f);
+	for (uint32_t t = 0; t < triangles; ++t)
+	{
+		centroids[t] = (position(indices[t * 3]) + position(indices[t * 3 + 1]) + position(indices[t * 3 + 2])) / 3.0f;
+		centroidMin = t ? glm::min(centroidMin, centroids[t]) : centroids[t];
+		centroidMax = t ? glm::max(centroidMax, centroids[t]) : centroids[t];
+	}
+	glm::vec3 scale = 1.0f / glm::max(centroidMax - centroidMin, glm::vec3(1.0e-20f));
+
+	std::vector<uint64_t> order(triangles);
+	for (uint32_t t = 0; t < triangles; ++t)
+		order[t] = ((uint64_t)UMortonCode((centroids[t] - centroidMin) * scale) << 32) | t;
+	std::sort(order.begin(), order.end());
+
+	packets.assign((triangles + PACKET_SIZE - 1) / PACKET_SIZE, TrianglePacket());
+	std::vector<Aabb> packetBounds(packets.size());
+	for (uint32_t slot = 0; slot < packets.size() * PACKET_SIZE; ++slot)
+	{
+		TrianglePacket& packet = packets[slot / PACKET_SIZE];
+		uint32_t lane = slot % PACKET_SIZE;
+
+		// padding repeats the first triangle's vertex with zero edges, which never hits
+		uint32_t triangle = slot < triangles ? (uint32_t)order[slot] : NO_TRIANGLE;
+		glm::vec3 v0 = position(indices[(triangle == NO_TRIANGLE ? (uint32_t)order[0] : triangle) * 3]);
+		glm::vec3 v1 = triangle == NO_TRIANGLE ? v0 : position(indices[triangle * 3 + 1]);
+		glm::vec3 v2 = triangle == NO_TRIANGLE ? v0 : position(indices[triangle * 3 + 2]);
+
+		packet.v0x[lane] = v0.x; packet.v0y[lane] = v0.y; packet.v0z[lane] = v0.z;
+		packet.e1x[lane] = v1.x - v0.x; packet.e1y[lane] = v1.y - v0.y; packet.e1z[lane] = v1.z - v0.z;
+		packet.e2x[lane] = v2.x - v0.x; packet.e2y[lane] = v2.y - v0.y; packet.e2z[lane] = v2.z - v0.z;
+		packet.triangle[lane] = triangle;
+
+		Aabb& bounds = packetBounds[slot / PACKET_SIZE];
+		if (lane == 0)
+			bounds.boundsMin = bounds.boundsMax = v0;
+		bounds.boundsMin = glm::min(bounds.boundsMin, glm::min(v0, glm::min(v1, v2)));
+		bounds.boundsMax = glm::max(bounds.boundsMax, glm::max(v0, glm::max(v1, v2)));
+	}
+
+	bvh.build(packetBounds);
+}
+
+bool TriangleBvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, TriangleHit& hit) const
+{
+	uint32_t packetIndex;
+	float u = 0.0f, v = 0.0f;
+	int hitLane = -1;
+	bool found = bvh.raycast(origin, direction, maxDistance, packetIndex,
+		[&](uint32_t packet, float, float& distance) {
+			float laneU, laneV;
+			int lane = UIntersectPacket(packets[packet], origin, direction, distance, distance, laneU, laneV);
+			if (lane < 0)
+				return false;
+			hitLane = lane;
+			u = laneU;
+			v = laneV;
+			return true;
+		});
+	if (!found)
+		return false;
+
+	hit.triangle = packets[packetIndex].triangle[hitLane];
+	hit.distance = maxDistance;
+	hit.barycentric = glm::vec2(u, v);
+	const GLuint* corner = &indices[hit.triangle * 3];
+	hit.uv = uvs[corner[0]] * (1.0f - u - v) + uvs[corner[1]] * u + uvs[corner[2]] * v;
+	return true;
+}
+
+int TriangleBvh::UIntersectPacket(const TrianglePacket& packet, const glm::vec3& origin, const glm::vec3& direction,
+	float maxDistance, float& distance, float& u, float& v)
+{
+	float laneDistance[PACKET_SIZE], laneU[PACKET_SIZE], laneV[PACKET_SIZE];
+	int hitMask = 0;
+
+#if defined(TRIANGLE_BVH_SSE2)
+	const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+	const __m128 e1x = _mm_loadu_ps(packet.e1x), e1y = _mm_loadu_ps(packet.e1y), e1z = _mm_loadu_ps(packet.e1z);
+	const __m128 e2x = _mm_loadu_ps(packet.e2x), e2y = _mm_loadu_ps(packet.e2y), e2z = _mm_loadu_ps(packet.e2z);
+
+	// p = d x e2, det = e1 . p
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	// s = o - v0, u = (s . p) / det
+	__m128 sx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(packet.v0x));
+	__m128 sy = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(packet.v0y));
+	__m128 sz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(packet.v0z));
+	__m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDet);
+
+	// q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	__m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDet);
+	__m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+
+	const __m128 zero = _mm_setzero_ps();
+	__m128 mask = _mm_cmpgt_ps(absDet, _mm_set1_ps(PARALLEL_EPSILON));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(uu, zero));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(vv, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.0f)));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(tt, zero));
+	mask = _mm_and_ps(mask, _mm_cmplt_ps(tt, _mm_set1_ps(maxDistance)));
+	hitMask = _mm_movemask_ps(mask);
+	if (!hitMask)
+		return -1;
+
+	_mm_storeu_ps(laneDistance, tt);
+	_mm_storeu_ps(laneU, uu);
+	_mm_storeu_ps(laneV, vv);
+#else
+	for (uint32_t lane = 0; lane < PACKET_SIZE; ++lane)
+	{
+		glm::vec3 e1(packet.e1x[lane], packet.e1y[lane], packet.e1z[lane]);
+		glm::vec3 e2(packet.e2x[lane], packet.e2y[lane], packet.e2z[lane]);
+		glm::vec3 p = glm::cross(direction, e2);
+		float det = glm::dot(e1, p);
+		if (!(std::fabs(det) > PARALLEL_EPSILON))
+			continue;
+
+		float inverseDet = 1.0f / det;
+		glm::vec3 s = origin - glm::vec3(packet.v0x[lane], packet.v0y[lane], packet.v0z[lane]);
+		glm::vec3 q = glm::cross(s, e1);
+		laneU[lane] = glm::dot(s, p) * inverseDet;
+		laneV[lane] = glm::dot(direction, q) * inverseDet;
+		laneDistance[lane] = glm::dot(e2, q) * inverseDet;
+		if (laneU[lane] >= 0.0f && laneV[lane] >= 0.0f && laneU[lane] + laneV[lane] <= 1.0f &&
+			laneDistance[lane] >= 0.0f && laneDistance[lane] < maxDistance)
+			hitMask |= 1 << lane;
+	}
+	if (!hitMask)
+		return -1;
+#endif
+
+	int nearest = -1;
+	for (int lane = 0; lane < (int)PACKET_SIZE; ++lane)
+	{
+		if ((hitMask & (1 << lane)) && (nearest < 0 || laneDistance[lane] < laneDistance[nearest]))
+			nearest = lane;
+	}
+	distance = laneDistance[nearest];
+	u = laneU[nearest];
+	v = laneV[nearest];
+	return nearest;
+}
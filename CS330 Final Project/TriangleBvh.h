@@ -0,0 +1,65 @@
+/*
+	TriangleBvh.h
+	Ray queries against the triangles of one indexed mesh, for picking.
+
+	Triangles are sorted along a Morton curve through their centroids and grouped four at a
+	time into packets stored as structure of arrays (first vertex and two edges). A Bvh over
+	the packet boxes finds the packets a ray passes near, and each packet is tested with a
+	4-wide SSE2 Moller-Trumbore intersection, or one triangle at a time without SSE2.
+	Both sides of a triangle can be hit.
+*/
+
+#ifndef TRIANGLE_BVH_H
+#define TRIANGLE_BVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Bvh.h"
+
+struct TriangleHit
+{
+	uint32_t triangle;			// index / 3 of its first index
+	float distance;				// ray parameter, in units of the ray direction's length
+	glm::vec2 barycentric;		// weights of the second and third vertex
+	glm::vec2 uv;				// interpolated texture coordinate, as stored in the mesh
+};
+
+class TriangleBvh
+{
+public:
+	// Interleaved position/normal/uv vertices, 8 floats each, and triangle list indices
+	void build(const GLfloat* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount);
+
+	// Nearest triangle the ray hits within maxDistance, which is shortened to the hit.
+	// The direction need not be normalized.
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, TriangleHit& hit) const;
+
+	std::size_t triangleCount() const { return indices.size() / 3; }
+
+private:
+	static const uint32_t PACKET_SIZE = 4;
+	static const uint32_t NO_TRIANGLE = ~0u;
+
+	struct TrianglePacket
+	{
+		float v0x[PACKET_SIZE], v0y[PACKET_SIZE], v0z[PACKET_SIZE];
+		float e1x[PACKET_SIZE], e1y[PACKET_SIZE], e1z[PACKET_SIZE];		// v1 - v0
+		float e2x[PACKET_SIZE], e2y[PACKET_SIZE], e2z[PACKET_SIZE];		// v2 - v0
+		uint32_t triangle[PACKET_SIZE];									// NO_TRIANGLE pads the last packet
+	};
+
+	// Nearest lane hit closer than maxDistance, or -1
+	static int UIntersectPacket(const TrianglePacket& packet, const glm::vec3& origin, const glm::vec3& direction,
+		float maxDistance, float& distance, float& u, float& v);
+
+	std::vector<TrianglePacket> packets;
+	Bvh bvh;
+	std::vector<GLuint> indices;
+	std::vector<glm::vec2> uvs;
+};
+
+#endif // TRIANGLE_BVH_H
@@ -0,0 +1,47 @@
+/*
+	TripleBuffer.h
+	Lock-free hand-off of whole values from one producer thread to one consumer thread.
+	The producer fills its back slot and publishes it; the consumer swaps in the newest
+	published slot when it wants one. Neither side ever blocks the other, and values the
+	consumer was too slow to pick up are simply overwritten.
+*/
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : front(0), back(2), middle(1) {}
+
+	// Producer: the slot to fill, then publish() it
+	T& write() { return slots[back]; }
+	void publish()
+	{
+		// release makes the slot's contents visible to the consumer's acquire in update()
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	// Consumer: true if a newer value was published since the last update()
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+	const T& read() const { return slots[front]; }
+
+private:
+	static const unsigned INDEX_MASK = 3u;
+	static const unsigned FRESH = 4u;	// middle holds a value the consumer has not seen
+
+	T slots[3];
+	unsigned front, back;				// owned by the consumer and the producer
+	std::atomic<unsigned> middle;		// slot index plus FRESH, swapped by both sides
+};
+
+#endif // TRIPLE_BUFFER_H
@@ -0,0 +1,72 @@
+/*
+	UniformCache.cpp
+	Builds the per-program name -> location table from the program's active uniforms.
+*/
+
+#include "UniformCache.h"
+
+#include <vector>
+
+void UniformCache::build(GLuint programId)
+{
+	std::unordered_map<std::string, GLint>& locations = programs[programId];
+	locations.clear();
+
+	GLint uniformCount = 0, maxNameLength = 0;
+	glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &uniformCount);
+	glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::vector<GLchar> name(maxNameLength > 0 ? maxNameLength : 1);
+	for (GLint i = 0; i < uniformCount; ++i)
+	{
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(programId, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+
+		std::string uniformName(name.data(), length);
+		GLint loc = glGetUniformLocation(programId, uniformName.c_str());
+		// members of uniform blocks have no location
+		if (loc < 0)
+			continue;
+
+		locations[uniformName] = loc;
+
+		// arrays of basic types are reported as "name[0]", make "name" and every element resolvable
+		const std::string arraySuffix = "[0]";
+		if (uniformName.size() > arraySuffix.size() &&
+			uniformName.compare(uniformName.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0)
+		{
+			std::string base = uniformName.substr(0, uniformName.size() - arraySuffix.size());
+			locations[base] = loc;
+			for (GLint element = 1; element < size; ++element)
+			{
+				std::string elementName = base + "[" + std::to_string(element) + "]";
+				locations[elementName] = glGetUniformLocation(programId, elementName.c_str());
+			}
+		}
+	}
+}
+
+void UniformCache::forget(GLuint programId)
+{
+	programs.erase(programId);
+}
+
+GLint UniformCache::location(GLuint programId, const std::string& name) const
+{
+	auto program = programs.find(programId);
+	if (program == programs.end())
+		return -1;
+
+	auto entry = program->second.find(name);
+	return entry == program->second.end() ? -1 : entry->second;
+}
+
+std::size_t UniformCache::size() const
+{
+	std::size_t total = 0;
+	for (const auto& program : programs)
+		total += program.second.size();
+	return total;
+}
@@ -0,0 +1,54 @@
+/*
+	UniformCache.h
+	Uniform locations resolved once per linked program instead of calling glGetUniformLocation
+	every frame. Locations are keyed by program and uniform name, and handed out as typed
+	handles so the matching glUniform* call is picked at compile time.
+*/
+
+#ifndef UNIFORM_CACHE_H
+#define UNIFORM_CACHE_H
+
+#include <string>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+// Location of a uniform of type T. A location of -1 is accepted (and ignored) by GL.
+template <typename T>
+struct UniformHandle
+{
+	GLint location = -1;
+
+	bool valid() const { return location >= 0; }
+};
+
+class UniformCache
+{
+public:
+	// Reads every active uniform of a linked program into the cache
+	void build(GLuint programId);
+	// Drops the entries of a deleted program
+	void forget(GLuint programId);
+
+	// -1 when the program has no active uniform with that name
+	GLint location(GLuint programId, const std::string& name) const;
+
+	template <typename T>
+	UniformHandle<T> handle(GLuint programId, const std::string& name) const
+	{
+		UniformHandle<T> h;
+		h.location = location(programId, name);
+		return h;
+	}
+
+	// number of cached locations across all programs
+	std::size_t size() const;
+
+private:
+	std::unordered_map<GLuint, std::unordered_map<std::string, GLint>> programs;
+};
+
+// typed uniform setters, the program owning the handle must be in use
+inline void USetUniform(UniformHandle<int> h, int value) { glUniform1i(h.location, value); }
+
+#endif // UNIFORM_CACHE_H
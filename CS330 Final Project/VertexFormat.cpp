@@ -0,0 +1,141 @@
+/*
+	VertexFormat.cpp
+	Vertex packing, attribute layouts and the loadVertex() shaders of both layouts.
+*/
+
+#include "VertexFormat.h"
+
+#include <cmath>
+#include <cstddef>
+
+#include <glm/gtc/packing.hpp>
+
+#ifndef GLSL
+#define GLSL(Version, Source) "#version " #Version " core \n" #Source
+#endif
+
+namespace
+{
+	// position, normal and uv
+	const GLsizei FLOATS_PER_VERTEX = 8;
+
+	const char* const floatVertexShaderSource = GLSL(440,
+		layout(location = 0) in vec3 position;
+		layout(location = 1) in vec3 normal;
+		layout(location = 2) in vec2 textureCoordinate;
+
+		void loadVertex(uint mesh, out vec3 objectPosition, out vec3 objectNormal, out vec2 uv)
+		{
+			objectPosition = position;
+			objectNormal = normal;
+			uv = textureCoordinate;
+		}
+	);
+
+	// the attributes arrive already normalized to [0, 1] and [-1, 1], and as floats from halves
+	const char* const packedVertexShaderSource = GLSL(440,
+		layout(location = 0) in vec3 position;
+		layout(location = 1) in vec2 normal;
+		layout(location = 2) in vec2 textureCoordinate;
+
+		// bounding box of every mesh's positions, mirrored by MeshDecode in ShaderBlocks.h
+		struct MeshDecode
+		{
+			vec4 positionScale;
+			vec4 positionOffset;
+		};
+
+		layout(std430, binding = 7) readonly buffer MeshDecodeBuffer
+		{
+			MeshDecode meshDecode[];
+		};
+
+		void loadVertex(uint mesh, out vec3 objectPosition, out vec3 objectNormal, out vec2 uv)
+		{
+			objectPosition = meshDecode[mesh].positionOffset.xyz + position * meshDecode[mesh].positionScale.xyz;
+
+			// the lower hemisphere is folded over the diagonals of the square
+			vec3 n = vec3(normal, 1.0 - abs(normal.x) - abs(normal.y));
+			float fold = max(-n.z, 0.0);
+			n.x += n.x >= 0.0 ? -fold : fold;
+			n.y += n.y >= 0.0 ? -fold : fold;
+			objectNormal = normalize(n);
+
+			uv = textureCoordinate;
+		}
+	);
+
+	float USignNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+}
+
+glm::vec2 UOctahedralEncode(const glm::vec3& normal)
+{
+	float length1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+	if (length1 <= 0.0f)
+		return glm::vec2(0.0f);
+
+	glm::vec2 encoded = glm::vec2(normal.x, normal.y) / length1;
+	if (normal.z < 0.0f)
+	{
+		encoded = glm::vec2((1.0f - std::fabs(encoded.y)) * USignNotZero(encoded.x),
+			(1.0f - std::fabs(encoded.x)) * USignNotZero(encoded.y));
+	}
+	return encoded;
+}
+
+glm::vec3 UOctahedralDecode(const glm::vec2& encoded)
+{
+	glm::vec3 n(encoded.x, encoded.y, 1.0f - std::fabs(encoded.x) - std::fabs(encoded.y));
+	float fold = glm::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -fold : fold;
+	n.y += n.y >= 0.0f ? -fold : fold;
+	return glm::normalize(n);
+}
+
+PackedVertex UPackVertex(const GLfloat* vertex, const glm::vec3& positionOffset, const glm::vec3& positionScale)
+{
+	PackedVertex packed;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float unit = positionScale[axis] > 0.0f ? (vertex[axis] - positionOffset[axis]) / positionScale[axis] : 0.0f;
+		packed.position[axis] = glm::packUnorm1x16(unit);
+	}
+	packed.position[3] = 0;
+
+	glm::vec2 normal = UOctahedralEncode(glm::vec3(vertex[3], vertex[4], vertex[5]));
+	packed.normal[0] = (GLshort)glm::packSnorm1x16(normal.x);
+	packed.normal[1] = (GLshort)glm::packSnorm1x16(normal.y);
+
+	packed.uv[0] = glm::packHalf1x16(vertex[6]);
+	packed.uv[1] = glm::packHalf1x16(vertex[7]);
+	return packed;
+}
+
+void USetVertexAttributes(bool packed)
+{
+	if (packed)
+	{
+		const GLsizei stride = sizeof(PackedVertex);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, position));
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, normal));
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, uv));
+	}
+	else
+	{
+		const GLsizei stride = sizeof(GLfloat) * FLOATS_PER_VERTEX;
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * 3));
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(GLfloat) * 6));
+	}
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+}
+
+const char* UVertexFormatShaderSource(bool packed)
+{
+	return packed ? packedVertexShaderSource : floatVertexShaderSource;
+}
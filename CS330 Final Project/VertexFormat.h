@@ -0,0 +1,41 @@
+/*
+	VertexFormat.h
+	The two layouts the mesh arena can store its vertices in. The float layout is the 32-byte
+	position/normal/uv vertex every mesh is built with. The packed layout is 16 bytes: 16-bit
+	unsigned normalized positions over the mesh's bounding box, the normal octahedral encoded
+	into two 16-bit signed normalized values, and half float texture coordinates.
+
+	Each layout comes with a vertex shader object, linked next to the object vertex shader like
+	MaterialLibrary's fragment shader, whose loadVertex() decodes the attributes; the packed one
+	reads each mesh's box from the MeshDecodeBuffer storage block (see ShaderBlocks.h).
+*/
+
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+struct PackedVertex
+{
+	GLushort position[4];	// xyz over the mesh box, w unused
+	GLshort normal[2];		// octahedral
+	GLushort uv[2];			// half floats
+};
+
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay 16 bytes");
+
+// Unit vector to a point of the [-1, 1] square and back
+glm::vec2 UOctahedralEncode(const glm::vec3& normal);
+glm::vec3 UOctahedralDecode(const glm::vec2& encoded);
+
+// Packs one float vertex whose position lies in the box positionOffset + [0, 1] * positionScale
+PackedVertex UPackVertex(const GLfloat* vertex, const glm::vec3& positionOffset, const glm::vec3& positionScale);
+
+// Points attributes 0 to 2 at the bound array buffer in either layout
+void USetVertexAttributes(bool packed);
+
+// Vertex shader object defining loadVertex(mesh, position, normal, uv) for either layout
+const char* UVertexFormatShaderSource(bool packed);
+
+#endif // VERTEX_FORMAT_H